@@ -0,0 +1,109 @@
+/*
+ * bench.h - Shared helpers for the microbenchmarks
+ *
+ * Copyright (C) 2025
+ *
+ * Every benchmark prints one tab-separated line per measurement:
+ *
+ *     <benchmark>\t<metric>\t<value>\t<unit>
+ *
+ * so runs can be diffed or fed to a spreadsheet without parsing prose.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+/* Timed runs per measurement; the median is reported so one preempted
+ * run does not move the result */
+#define BENCH_RUNS 9
+
+/* CPU time of the calling thread in seconds */
+static inline double bench_cpu_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline void bench_report(const char *name, const char *metric,
+                                double value, const char *unit)
+{
+    printf("%s\t%s\t%.6g\t%s\n", name, metric, value, unit);
+    fflush(stdout);
+}
+
+static inline double bench_median(double *v, int n)
+{
+    for (int i = 1; i < n; i++)
+        for (int j = i; j > 0 && v[j] < v[j - 1]; j--) {
+            double t = v[j]; v[j] = v[j - 1]; v[j - 1] = t;
+        }
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+/* A text corpus from bench/corpus (or $BENCH_CORPUS), one message per
+ * line */
+typedef struct {
+    char **msg;
+    size_t *len;
+    int count;
+    size_t bytes;
+} BenchCorpus;
+
+static inline int bench_corpus_load(BenchCorpus *c, const char *name)
+{
+    const char *dir = getenv("BENCH_CORPUS");
+    char path[512], line[8192];
+
+    snprintf(path, sizeof(path), "%s/%s", dir ? dir : "bench/corpus", name);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    memset(c, 0, sizeof(*c));
+    while (fgets(line, sizeof(line), f)) {
+        size_t len = strcspn(line, "\n");
+        line[len] = '\0';
+        c->msg = realloc(c->msg, (c->count + 1) * sizeof(char *));
+        c->len = realloc(c->len, (c->count + 1) * sizeof(size_t));
+        if (!c->msg || !c->len || !(c->msg[c->count] = strdup(line))) {
+            fclose(f);
+            return -1;
+        }
+        c->len[c->count++] = len;
+        c->bytes += len;
+    }
+    fclose(f);
+    return c->count ? 0 : -1;
+}
+
+/* n samples of a harmonic-rich signal with a gliding pitch and a
+ * syllable-rate envelope, close enough to speech for DSP timing */
+static inline short *bench_speechlike(int n, int sample_rate)
+{
+    short *buf = malloc(n * sizeof(short));
+    if (!buf) return NULL;
+
+    double phase = 0;
+    for (int i = 0; i < n; i++) {
+        double t = (double)i / sample_rate;
+        double f0 = 140 + 40 * sin(2 * M_PI * 0.7 * t);
+        double env = 0.5 + 0.5 * sin(2 * M_PI * 4.0 * t);
+        phase += 2 * M_PI * f0 / sample_rate;
+        double v = 0;
+        for (int h = 1; h <= 8; h++)
+            v += sin(h * phase) / h;
+        buf[i] = (short)(v * env * 6000);
+    }
+    return buf;
+}
+
+#endif /* _BENCH_H */
@@ -0,0 +1,93 @@
+/*
+ * bench_callback.c - Cost of the engine's audio callback
+ *
+ * Copyright (C) 2025
+ *
+ * Appends engine-sized buffers (20000 samples) of synthetic speech to an
+ * utterance with audiobuf_append(), which is what the ECI callback does
+ * with each buffer, with no processing, with silence trimming (CHAR and
+ * KEY messages), with 2x time compression and with the DSP chain.  The
+ * callback runs on the engine's synthesis path, so time spent here is
+ * time the engine is not synthesizing.
+ */
+
+#include "bench.h"
+#include "audiobuf.h"
+
+#define SAMPLE_RATE 22050
+#define BUFFER 20000            /* audio_buffer_size in sd_viavoice.c */
+#define UTTERANCE_BUFFERS 12    /* about 11 s of audio */
+#define UTTERANCES 50
+
+/* Time one run of UTTERANCES utterances.  A fresh AudioData per
+ * utterance includes the reallocations of a first long message; reusing
+ * it is the steady state. */
+static double time_run(const short *ref, AudioStages *stages, int fresh)
+{
+    static short buf[BUFFER];
+    AudioData a = { NULL, 0, 0 };
+    double t = 0;
+
+    for (int u = 0; u < UTTERANCES; u++) {
+        if (stages->wsola)
+            wsola_reset(stages->wsola, 2.0);
+        if (stages->trim)
+            silence_reset(stages->trim, SAMPLE_RATE, -50, 10, 0);
+        if (fresh) {
+            free(a.samples);
+            a.samples = NULL;
+            a.allocated = 0;
+        }
+        a.num_samples = 0;
+
+        for (int b = 0; b < UTTERANCE_BUFFERS; b++) {
+            memcpy(buf, ref + b * BUFFER, sizeof(buf));
+            double t0 = bench_cpu_time();
+            if (audiobuf_append(&a, buf, BUFFER, stages, BUFFER) < 0)
+                return -1;
+            t += bench_cpu_time() - t0;
+        }
+    }
+    free(a.samples);
+    return t;
+}
+
+int main(void)
+{
+    short *ref = bench_speechlike(BUFFER * UTTERANCE_BUFFERS, SAMPLE_RATE);
+    WsolaState *ws = wsola_new(SAMPLE_RATE, WSOLA_MAX_SPEED);
+    SilenceTrim trim;
+    DspChain dsp;
+    if (!ref || !ws)
+        return 1;
+    dsp_chain_init(&dsp, DSP_STAGE_DC | DSP_STAGE_LIMIT, SAMPLE_RATE, 0.0);
+
+    static const struct { const char *name; int fresh; } modes[] = {
+        { "", 0 }, { "/grow", 1 },
+    };
+    struct { const char *name; AudioStages stages; } variants[] = {
+        { "callback/plain",   { NULL, NULL, NULL } },
+        { "callback/trim",    { NULL, NULL, &trim } },
+        { "callback/stretch", { NULL, ws, NULL } },
+        { "callback/dsp",     { &dsp, NULL, NULL } },
+    };
+
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++)
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            double runs[BENCH_RUNS];
+            for (int r = 0; r < BENCH_RUNS; r++)
+                if ((runs[r] = time_run(ref, &variants[v].stages, modes[m].fresh)) < 0)
+                    return 1;
+            double t = bench_median(runs, BENCH_RUNS);
+            double calls = (double)UTTERANCES * UTTERANCE_BUFFERS;
+
+            char name[64];
+            snprintf(name, sizeof(name), "%s%s", variants[v].name, modes[m].name);
+            bench_report(name, "throughput", calls * BUFFER / t / 1e6, "Msamples/s");
+            bench_report(name, "latency", t / calls * 1e6, "us/callback");
+        }
+
+    wsola_free(ws);
+    free(ref);
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * bench_dsp.c - Throughput of the post-synthesis DSP kernels
+ *
+ * Copyright (C) 2025
+ *
+ * Runs each stage over engine-sized buffers (20000 samples) of
+ * synthetic speech and reports samples processed per CPU second, the
+ * median of BENCH_RUNS runs.  dsp/level is the loudness measurement
+ * that calibrates dsp/normalize, not part of the chain.
+ */
+
+#include <string.h>
+
+#include "bench.h"
+#include "dsp.h"
+
+#define SAMPLE_RATE 22050
+#define CHUNK 20000
+#define MIN_RUN 0.02    /* CPU seconds per timed run */
+
+typedef void (*StageFn)(short *buf, int n);
+
+static DspChain chain;
+static volatile long long sink;
+
+static void run_dc(short *buf, int n)        { chain.stages = DSP_STAGE_DC; chain.dc = 37.0f; dsp_chain_process(&chain, buf, n); }
+static void run_gain(short *buf, int n)      { dsp_gain(buf, n, 4096 + 512); }
+static void run_normalize(short *buf, int n) { chain.stages = DSP_STAGE_NORMALIZE; chain.normalize = 1.4f; dsp_chain_process(&chain, buf, n); }
+static void run_level(short *buf, int n)     { sink += (long long)dsp_level_db(buf, n, SAMPLE_RATE); }
+static void run_limit(short *buf, int n)     { dsp_soft_limit(buf, n, 1.5f, 0.9f); }
+static void run_energy(short *buf, int n)    { sink += dsp_sum_squares(buf, n); }
+
+/* CPU time of passes chunks through fn, each from a fresh copy of ref */
+static double time_passes(StageFn fn, const short *ref, short *buf, int passes)
+{
+    double elapsed = 0;
+    for (int p = 0; p < passes; p++) {
+        memcpy(buf, ref, CHUNK * sizeof(short));
+        double t0 = bench_cpu_time();
+        fn(buf, CHUNK);
+        elapsed += bench_cpu_time() - t0;
+    }
+    return elapsed;
+}
+
+int main(void)
+{
+    static const struct { const char *name; StageFn fn; } stages[] = {
+        { "dsp/dc",        run_dc },
+        { "dsp/gain",      run_gain },
+        { "dsp/normalize", run_normalize },
+        { "dsp/level",     run_level },
+        { "dsp/limit",     run_limit },
+        { "dsp/energy",    run_energy },
+    };
+    short *ref = bench_speechlike(CHUNK, SAMPLE_RATE);
+    short buf[CHUNK];
+    if (!ref) return 1;
+
+    dsp_chain_init(&chain, 0, SAMPLE_RATE, 0.0);
+
+    for (size_t s = 0; s < sizeof(stages) / sizeof(stages[0]); s++) {
+        double runs[BENCH_RUNS];
+        int passes = 1;
+
+        while (time_passes(stages[s].fn, ref, buf, passes) < MIN_RUN)
+            passes *= 2;
+        for (int r = 0; r < BENCH_RUNS; r++)
+            runs[r] = time_passes(stages[s].fn, ref, buf, passes);
+
+        double elapsed = bench_median(runs, BENCH_RUNS);
+        double samples = (double)CHUNK * passes;
+        bench_report(stages[s].name, "throughput", samples / elapsed / 1e6, "Msamples/s");
+        bench_report(stages[s].name, "rtf", elapsed / (samples / SAMPLE_RATE), "cpu_s/audio_s");
+    }
+
+    free(ref);
+    return 0;
+}
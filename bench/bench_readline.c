@@ -0,0 +1,112 @@
+/*
+ * bench_readline.c - Line splitting of the SSIP input stream
+ *
+ * Copyright (C) 2025
+ *
+ * Wraps every corpus message in a SPEAK command, as the server sends it,
+ * and writes the stream into a pipe in 4 KB writes from another thread.
+ * module_readline() splits it back into lines; the CPU time of the
+ * reading thread is reported per byte and per line.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "spd_module_main.h"
+
+#define MIN_BYTES (4 << 20)     /* stream size per timed run */
+#define WRITE_SIZE 4096
+
+typedef struct {
+    int fd;
+    const char *stream;
+    size_t size;
+    int passes;
+} Writer;
+
+static void *writer_thread(void *arg)
+{
+    Writer *w = arg;
+
+    for (int p = 0; p < w->passes; p++)
+        for (size_t pos = 0; pos < w->size; ) {
+            size_t n = w->size - pos < WRITE_SIZE ? w->size - pos : WRITE_SIZE;
+            ssize_t ret = write(w->fd, w->stream + pos, n);
+            if (ret <= 0)
+                return NULL;
+            pos += ret;
+        }
+    close(w->fd);
+    return NULL;
+}
+
+/* Read passes copies of the stream; returns reader CPU seconds, or -1
+ * if the lines did not come back as sent */
+static double time_passes(const char *stream, size_t size, int lines, int passes)
+{
+    int fds[2];
+    pthread_t thread;
+
+    if (pipe(fds) != 0)
+        return -1;
+    Writer w = { fds[1], stream, size, passes };
+    if (pthread_create(&thread, NULL, writer_thread, &w) != 0)
+        return -1;
+
+    long got = 0;
+    double t0 = bench_cpu_time();
+    for (long i = 0; i < (long)lines * passes; i++) {
+        char *line = module_readline(fds[0], 1);
+        if (!line)
+            break;
+        got += line[0] != '\0';
+        free(line);
+    }
+    double t = bench_cpu_time() - t0;
+
+    pthread_join(thread, NULL);
+    close(fds[0]);
+    return got == (long)lines * passes ? t : -1;
+}
+
+int main(void)
+{
+    static const char *corpora[] = { "web.ssml", "code.txt", "chat.txt", "chars.txt" };
+
+    for (size_t k = 0; k < sizeof(corpora) / sizeof(corpora[0]); k++) {
+        BenchCorpus c;
+        if (bench_corpus_load(&c, corpora[k]) != 0)
+            return 1;
+
+        /* SPEAK\n<message>\n.\n per message */
+        size_t size = c.bytes + c.count * (sizeof("SPEAK\n") - 1 + 1 + 2);
+        char *stream = malloc(size + 1), *p = stream;
+        if (!stream)
+            return 1;
+        for (int i = 0; i < c.count; i++)
+            p += sprintf(p, "SPEAK\n%s\n.\n", c.msg[i]);
+        int lines = c.count * 3;
+        int passes = MIN_BYTES / size + 1;
+
+        double runs[BENCH_RUNS];
+        for (int r = 0; r < BENCH_RUNS; r++)
+            if ((runs[r] = time_passes(stream, size, lines, passes)) < 0) {
+                fprintf(stderr, "%s: lines lost or split\n", corpora[k]);
+                return 1;
+            }
+        double t = bench_median(runs, BENCH_RUNS);
+
+        char name[64];
+        snprintf(name, sizeof(name), "readline/%.*s", (int)strcspn(corpora[k], "."), corpora[k]);
+        bench_report(name, "throughput", (double)size * passes / t / 1e6, "MB/s");
+        bench_report(name, "latency", t / ((double)lines * passes) * 1e9, "ns/line");
+
+        for (int i = 0; i < c.count; i++)
+            free(c.msg[i]);
+        free(c.msg);
+        free(c.len);
+        free(stream);
+    }
+    return 0;
+}
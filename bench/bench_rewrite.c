@@ -0,0 +1,189 @@
+/*
+ * bench_rewrite.c - Rewrite rule compile time and matching throughput
+ *
+ * Copyright (C) 2025
+ *
+ * Compiles config/main.dict and generated sets of 10k and 50k rules,
+ * times mapping each back from a compiled image, then rewrites each
+ * stripped corpus one message at a time, as the module does.  The
+ * automaton makes one table lookup per byte, so throughput should not
+ * drop as the rule set grows.
+ */
+
+#include <unistd.h>
+
+#include "bench.h"
+#include "text.h"
+#include "rewrite.h"
+
+#define MIN_RUN 0.02    /* CPU seconds per timed run */
+
+/* Write count random word rules to a temporary file; returns its path */
+static char *make_rules(int count)
+{
+    static char path[32];
+    unsigned int seed = 12345;
+
+    strcpy(path, "/tmp/bench_rewrite_XXXXXX");
+    int fd = mkstemp(path);
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!f)
+        return NULL;
+
+    for (int i = 0; i < count; i++) {
+        int len = 4 + i % 7;
+        for (int k = 0; k < len; k++) {
+            seed = seed * 1103515245 + 12345;
+            fputc('a' + (seed >> 16) % 26, f);
+        }
+        fprintf(f, "\treplacement %d\n", i);
+    }
+    fclose(f);
+    return path;
+}
+
+/* Overlapping rules, where the leftmost longest match leaves a shorter
+ * one that ends at the same place as a longer one to apply.  The
+ * throughput numbers mean nothing if matching is wrong. */
+static int check_overlaps(void)
+{
+    static const char rules[] = "new york\tNY\nyork city\tYC\ncity\tTOWN\n";
+    static const char text[] = "new york city", want[] = "NY TOWN";
+    char path[] = "/tmp/bench_rewrite_check_XXXXXX";
+    const char *p = path;
+    int fd = mkstemp(path), matches;
+
+    if (fd < 0 || write(fd, rules, sizeof(rules) - 1) != sizeof(rules) - 1) {
+        perror(path);
+        return -1;
+    }
+    close(fd);
+    Rewriter *rw = rewrite_load(&p, 1);
+    unlink(path);
+    char *got = rw ? rewrite_apply(rw, text, &matches) : NULL;
+    int ok = got && strcmp(got, want) == 0;
+    if (!ok)
+        fprintf(stderr, "rewrite: \"%s\" gave \"%s\", not \"%s\"\n",
+                text, got ? got : "(error)", want);
+    free(got);
+    rewrite_free(rw);
+    return ok ? 0 : -1;
+}
+
+static double time_passes(const Rewriter *rw, const BenchCorpus *c, int passes)
+{
+    double t0 = bench_cpu_time();
+    for (int p = 0; p < passes; p++)
+        for (int i = 0; i < c->count; i++) {
+            int matches;
+            free(rewrite_apply(rw, c->msg[i], &matches));
+        }
+    return bench_cpu_time() - t0;
+}
+
+static void measure(const char *name, const Rewriter *rw, const BenchCorpus *c)
+{
+    double runs[BENCH_RUNS];
+    int passes = 1;
+
+    while (time_passes(rw, c, passes) < MIN_RUN)
+        passes *= 2;
+    for (int r = 0; r < BENCH_RUNS; r++)
+        runs[r] = time_passes(rw, c, passes);
+
+    double t = bench_median(runs, BENCH_RUNS);
+    bench_report(name, "throughput", (double)c->bytes * passes / t / 1e6, "MB/s");
+    bench_report(name, "latency", t / ((double)c->count * passes) * 1e9, "ns/msg");
+}
+
+int main(void)
+{
+    static const char *corpora[] = { "web.ssml", "code.txt", "chat.txt" };
+    static const struct { const char *name; int generate; } sets[] = {
+        { "main.dict", 0 },
+        { "10k", 10000 },
+        { "50k", 50000 },
+    };
+    BenchCorpus stripped[3];
+
+    if (check_overlaps() != 0)
+        return 1;
+
+    for (int k = 0; k < 3; k++) {
+        BenchCorpus raw;
+        if (bench_corpus_load(&raw, corpora[k]) != 0)
+            return 1;
+        stripped[k] = raw;
+        stripped[k].bytes = 0;
+        for (int i = 0; i < raw.count; i++) {
+            char *text = strip_ssml(raw.msg[i], raw.len[i]);
+            free(raw.msg[i]);
+            raw.msg[i] = text;
+            stripped[k].len[i] = strlen(text);
+            stripped[k].bytes += stripped[k].len[i];
+        }
+    }
+
+    for (size_t s = 0; s < sizeof(sets) / sizeof(sets[0]); s++) {
+        const char *path = sets[s].generate ? make_rules(sets[s].generate) : "config/main.dict";
+        if (!path)
+            return 1;
+
+        double runs[BENCH_RUNS];
+        Rewriter *rw = NULL;
+        for (int r = 0; r < BENCH_RUNS; r++) {
+            rewrite_free(rw);
+            double t0 = bench_cpu_time();
+            rw = rewrite_load(&path, 1);
+            runs[r] = bench_cpu_time() - t0;
+            if (!rw) {
+                perror(path);
+                return 1;
+            }
+        }
+        double compile_time = bench_median(runs, BENCH_RUNS);
+
+        /* The image's mapping is what a module start costs instead,
+         * with one pass over its tables to check their indexes */
+        char image[] = "/tmp/bench_rewrite_image_XXXXXX";
+        int fd = mkstemp(image);
+        if (fd < 0 || rewrite_save(rw, image, &path, 1) != 0) {
+            perror(image);
+            return 1;
+        }
+        close(fd);
+        for (int r = 0; r < BENCH_RUNS; r++) {
+            int how;
+            double t0 = bench_cpu_time();
+            Rewriter *mapped = rewrite_open(image, &how);
+            runs[r] = bench_cpu_time() - t0;
+            if (!mapped || how != REWRITE_IMAGE) {
+                fprintf(stderr, "%s: not mapped\n", image);
+                return 1;
+            }
+            rewrite_free(mapped);
+        }
+        unlink(image);
+        if (sets[s].generate)
+            unlink(path);
+
+        char name[64];
+        int rules, states;
+        size_t bytes;
+        rewrite_size(rw, &rules, &states, &bytes);
+        snprintf(name, sizeof(name), "rewrite/compile/%s", sets[s].name);
+        bench_report(name, "rules", rules, "rules");
+        bench_report(name, "latency", compile_time * 1e3, "ms");
+        bench_report(name, "table", bytes / 1024.0, "KiB");
+        snprintf(name, sizeof(name), "rewrite/map/%s", sets[s].name);
+        bench_report(name, "latency", bench_median(runs, BENCH_RUNS) * 1e3, "ms");
+
+        for (int k = 0; k < 3; k++) {
+            snprintf(name, sizeof(name), "rewrite/%s/%.*s", sets[s].name,
+                     (int)strcspn(corpora[k], "."), corpora[k]);
+            measure(name, rw, &stripped[k]);
+        }
+        rewrite_free(rw);
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * bench_send.c - HDLC escaping and framing of audio sent to the server
+ *
+ * Copyright (C) 2025
+ *
+ * Pushes audio through module_tts_output_server(), which frames it in
+ * 10000-byte 705 AUDIO blocks and escapes newlines and 0x7d, with
+ * stdout on /dev/null.  Silence has nothing to escape; speech-like
+ * audio and white noise have about one byte in a hundred.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "spd_module_main.h"
+
+#define SAMPLE_RATE 22050
+#define SECONDS 5
+#define CHUNK_BYTES 10000   /* MAX_CHUNK in module_process.c */
+
+/* The rest of the module is not needed here */
+int module_set(const char *var, const char *val)          { (void)var; (void)val; return 0; }
+int module_audio_set(const char *var, const char *val)    { (void)var; (void)val; return 0; }
+int module_audio_init(char **status)                      { (void)status; return 0; }
+int module_loglevel_set(const char *var, const char *val) { (void)var; (void)val; return 0; }
+int module_debug(int enable, const char *file)            { (void)enable; (void)file; return 0; }
+SPDVoice **module_list_voices(void)                       { return NULL; }
+size_t module_pause(void)                                 { return 0; }
+int module_stop(void)                                     { return 0; }
+int module_close(void)                                    { return 0; }
+
+static double time_send(const AudioTrack *track)
+{
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+
+    double t0 = bench_cpu_time();
+    module_tts_output_server(track, SPD_AUDIO_LE);
+    double t = bench_cpu_time() - t0;
+
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    return t;
+}
+
+int main(void)
+{
+    int n = SAMPLE_RATE * SECONDS;
+    short *speech = bench_speechlike(n, SAMPLE_RATE);
+    short *noise = malloc(n * sizeof(short));
+    short *silence = calloc(n, sizeof(short));
+    if (!speech || !noise || !silence)
+        return 1;
+
+    unsigned int seed = 1;
+    for (int i = 0; i < n; i++) {
+        seed = seed * 1103515245 + 12345;
+        noise[i] = (short)(seed >> 16);
+    }
+
+    /* Nothing arrives on stdin between chunks, but it stays open */
+    int fds[2];
+    if (pipe(fds) != 0 || dup2(fds[0], STDIN_FILENO) < 0)
+        return 1;
+
+    static const char *names[] = { "send/speech", "send/silence", "send/noise" };
+    short *signals[] = { speech, silence, noise };
+
+    for (int s = 0; s < 3; s++) {
+        AudioTrack track = { 16, 1, SAMPLE_RATE, n, signals[s] };
+        double runs[BENCH_RUNS];
+        long escapes = 0;
+
+        for (int r = 0; r < BENCH_RUNS; r++)
+            runs[r] = time_send(&track);
+        double t = bench_median(runs, BENCH_RUNS);
+
+        const unsigned char *b = (const unsigned char *)signals[s];
+        for (size_t i = 0; i < n * sizeof(short); i++)
+            escapes += b[i] == '\n' || b[i] == 0x7d;
+
+        double bytes = (double)n * sizeof(short);
+        bench_report(names[s], "throughput", bytes / t / 1e6, "MB/s");
+        bench_report(names[s], "latency", t / (bytes / CHUNK_BYTES) * 1e6, "us/chunk");
+        bench_report(names[s], "escaped", escapes / (bytes / 1024), "bytes/KB");
+    }
+
+    free(speech);
+    free(noise);
+    free(silence);
+    return 0;
+}
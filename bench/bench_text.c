@@ -0,0 +1,116 @@
+/*
+ * bench_text.c - Throughput and latency of the text clean-up functions
+ *
+ * Copyright (C) 2025
+ *
+ * Feeds each corpus in bench/corpus through strip_ssml(),
+ * decode_xml_entities(), transliterate() and sanitize_for_viavoice()
+ * one message at a time, as the module does, and reports bytes per CPU
+ * second and CPU time per message.  Sanitizing runs with punctuation
+ * mode "none" and again with "all", which speaks every symbol as a
+ * word.  Transliterating and sanitizing get their input already
+ * stripped, like in the module.  intl.txt is mostly accented and
+ * non-Latin text, the worst case for transliteration.  chars.txt also
+ * goes through the CHAR message path, char_name() with
+ * sanitize_for_viavoice() for characters without a name.
+ */
+
+#include "bench.h"
+#include "text.h"
+#include "charname.h"
+
+#define MIN_RUN 0.02    /* CPU seconds per timed run */
+
+typedef void (*TextFn)(const BenchCorpus *c, int i);
+
+static char scratch[8192];
+
+static void run_strip(const BenchCorpus *c, int i)    { free(strip_ssml(c->msg[i], c->len[i])); }
+static void run_translit(const BenchCorpus *c, int i) { free(transliterate(c->msg[i])); }
+static void run_sanitize(const BenchCorpus *c, int i) { free(sanitize_for_viavoice(c->msg[i], PUNCT_NONE)); }
+static void run_sanitize_all(const BenchCorpus *c, int i) { free(sanitize_for_viavoice(c->msg[i], PUNCT_ALL)); }
+static void run_char(const BenchCorpus *c, int i)
+{
+    const char *name = (unsigned char)c->msg[i][0] >= 0x80 ? char_name(c->msg[i]) : NULL;
+    free(name ? strdup(name) : sanitize_for_viavoice(c->msg[i], PUNCT_ALL));
+}
+static void run_decode(const BenchCorpus *c, int i)
+{
+    memcpy(scratch, c->msg[i], c->len[i] + 1);
+    decode_xml_entities(scratch);
+}
+
+static double time_passes(TextFn fn, const BenchCorpus *c, int passes)
+{
+    double t0 = bench_cpu_time();
+    for (int p = 0; p < passes; p++)
+        for (int i = 0; i < c->count; i++)
+            fn(c, i);
+    return bench_cpu_time() - t0;
+}
+
+static void measure(const char *name, TextFn fn, const BenchCorpus *c)
+{
+    double runs[BENCH_RUNS];
+    int passes = 1;
+
+    while (time_passes(fn, c, passes) < MIN_RUN)
+        passes *= 2;
+    for (int r = 0; r < BENCH_RUNS; r++)
+        runs[r] = time_passes(fn, c, passes);
+
+    double t = bench_median(runs, BENCH_RUNS);
+    bench_report(name, "throughput", (double)c->bytes * passes / t / 1e6, "MB/s");
+    bench_report(name, "latency", t / ((double)c->count * passes) * 1e9, "ns/msg");
+}
+
+int main(void)
+{
+    static const char *corpora[] = { "web.ssml", "code.txt", "chat.txt", "chars.txt", "intl.txt" };
+    static const struct { const char *name; TextFn fn; int stripped; const char *only; } stages[] = {
+        { "strip_ssml",      run_strip,    0, NULL },
+        { "decode_entities", run_decode,   0, NULL },
+        { "transliterate",   run_translit, 1, NULL },
+        { "sanitize",        run_sanitize, 1, NULL },
+        { "sanitize_all",    run_sanitize_all, 1, NULL },
+        { "char_name",       run_char,     1, "chars.txt" },
+    };
+
+    for (size_t k = 0; k < sizeof(corpora) / sizeof(corpora[0]); k++) {
+        BenchCorpus raw, stripped;
+        if (bench_corpus_load(&raw, corpora[k]) != 0)
+            return 1;
+
+        stripped = raw;
+        stripped.msg = malloc(raw.count * sizeof(char *));
+        stripped.len = malloc(raw.count * sizeof(size_t));
+        stripped.bytes = 0;
+        if (!stripped.msg || !stripped.len)
+            return 1;
+        for (int i = 0; i < raw.count; i++) {
+            stripped.msg[i] = strip_ssml(raw.msg[i], raw.len[i]);
+            stripped.len[i] = strlen(stripped.msg[i]);
+            stripped.bytes += stripped.len[i];
+        }
+
+        char corpus[32];
+        snprintf(corpus, sizeof(corpus), "%.*s", (int)strcspn(corpora[k], "."), corpora[k]);
+        for (size_t s = 0; s < sizeof(stages) / sizeof(stages[0]); s++) {
+            char name[64];
+            if (stages[s].only && strcmp(stages[s].only, corpora[k]) != 0)
+                continue;
+            snprintf(name, sizeof(name), "text/%s/%s", stages[s].name, corpus);
+            measure(name, stages[s].fn, stages[s].stripped ? &stripped : &raw);
+        }
+
+        for (int i = 0; i < raw.count; i++) {
+            free(raw.msg[i]);
+            free(stripped.msg[i]);
+        }
+        free(raw.msg);
+        free(raw.len);
+        free(stripped.msg);
+        free(stripped.len);
+    }
+    return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * bench_wsola.c - Real-time factor of the WSOLA time compressor
+ *
+ * Copyright (C) 2025
+ *
+ * Compresses 60 seconds of synthetic voiced speech on a single core and
+ * reports CPU seconds spent per second of input audio.
+ */
+
+#include "bench.h"
+#include "wsola.h"
+
+#define SAMPLE_RATE 22050
+#define SECONDS 60
+#define CHUNK 2048
+
+int main(void)
+{
+    static const double speeds[] = { 1.5, 2.0, 3.0 };
+    int n = SAMPLE_RATE * SECONDS;
+    short *in = bench_speechlike(n, SAMPLE_RATE);
+    if (!in) return 1;
+
+    WsolaState *ws = wsola_new(SAMPLE_RATE, WSOLA_MAX_SPEED);
+    short *out = malloc(wsola_max_output(ws, CHUNK) * sizeof(short));
+    if (!ws || !out) return 1;
+
+    for (size_t s = 0; s < sizeof(speeds) / sizeof(speeds[0]); s++) {
+        char name[32];
+        long produced = 0;
+
+        snprintf(name, sizeof(name), "wsola/%.1fx", speeds[s]);
+        wsola_reset(ws, speeds[s]);
+
+        double t0 = bench_cpu_time();
+        for (int pos = 0; pos < n; pos += CHUNK) {
+            int len = n - pos < CHUNK ? n - pos : CHUNK;
+            produced += wsola_process(ws, in + pos, len, out);
+        }
+        produced += wsola_flush(ws, out);
+        double cpu = bench_cpu_time() - t0;
+
+        bench_report(name, "rtf", cpu / SECONDS, "cpu_s/audio_s");
+        bench_report(name, "output_ratio", (double)produced / n, "ratio");
+    }
+
+    wsola_free(ws);
+    free(out);
+    free(in);
+    return 0;
+}
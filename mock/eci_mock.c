@@ -0,0 +1,608 @@
+/*
+ * eci_mock.c - Stand-in for libibmeci50.so
+ *
+ * Copyright (C) 2025
+ *
+ * Implements the ECI API from eci_viavoice.h without the IBM engine, so
+ * the module can be built, tested and profiled on any Linux box.  Text
+ * is "synthesized" into a deterministic waveform: every letter or digit
+ * becomes a short tone whose pitch depends on the character, everything
+ * else becomes silence.  Audio is delivered through the registered
+ * callback in output-buffer-sized chunks, with index replies at the
+ * positions eciInsertIndex() put them, much like the real engine.
+ *
+ * Behaviour is tuned through the environment:
+ *
+ *   ECIMOCK_MS_PER_CHAR      audio per character at speed 50 (default 60)
+ *   ECIMOCK_US_PER_CHAR      CPU time burnt per character (default 0)
+ *   ECIMOCK_CHUNK            max samples per callback (default: buffer size)
+ *   ECIMOCK_SILENCE_MS       silence before and after each utterance (default 150)
+ *   ECIMOCK_INDEX            0 to never send index replies (default 1)
+ *   ECIMOCK_US_PER_DICT_ENTRY  CPU time per dictionary line loaded (default 0)
+ *   ECIMOCK_TEXT_LOG         file every eciAddText() text is appended to,
+ *                            as given, for tests to check (default: none)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "eci_viavoice.h"
+
+typedef struct {
+    int type;               /* ITEM_TEXT or ITEM_INDEX */
+    char *text;
+    int index;
+} Item;
+
+enum { ITEM_TEXT, ITEM_INDEX };
+
+typedef struct {
+    ECICallback callback;
+    void *callback_data;
+    short *buffer;
+    int buffer_size;
+    int params[eciNumParams];
+    int voices[ECI_PRESET_VOICES + ECI_USER_DEFINED_VOICES][eciNumVoiceParams];
+    ECIDictHand dict;
+
+    /* Input queue */
+    Item *items;
+    int num_items;
+    int alloc_items;
+
+    /* Synthesis progress */
+    int synthesizing;
+    int item;               /* current item */
+    int offset;             /* character within the current text item */
+    int char_sample;        /* sample within the current character */
+    int lead;               /* leading silence still to produce */
+    int trail;              /* trailing silence still to produce */
+    int fill;               /* samples waiting in buffer */
+    int paused;
+} MockEngine;
+
+typedef struct {
+    int entries[3];
+} MockDict;
+
+/* eci.ini defaults: gender, head size, pitch, fluctuation, roughness,
+ * breathiness, speed, volume */
+static const int preset_voices[ECI_PRESET_VOICES][eciNumVoiceParams] = {
+    { 0, 50, 65, 30, 0, 0, 50, 92 },
+    { 1, 50, 81, 30, 0, 50, 50, 95 },
+    { 1, 22, 93, 35, 0, 0, 50, 95 },
+    { 0, 86, 56, 47, 0, 0, 50, 93 },
+    { 0, 50, 69, 34, 0, 0, 70, 92 },
+    { 1, 56, 89, 35, 0, 40, 70, 95 },
+    { 1, 45, 68, 30, 3, 40, 50, 90 },
+    { 0, 30, 61, 44, 18, 20, 50, 89 },
+};
+
+static int env_int(const char *name, int def)
+{
+    const char *v = getenv(name);
+    return v && *v ? atoi(v) : def;
+}
+
+static void burn_cpu(int usec)
+{
+    if (usec <= 0)
+        return;
+    struct timespec start, now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    do {
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    } while ((now.tv_sec - start.tv_sec) * 1000000L +
+             (now.tv_nsec - start.tv_nsec) / 1000 < usec);
+}
+
+static int sample_rate(MockEngine *e)
+{
+    switch (e->params[eciSampleRate]) {
+        case 0: return 8000;
+        case 1: return 11025;
+        default: return 22050;
+    }
+}
+
+static int samples_per_char(MockEngine *e)
+{
+    int speed = e->voices[0][eciSpeed];
+    int ms = env_int("ECIMOCK_MS_PER_CHAR", 60) * 100 / (speed + 50);
+    return sample_rate(e) * ms / 1000;
+}
+
+static void clear_input(MockEngine *e)
+{
+    for (int i = 0; i < e->num_items; i++)
+        free(e->items[i].text);
+    e->num_items = 0;
+    e->synthesizing = 0;
+    e->item = e->offset = e->char_sample = 0;
+    e->lead = e->trail = e->fill = 0;
+}
+
+static ECIBoolean add_item(MockEngine *e, int type, const char *text, int index)
+{
+    if (e->num_items == e->alloc_items) {
+        int n = e->alloc_items ? e->alloc_items * 2 : 16;
+        Item *items = realloc(e->items, n * sizeof(Item));
+        if (!items)
+            return false;
+        e->items = items;
+        e->alloc_items = n;
+    }
+    Item *it = &e->items[e->num_items];
+    it->type = type;
+    it->text = text ? strdup(text) : NULL;
+    it->index = index;
+    if (text && !it->text)
+        return false;
+    e->num_items++;
+    return true;
+}
+
+/* Hand the buffered samples to the client.  Returns 0 if it asked us
+ * to stop. */
+static int deliver(MockEngine *e)
+{
+    if (!e->fill)
+        return 1;
+    int n = e->fill;
+    e->fill = 0;
+    if (e->callback &&
+        e->callback(e, eciWaveformBuffer, n, e->callback_data) == eciDataNotProcessed)
+        return 0;
+    return 1;
+}
+
+static short char_sample(MockEngine *e, unsigned char c, int i, int len)
+{
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+        return 0;
+
+    double freq = 120.0 + (c % 32) * 12.0 + e->voices[0][eciPitchBaseline];
+    double amp = 80.0 * e->voices[0][eciVolume];
+    int fade = len / 8 + 1;
+    double env = 1.0;
+    if (i < fade) env = (double)i / fade;
+    else if (i > len - fade) env = (double)(len - i) / fade;
+    return (short)(amp * env * sin(2 * M_PI * freq * i / sample_rate(e)));
+}
+
+/* Produce up to one buffer of audio.  Returns 1 while there is more to
+ * do, 0 when the utterance is finished or was stopped. */
+static int synth_step(MockEngine *e)
+{
+    int chunk = env_int("ECIMOCK_CHUNK", e->buffer_size);
+    int cost = env_int("ECIMOCK_US_PER_CHAR", 0);
+    int want_index = env_int("ECIMOCK_INDEX", 1);
+    int per_char = samples_per_char(e);
+
+    if (!e->synthesizing || !e->buffer)
+        return 0;
+    if (chunk > e->buffer_size || chunk <= 0)
+        chunk = e->buffer_size;
+
+    while (e->fill < chunk) {
+        if (e->lead > 0) {
+            e->buffer[e->fill++] = 0;
+            e->lead--;
+            continue;
+        }
+        if (e->item >= e->num_items) {
+            if (e->trail > 0) {
+                e->buffer[e->fill++] = 0;
+                e->trail--;
+                continue;
+            }
+            int ok = deliver(e);
+            clear_input(e);
+            (void)ok;
+            return 0;
+        }
+
+        Item *it = &e->items[e->item];
+        if (it->type == ITEM_INDEX) {
+            /* Flush the audio preceding the index first */
+            if (!deliver(e)) {
+                clear_input(e);
+                return 0;
+            }
+            e->item++;
+            if (want_index && e->callback &&
+                e->callback(e, eciIndexReply, it->index, e->callback_data) == eciDataNotProcessed) {
+                clear_input(e);
+                return 0;
+            }
+            continue;
+        }
+
+        unsigned char c = it->text[e->offset];
+        if (!c) {
+            e->item++;
+            e->offset = 0;
+            continue;
+        }
+        if (e->char_sample == 0)
+            burn_cpu(cost);
+        e->buffer[e->fill++] = char_sample(e, c, e->char_sample, per_char);
+        if (++e->char_sample >= per_char) {
+            e->char_sample = 0;
+            e->offset++;
+        }
+    }
+
+    if (!deliver(e)) {
+        clear_input(e);
+        return 0;
+    }
+    return 1;
+}
+
+ECIHand eciNew(void)
+{
+    MockEngine *e = calloc(1, sizeof(*e));
+    if (!e)
+        return NULL_ECI_HAND;
+    e->params[eciSampleRate] = 1;
+    e->params[eciLanguageDialect] = eciGeneralAmericanEnglish;
+    for (int v = 0; v < ECI_PRESET_VOICES; v++)
+        memcpy(e->voices[v], preset_voices[v], sizeof(preset_voices[v]));
+    return e;
+}
+
+ECIHand eciDelete(ECIHand h)
+{
+    MockEngine *e = h;
+    if (e) {
+        clear_input(e);
+        free(e->items);
+        free(e);
+    }
+    return NULL_ECI_HAND;
+}
+
+ECIBoolean eciReset(ECIHand h)
+{
+    clear_input(h);
+    return true;
+}
+
+void eciVersion(char *buffer)
+{
+    strcpy(buffer, "5.1 (mock)");
+}
+
+int eciProgStatus(ECIHand h)
+{
+    (void)h;
+    return 0;
+}
+
+void eciErrorMessage(ECIHand h, char *buffer)
+{
+    (void)h;
+    buffer[0] = '\0';
+}
+
+void eciClearErrors(ECIHand h)
+{
+    (void)h;
+}
+
+ECIBoolean eciTestPhrase(ECIHand h)
+{
+    (void)h;
+    return true;
+}
+
+ECIBoolean eciSpeakText(ECIInputText text, ECIBoolean annotations)
+{
+    (void)text;
+    (void)annotations;
+    return false;
+}
+
+int eciGetParam(ECIHand h, ECIParam p)
+{
+    MockEngine *e = h;
+    if (p < 0 || p >= eciNumParams)
+        return -1;
+    return e->params[p];
+}
+
+int eciSetParam(ECIHand h, ECIParam p, int value)
+{
+    MockEngine *e = h;
+    if (p < 0 || p >= eciNumParams)
+        return -1;
+    if (p == eciSampleRate && (value < 0 || value > 2))
+        return -1;
+    int old = e->params[p];
+    e->params[p] = value;
+    return old;
+}
+
+ECIBoolean eciCopyVoice(ECIHand h, int from, int to)
+{
+    MockEngine *e = h;
+    int n = ECI_PRESET_VOICES + ECI_USER_DEFINED_VOICES;
+    if (from < 0 || from >= n || to < 0 || to >= n)
+        return false;
+    memcpy(e->voices[to], e->voices[from], sizeof(e->voices[0]));
+    return true;
+}
+
+ECIBoolean eciGetVoiceName(ECIHand h, int voice, char *name)
+{
+    (void)h;
+    snprintf(name, ECI_VOICE_NAME_LENGTH + 1, "Mock %d", voice);
+    return true;
+}
+
+ECIBoolean eciSetVoiceName(ECIHand h, int voice, const char *name)
+{
+    (void)h;
+    (void)voice;
+    (void)name;
+    return true;
+}
+
+int eciGetVoiceParam(ECIHand h, int voice, ECIVoiceParam p)
+{
+    MockEngine *e = h;
+    if (voice < 0 || voice >= ECI_PRESET_VOICES + ECI_USER_DEFINED_VOICES ||
+        p < 0 || p >= eciNumVoiceParams)
+        return -1;
+    return e->voices[voice][p];
+}
+
+int eciSetVoiceParam(ECIHand h, int voice, ECIVoiceParam p, int value)
+{
+    MockEngine *e = h;
+    if (voice < 0 || voice >= ECI_PRESET_VOICES + ECI_USER_DEFINED_VOICES ||
+        p < 0 || p >= eciNumVoiceParams)
+        return -1;
+    int old = e->voices[voice][p];
+    e->voices[voice][p] = value;
+    return old;
+}
+
+ECIBoolean eciAddText(ECIHand h, ECIInputText text)
+{
+    if (!text)
+        return false;
+    const char *log = getenv("ECIMOCK_TEXT_LOG");
+    FILE *f = log && *log ? fopen(log, "a") : NULL;
+    if (f) {
+        fputs(text, f);
+        fclose(f);
+    }
+    return add_item(h, ITEM_TEXT, text, 0);
+}
+
+ECIBoolean eciInsertIndex(ECIHand h, int index)
+{
+    return add_item(h, ITEM_INDEX, NULL, index);
+}
+
+ECIBoolean eciSynthesize(ECIHand h)
+{
+    MockEngine *e = h;
+    if (!e->synthesizing) {
+        int rate = sample_rate(e);
+        e->synthesizing = 1;
+        e->lead = rate * env_int("ECIMOCK_SILENCE_MS", 150) / 1000;
+        e->trail = e->lead;
+    }
+    return true;
+}
+
+ECIBoolean eciSynthesizeFile(ECIHand h, const char *filename)
+{
+    (void)h;
+    (void)filename;
+    return false;
+}
+
+ECIBoolean eciClearInput(ECIHand h)
+{
+    MockEngine *e = h;
+    if (!e->synthesizing)
+        clear_input(e);
+    return true;
+}
+
+ECIBoolean eciGeneratePhonemes(ECIHand h, int size, char *buffer)
+{
+    (void)h;
+    (void)size;
+    (void)buffer;
+    return false;
+}
+
+int eciGetIndex(ECIHand h)
+{
+    (void)h;
+    return 0;
+}
+
+ECIBoolean eciStop(ECIHand h)
+{
+    clear_input(h);
+    return true;
+}
+
+ECIBoolean eciSpeaking(ECIHand h)
+{
+    MockEngine *e = h;
+    if (e->paused)
+        return e->synthesizing;
+    return synth_step(e);
+}
+
+ECIBoolean eciSynchronize(ECIHand h)
+{
+    MockEngine *e = h;
+    while (synth_step(e))
+        ;
+    return true;
+}
+
+void eciSynchronizeSynth(ECIHand h)
+{
+    eciSynchronize(h);
+}
+
+ECIBoolean eciSetOutputBuffer(ECIHand h, int size, short *buffer)
+{
+    MockEngine *e = h;
+    if (size <= 0 || !buffer)
+        return false;
+    e->buffer = buffer;
+    e->buffer_size = size;
+    return true;
+}
+
+ECIBoolean eciSetOutputFilename(ECIHand h, const char *filename)
+{
+    (void)h;
+    (void)filename;
+    return false;
+}
+
+ECIBoolean eciSetOutputDevice(ECIHand h, int device)
+{
+    (void)h;
+    (void)device;
+    return false;
+}
+
+ECIBoolean eciPause(ECIHand h, ECIBoolean on)
+{
+    MockEngine *e = h;
+    e->paused = on;
+    return true;
+}
+
+void eciRegisterCallback(ECIHand h, ECICallback callback, void *data)
+{
+    MockEngine *e = h;
+    e->callback = callback;
+    e->callback_data = data;
+}
+
+ECIDictHand eciNewDict(ECIHand h)
+{
+    (void)h;
+    return calloc(1, sizeof(MockDict));
+}
+
+ECIDictHand eciGetDict(ECIHand h)
+{
+    MockEngine *e = h;
+    return e->dict;
+}
+
+ECIDictError eciSetDict(ECIHand h, ECIDictHand d)
+{
+    MockEngine *e = h;
+    e->dict = d;
+    return DictNoError;
+}
+
+ECIDictHand eciDeleteDict(ECIHand h, ECIDictHand d)
+{
+    MockEngine *e = h;
+    if (e->dict == d)
+        e->dict = NULL_DICT_HAND;
+    free(d);
+    return NULL_DICT_HAND;
+}
+
+ECIDictError eciLoadDict(ECIHand h, ECIDictHand d, ECIDictVolume vol, const char *filename)
+{
+    MockDict *dict = d;
+    (void)h;
+
+    if (!dict || vol < eciMainDict || vol > eciAbbvDict)
+        return DictInternalError;
+
+    FILE *f = fopen(filename, "r");
+    if (!f)
+        return DictFileNotFound;
+
+    int cost = env_int("ECIMOCK_US_PER_DICT_ENTRY", 0);
+    char line[512];
+    dict->entries[vol] = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (strchr(line, '\t')) {
+            dict->entries[vol]++;
+            burn_cpu(cost);
+        }
+    }
+    fclose(f);
+    return DictNoError;
+}
+
+ECIDictError eciSaveDict(ECIHand h, ECIDictHand d, ECIDictVolume vol, const char *filename)
+{
+    (void)h;
+    (void)d;
+    (void)vol;
+    (void)filename;
+    return DictAccessError;
+}
+
+ECIDictError eciUpdateDict(ECIHand h, ECIDictHand d, ECIDictVolume vol,
+                           const char *key, const char *value)
+{
+    MockDict *dict = d;
+    (void)h;
+    (void)key;
+    (void)value;
+    if (!dict || vol < eciMainDict || vol > eciAbbvDict)
+        return DictInternalError;
+    dict->entries[vol]++;
+    return DictNoError;
+}
+
+ECIDictError eciDictFindFirst(ECIHand h, ECIDictHand d, ECIDictVolume vol,
+                              const char **key, const char **value)
+{
+    (void)h;
+    (void)d;
+    (void)vol;
+    (void)key;
+    (void)value;
+    return DictNoEntry;
+}
+
+ECIDictError eciDictFindNext(ECIHand h, ECIDictHand d, ECIDictVolume vol,
+                             const char **key, const char **value)
+{
+    (void)h;
+    (void)d;
+    (void)vol;
+    (void)key;
+    (void)value;
+    return DictNoEntry;
+}
+
+const char *eciDictLookup(ECIHand h, ECIDictHand d, ECIDictVolume vol, const char *key)
+{
+    (void)h;
+    (void)d;
+    (void)vol;
+    (void)key;
+    return NULL;
+}
+
+void eciRequestLicense(int code)
+{
+    (void)code;
+}
@@ -114,10 +114,11 @@ check_build_deps() {
     command -v cpio   &>/dev/null || missing+=("cpio")
     command -v ar     &>/dev/null || missing+=("binutils (ar)")
     command -v make   &>/dev/null || missing+=("make")
+    command -v python3 &>/dev/null || missing+=("python3")
 
     if [[ ${#missing[@]} -gt 0 ]]; then
         die "Missing build dependencies: ${missing[*]}
-Install with: sudo apt install gcc-multilib libc6-dev-i386 libspeechd-dev curl rpm2cpio cpio binutils make"
+Install with: sudo apt install gcc-multilib libc6-dev-i386 libspeechd-dev curl rpm2cpio cpio binutils make python3"
     fi
     info "All build dependencies found"
 }
@@ -242,6 +243,8 @@ assemble_bundle() {
 
     # Module binary
     cp "$BUILD_DIR/sd_viavoice.bin" "$BUNDLE_DIR/usr/bin/" || die "Failed to copy sd_viavoice.bin"
+    cp "$BUILD_DIR/vvrender" "$BUNDLE_DIR/usr/bin/" || die "Failed to copy vvrender"
+    cp "$BUILD_DIR/vvserver" "$BUNDLE_DIR/usr/bin/" || die "Failed to copy vvserver"
 
     # ViaVoice-specific libraries (not system libs)
     cp "$VIAVOICE_ROOT/usr/lib/libibmeci50.so" "$BUNDLE_DIR/usr/lib/" || die "Failed to copy libibmeci50.so"
@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+"""Generate the character name table header from data/charnames.txt.
+
+Usage: gen_charnames.py <charnames.txt> <charnames.h>
+       gen_charnames.py --extract <charnames.txt>
+
+Each line of the data file is "<code point>;<NAME>" as in the Unicode
+Character Database's UnicodeData.txt, for the blocks listed in BLOCKS.
+--extract writes it from this Python's unicodedata module, to refresh it
+for a new Unicode version.
+
+Names are turned into what a screen reader says: lower case, hyphens as
+spaces, "latin small letter e with acute" as "e acute" and "latin
+capital letter" as "capital".  Greek letters drop the script name too,
+while Cyrillic keeps it as many of its letters look like Latin ones.
+
+The header holds a minimal perfect hash (hash and displace): a code
+point picks a bucket, the bucket's displacement picks its slot among
+exactly as many slots as there are names, and the slot's code point is
+compared to reject characters without one.  So a lookup is two hashes
+and one comparison whatever the table size.  charname.c has the same
+hash functions as hash() and bucket() below.
+"""
+
+import re
+import sys
+
+BLOCKS = [
+    (0x00A0, 0x036F),   # Latin-1 to combining diacritical marks
+    (0x0370, 0x04FF),   # Greek, Cyrillic
+    (0x1E00, 0x1EFF),   # Latin extended additional
+    (0x2000, 0x2BFF),   # punctuation, symbols, arrows, maths, shapes, braille
+    (0x2E00, 0x2E7F),   # supplemental punctuation
+    (0x3000, 0x303F),   # CJK symbols and punctuation
+    (0xFB00, 0xFB06),   # Latin ligatures
+    (0xFF01, 0xFF5E),   # fullwidth ASCII
+    (0x1F000, 0x1FAFF), # game symbols, emoji and pictographs
+]
+
+LOAD = 4                # names per bucket, on average
+
+
+def mix(x):
+    x &= 0xFFFFFFFF
+    x ^= x >> 16
+    x = (x * 0x7FEB352D) & 0xFFFFFFFF
+    x ^= x >> 15
+    x = (x * 0x846CA68B) & 0xFFFFFFFF
+    x ^= x >> 16
+    return x
+
+
+def bucket(cp, nbuckets):
+    return mix(cp) % nbuckets
+
+
+def hash(cp, disp, size):
+    return mix(cp ^ (disp * 0x9E3779B9)) % size
+
+
+def extract(path):
+    import unicodedata
+    with open(path, "w") as f:
+        f.write(f"# Character names from Unicode {unicodedata.unidata_version},\n")
+        f.write("# written by scripts/gen_charnames.py --extract\n")
+        for first, last in BLOCKS:
+            for cp in range(first, last + 1):
+                name = unicodedata.name(chr(cp), None)
+                if name:
+                    f.write(f"{cp:04X};{name}\n")
+
+
+def spoken(name):
+    name = name.lower().replace("-", " ")
+    m = re.match(r"(.*?)(latin|greek|cyrillic) (small|capital) letter (.*)", name)
+    if m:
+        prefix, script, case, rest = m.groups()
+        name = (prefix + ("capital " if case == "capital" else "") +
+                ("cyrillic " if script == "cyrillic" else "") +
+                rest.replace(" with ", " "))
+    return name
+
+
+def parse(path):
+    names = {}
+    with open(path, encoding="ascii") as f:
+        for n, line in enumerate(f, 1):
+            line = line.rstrip("\n")
+            if not line or line.startswith("#"):
+                continue
+            try:
+                cp, name = line.split(";", 1)
+                cp = int(cp, 16)
+            except ValueError as e:
+                sys.exit(f"{path}:{n}: {e}")
+            if cp in names:
+                sys.exit(f"{path}:{n}: U+{cp:04X} is listed twice")
+            names[cp] = spoken(name)
+    return names
+
+
+def build(keys):
+    size = len(keys)
+    nbuckets = max(1, size // LOAD)
+    buckets = [[] for _ in range(nbuckets)]
+    for cp in keys:
+        buckets[bucket(cp, nbuckets)].append(cp)
+
+    slots = [None] * size
+    disps = [0] * nbuckets
+    for b in sorted(range(nbuckets), key=lambda b: -len(buckets[b])):
+        if not buckets[b]:
+            break
+        for disp in range(0x10000):
+            taken = [hash(cp, disp, size) for cp in buckets[b]]
+            if len(set(taken)) == len(taken) and all(slots[s] is None for s in taken):
+                break
+        else:
+            sys.exit("no displacement fits, lower LOAD")
+        disps[b] = disp
+        for cp, s in zip(buckets[b], taken):
+            slots[s] = cp
+    return disps, slots
+
+
+def main():
+    if len(sys.argv) == 3 and sys.argv[1] == "--extract":
+        extract(sys.argv[2])
+        return
+    if len(sys.argv) != 3:
+        sys.exit(__doc__.strip().splitlines()[2])
+    names = parse(sys.argv[1])
+    if not names:
+        sys.exit(f"{sys.argv[1]}: no names")
+    disps, slots = build(sorted(names))
+
+    pool = []
+    offsets = {}
+    size = 0
+    for cp in slots:
+        if names[cp] not in offsets:
+            offsets[names[cp]] = size
+            pool.append(names[cp])
+            size += len(names[cp]) + 1
+
+    with open(sys.argv[2], "w") as f:
+        f.write("/* Generated by scripts/gen_charnames.py from data/charnames.txt.  Do not edit. */\n\n")
+        f.write(f"#define CHARNAME_COUNT {len(slots)}\n")
+        f.write(f"#define CHARNAME_BUCKETS {len(disps)}\n\n")
+        f.write("static const unsigned short charname_disp[CHARNAME_BUCKETS] = {\n")
+        for i in range(0, len(disps), 16):
+            f.write("    " + ", ".join(str(v) for v in disps[i:i + 16]) + ",\n")
+        f.write("};\n\n")
+        f.write("static const struct { unsigned int cp, name; } charname_slot[CHARNAME_COUNT] = {\n")
+        for i in range(0, len(slots), 6):
+            f.write("    " + " ".join(f"{{ 0x{cp:X}, {offsets[names[cp]]} }},"
+                                      for cp in slots[i:i + 6]) + "\n")
+        f.write("};\n\n")
+        f.write("static const char charname_pool[] =\n")
+        for name in pool:
+            f.write(f'    "{name}\\0"\n')
+        f.write(";\n")
+
+
+if __name__ == "__main__":
+    main()
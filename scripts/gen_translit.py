@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""Generate the transliteration table header from data/translit.tsv.
+
+Usage: gen_translit.py <translit.tsv> <translit.h>
+
+Each line of the data file is "<code point>\t<spelling>", the code point
+in hex or a range "0300..036F" that shares one spelling.  Spellings are
+converted to Latin-1 and may only use ASCII and Latin-1 letters, since
+that is what the engine reads.  An empty spelling drops the character.
+The sanitizer gives the bytes 0x80..0x9F the meanings they have in
+Windows-1252 (0x97 is an em dash); spellings write them as \\x97.
+
+The header holds a two-level table: translit_page[] gives each block of
+256 code points an index into translit_block[], whose entries are
+offsets into translit_pool.  Blocks without any spelling share block 0,
+so the table stays small while lookups take one probe per level.
+Offset 0 means no spelling (the character becomes a space) and offset 1
+is the empty string.
+"""
+
+import re
+import sys
+
+LIMIT = 0x110000
+
+
+def parse(path):
+    spellings = {}
+    with open(path, encoding="utf-8") as f:
+        for n, line in enumerate(f, 1):
+            line = line.rstrip("\n")
+            if not line or line.startswith("#"):
+                continue
+            try:
+                key, spelling = line.split("\t", 1)
+                first, _, last = key.partition("..")
+                first = int(first, 16)
+                last = int(last, 16) if last else first
+                encoded = re.sub(r"\\x([89][0-9A-Fa-f])", lambda m: chr(int(m.group(1), 16)),
+                                 spelling).encode("latin-1")
+            except (ValueError, UnicodeEncodeError) as e:
+                sys.exit(f"{path}:{n}: {e}")
+            if not 0x80 <= first <= last < LIMIT:
+                sys.exit(f"{path}:{n}: code points must be non-ASCII")
+            for b in encoded:
+                if 0xA0 <= b < 0xC0 or b in (0xD7, 0xF7):
+                    sys.exit(f"{path}:{n}: spelling has a Latin-1 symbol, spell it out")
+            for cp in range(first, last + 1):
+                if cp in spellings:
+                    sys.exit(f"{path}:{n}: U+{cp:04X} is listed twice")
+                spellings[cp] = encoded
+    return spellings
+
+
+def c_string(data):
+    out = []
+    for b in data:
+        if b == 0x22 or b == 0x5C:
+            out.append("\\" + chr(b))
+        elif 0x20 <= b < 0x7F:
+            out.append(chr(b))
+        else:
+            out.append(f"\\{b:03o}")
+    return '"' + "".join(out) + '"'
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__.strip().splitlines()[2])
+    spellings = parse(sys.argv[1])
+
+    pool = [b"", b""]                   # offsets 0 and 1, see above
+    offsets = {b"": 1}
+    size = 2
+    for cp in sorted(spellings):
+        s = spellings[cp]
+        if s not in offsets:
+            offsets[s] = size
+            pool.append(s)
+            size += len(s) + 1
+    if size > 0xFFFF:
+        sys.exit("string pool too large for 16-bit offsets")
+
+    pages = (max(spellings) >> 8) + 1 if spellings else 1
+    blocks = [[0] * 256]
+    page_index = []
+    for page in range(pages):
+        block = [offsets[spellings[cp]] if cp in spellings else 0
+                 for cp in range(page << 8, (page + 1) << 8)]
+        if any(block):
+            page_index.append(len(blocks))
+            blocks.append(block)
+        else:
+            page_index.append(0)
+    page_type = "unsigned char" if len(blocks) <= 256 else "unsigned short"
+
+    with open(sys.argv[2], "w") as f:
+        f.write("/* Generated by scripts/gen_translit.py from data/translit.tsv.  Do not edit. */\n\n")
+        f.write(f"#define TRANSLIT_LIMIT 0x{pages << 8:X}\n\n")
+        f.write(f"static const {page_type} translit_page[{pages}] = {{\n")
+        for i in range(0, pages, 16):
+            f.write("    " + ", ".join(str(v) for v in page_index[i:i + 16]) + ",\n")
+        f.write("};\n\n")
+        f.write(f"static const unsigned short translit_block[{len(blocks)}][256] = {{\n")
+        for block in blocks:
+            f.write("    {\n")
+            for i in range(0, 256, 16):
+                f.write("        " + ", ".join(str(v) for v in block[i:i + 16]) + ",\n")
+            f.write("    },\n")
+        f.write("};\n\n")
+        f.write("static const char translit_pool[] =\n")
+        for s in pool:
+            f.write("    " + c_string(s + b"\0") + "\n")
+        f.write(";\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,49 @@
+/*
+ * audiobuf.c - Collecting engine audio for an utterance
+ *
+ * Copyright (C) 2025
+ *
+ * This is the body of the engine's audio callback, kept apart from the
+ * module so the benchmarks can time exactly what runs there.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "audiobuf.h"
+
+int audiobuf_reserve(AudioData *a, int extra, int slack)
+{
+    int new_size = a->num_samples + extra;
+
+    if (new_size > a->allocated) {
+        int alloc_size = new_size + slack;
+        short *samples = realloc(a->samples, alloc_size * sizeof(short));
+        if (!samples)
+            return 0;
+        a->samples = samples;
+        a->allocated = alloc_size;
+    }
+    return 1;
+}
+
+int audiobuf_append(AudioData *a, short *buf, int n, const AudioStages *stages,
+                    int slack)
+{
+    if (stages->dsp)
+        dsp_chain_process(stages->dsp, buf, n);
+
+    int room = stages->wsola ? wsola_max_output(stages->wsola, n) : n;
+    if (!audiobuf_reserve(a, room, slack))
+        return -1;
+
+    short *dst = a->samples + a->num_samples;
+    if (stages->wsola)
+        n = wsola_process(stages->wsola, buf, n, dst);
+    else
+        memcpy(dst, buf, n * sizeof(short));
+    if (stages->trim)
+        n = silence_trim(stages->trim, dst, n);
+    a->num_samples += n;
+    return n;
+}
@@ -0,0 +1,37 @@
+/*
+ * audiobuf.h - Collecting engine audio for an utterance
+ *
+ * Copyright (C) 2025
+ */
+
+#ifndef _AUDIOBUF_H
+#define _AUDIOBUF_H
+
+#include "wsola.h"
+#include "silence.h"
+#include "dsp.h"
+
+typedef struct {
+    short *samples;
+    int num_samples;
+    int allocated;
+} AudioData;
+
+/* Processing applied to engine buffers on the way in; NULL = off */
+typedef struct {
+    DspChain *dsp;
+    WsolaState *wsola;
+    SilenceTrim *trim;
+} AudioStages;
+
+/* Make room for extra samples at the end of a, allocating slack more
+ * when it has to grow.  Returns 0 if out of memory. */
+int audiobuf_reserve(AudioData *a, int extra, int slack);
+
+/* Run n engine samples in buf through the stages (buf is modified) and
+ * append the result to a.  Returns the number of samples appended, or
+ * -1 if out of memory. */
+int audiobuf_append(AudioData *a, short *buf, int n, const AudioStages *stages,
+                    int slack);
+
+#endif /* _AUDIOBUF_H */
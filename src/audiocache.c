@@ -0,0 +1,172 @@
+/*
+ * audiocache.c - Rendered audio of short messages, shared by all clients
+ *
+ * Copyright (C) 2025
+ *
+ * Services ask for the same prompts over and over, often with the same
+ * voice.  vvserver keeps what the engines rendered for short messages
+ * here, keyed on the text and on everything the engine held, so any
+ * client gets a repeat without an engine.  Entries are chained in a
+ * fixed hash table and on a least recently used list; the least
+ * recently used go when the samples would exceed the budget.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "audiocache.h"
+#include "stats.h"
+
+#define BUCKETS 1024                    /* power of two */
+
+typedef struct Entry Entry;
+struct Entry {
+    Entry *chain;                       /* next in the bucket */
+    Entry *newer, *older;               /* on the LRU list */
+    unsigned int hash;
+    EngineValues voice;
+    short *samples;
+    int n;
+    char text[];
+};
+
+struct AudioCache {
+    pthread_mutex_t mutex;
+    Entry *buckets[BUCKETS];
+    Entry *newest, *oldest;
+    size_t bytes, budget;
+};
+
+/* FNV-1a over the text and the engine values */
+static unsigned int hash_of(const char *text, const EngineValues *voice)
+{
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++)
+        h = (h ^ *p) * 16777619u;
+    const unsigned char *v = (const unsigned char *)voice;
+    for (size_t i = 0; i < sizeof(*voice); i++)
+        h = (h ^ v[i]) * 16777619u;
+    return h;
+}
+
+static Entry **find(AudioCache *c, unsigned int hash, const char *text,
+                    const EngineValues *voice)
+{
+    Entry **e = &c->buckets[hash & (BUCKETS - 1)];
+    while (*e && ((*e)->hash != hash || strcmp((*e)->text, text) != 0 ||
+                  memcmp(&(*e)->voice, voice, sizeof(*voice)) != 0))
+        e = &(*e)->chain;
+    return e;
+}
+
+static void unlink_lru(AudioCache *c, Entry *e)
+{
+    if (e->newer)
+        e->newer->older = e->older;
+    else
+        c->newest = e->older;
+    if (e->older)
+        e->older->newer = e->newer;
+    else
+        c->oldest = e->newer;
+}
+
+static void push_lru(AudioCache *c, Entry *e)
+{
+    e->newer = NULL;
+    e->older = c->newest;
+    if (c->newest)
+        c->newest->newer = e;
+    else
+        c->oldest = e;
+    c->newest = e;
+}
+
+static void drop(AudioCache *c, Entry *e)
+{
+    Entry **link = find(c, e->hash, e->text, &e->voice);
+    *link = e->chain;
+    unlink_lru(c, e);
+    c->bytes -= e->n * sizeof(short);
+    free(e->samples);
+    free(e);
+}
+
+AudioCache *audiocache_new(size_t bytes)
+{
+    AudioCache *c = calloc(1, sizeof(AudioCache));
+    if (!c)
+        return NULL;
+    pthread_mutex_init(&c->mutex, NULL);
+    c->budget = bytes;
+    return c;
+}
+
+short *audiocache_get(AudioCache *c, const char *text, const EngineValues *voice,
+                      int *n)
+{
+    unsigned int hash = hash_of(text, voice);
+    short *copy = NULL;
+
+    pthread_mutex_lock(&c->mutex);
+    Entry *e = *find(c, hash, text, voice);
+    if (e && (copy = malloc(e->n * sizeof(short) + 1))) {
+        memcpy(copy, e->samples, e->n * sizeof(short));
+        *n = e->n;
+        unlink_lru(c, e);
+        push_lru(c, e);
+    }
+    pthread_mutex_unlock(&c->mutex);
+
+    if (copy)
+        stats_count(STAT_AUDIO_HITS, 1);
+    return copy;
+}
+
+void audiocache_put(AudioCache *c, const char *text, const EngineValues *voice,
+                    const short *samples, int n)
+{
+    size_t size = n * sizeof(short);
+    size_t len = strlen(text);
+    if (size > c->budget || len > AUDIOCACHE_MAX_TEXT)
+        return;
+
+    Entry *e = malloc(sizeof(Entry) + len + 1);
+    short *copy = malloc(size + 1);
+    if (!e || !copy) {
+        free(e);
+        free(copy);
+        return;
+    }
+    memcpy(copy, samples, size);
+    memcpy(e->text, text, len + 1);
+    e->voice = *voice;
+    e->hash = hash_of(text, voice);
+    e->samples = copy;
+    e->n = n;
+
+    pthread_mutex_lock(&c->mutex);
+    /* Two engines may have rendered the same message */
+    Entry *old = *find(c, e->hash, text, voice);
+    if (old)
+        drop(c, old);
+    while (c->oldest && c->bytes + size > c->budget)
+        drop(c, c->oldest);
+    Entry **bucket = &c->buckets[e->hash & (BUCKETS - 1)];
+    e->chain = *bucket;
+    *bucket = e;
+    push_lru(c, e);
+    c->bytes += size;
+    pthread_mutex_unlock(&c->mutex);
+}
+
+void audiocache_free(AudioCache *c)
+{
+    if (!c)
+        return;
+    while (c->oldest)
+        drop(c, c->oldest);
+    pthread_mutex_destroy(&c->mutex);
+    free(c);
+}
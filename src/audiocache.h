@@ -0,0 +1,35 @@
+/*
+ * audiocache.h - Rendered audio of short messages, shared by all clients
+ *
+ * Copyright (C) 2025
+ */
+
+#ifndef _AUDIOCACHE_H
+#define _AUDIOCACHE_H
+
+#include <stddef.h>
+
+#include "engparams.h"
+
+/* Only messages up to this long are kept: prompts and notifications
+ * repeat, while the sentences of a document do not */
+#define AUDIOCACHE_MAX_TEXT 256
+
+typedef struct AudioCache AudioCache;
+
+/* A cache holding up to bytes of samples */
+AudioCache *audiocache_new(size_t bytes);
+
+/* A malloc'd copy of the samples of text as rendered with the engine
+ * holding voice, and their number in *n; NULL if they are not cached */
+short *audiocache_get(AudioCache *c, const char *text, const EngineValues *voice,
+                      int *n);
+
+/* Keep n samples of text rendered with voice, dropping the least
+ * recently used entries to make room */
+void audiocache_put(AudioCache *c, const char *text, const EngineValues *voice,
+                    const short *samples, int n);
+
+void audiocache_free(AudioCache *c);
+
+#endif /* _AUDIOCACHE_H */
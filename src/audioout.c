@@ -0,0 +1,475 @@
+/*
+ * audioout.c - Playing audio from the module, without the server
+ *
+ * Copyright (C) 2025
+ *
+ * Sent through the server, every sample is escaped into a 705 AUDIO
+ * block, parsed back by speech-dispatcher and queued again in its own
+ * audio output, and a STOP has to travel back the same way before the
+ * device goes quiet.  Here the module writes to the device itself.
+ *
+ * Each backend is a table of operations.  The sound server libraries
+ * are loaded with dlopen() when a backend is opened, so the module
+ * builds and runs without them and only the backend asked for needs
+ * its library installed.  PipeWire is reached through its PulseAudio
+ * server (pipewire-pulse), which every PipeWire desktop runs; "null"
+ * and "wav" need no device at all, for testing headless.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+
+#include "audioout.h"
+#include "stats.h"
+#include "log.h"
+
+typedef struct {
+    const char *name;
+    int (*open)(AudioOut *out, const char *device);   /* 0 on success */
+    int (*write)(AudioOut *out, const short *samples, int n);
+    long (*delay)(AudioOut *out);
+    void (*flush)(AudioOut *out);
+    void (*close)(AudioOut *out);
+} Backend;
+
+/* The parts of libpulse-simple and libasound used here, declared
+ * locally so neither is needed to build */
+typedef struct {
+    int format;
+    unsigned int rate;
+    unsigned char channels;
+} PaSampleSpec;
+
+typedef struct {
+    unsigned int maxlength, tlength, prebuf, minreq, fragsize;
+} PaBufferAttr;
+
+#define PA_STREAM_PLAYBACK 1
+#define PA_SAMPLE_S16LE    3
+
+typedef struct {
+    void *(*new_)(const char *server, const char *name, int dir, const char *dev,
+                  const char *stream, const PaSampleSpec *ss, const void *map,
+                  const PaBufferAttr *attr, int *error);
+    int (*write)(void *s, const void *data, size_t bytes, int *error);
+    unsigned long long (*get_latency)(void *s, int *error);
+    int (*flush)(void *s, int *error);
+    void (*free_)(void *s);
+    const char *(*strerror)(int error);
+} PulseApi;
+
+#define SND_PCM_STREAM_PLAYBACK        0
+#define SND_PCM_FORMAT_S16_LE          2
+#define SND_PCM_ACCESS_RW_INTERLEAVED  3
+
+typedef struct {
+    int (*open)(void **pcm, const char *name, int stream, int mode);
+    int (*set_params)(void *pcm, int format, int access, unsigned int channels,
+                      unsigned int rate, int soft_resample, unsigned int latency);
+    long (*writei)(void *pcm, const void *buffer, unsigned long frames);
+    int (*recover)(void *pcm, int err, int silent);
+    int (*delay)(void *pcm, long *frames);
+    int (*drop)(void *pcm);
+    int (*prepare)(void *pcm);
+    int (*close)(void *pcm);
+    const char *(*strerror)(int err);
+} AlsaApi;
+
+typedef struct {
+    const char *symbol;
+    size_t offset;
+} Symbol;
+
+static const Symbol pulse_symbols[] = {
+    { "pa_simple_new", offsetof(PulseApi, new_) },
+    { "pa_simple_write", offsetof(PulseApi, write) },
+    { "pa_simple_get_latency", offsetof(PulseApi, get_latency) },
+    { "pa_simple_flush", offsetof(PulseApi, flush) },
+    { "pa_simple_free", offsetof(PulseApi, free_) },
+    { "pa_strerror", offsetof(PulseApi, strerror) },
+};
+
+static const Symbol alsa_symbols[] = {
+    { "snd_pcm_open", offsetof(AlsaApi, open) },
+    { "snd_pcm_set_params", offsetof(AlsaApi, set_params) },
+    { "snd_pcm_writei", offsetof(AlsaApi, writei) },
+    { "snd_pcm_recover", offsetof(AlsaApi, recover) },
+    { "snd_pcm_delay", offsetof(AlsaApi, delay) },
+    { "snd_pcm_drop", offsetof(AlsaApi, drop) },
+    { "snd_pcm_prepare", offsetof(AlsaApi, prepare) },
+    { "snd_pcm_close", offsetof(AlsaApi, close) },
+    { "snd_strerror", offsetof(AlsaApi, strerror) },
+};
+
+struct AudioOut {
+    const Backend *backend;
+    int rate;
+    void *lib;                  /* dlopen() handle */
+    void *stream;               /* pa_simple or snd_pcm_t */
+    union {
+        PulseApi pulse;
+        AlsaApi alsa;
+    } api;
+    FILE *file;                 /* wav */
+    unsigned long data_bytes;
+    unsigned long long ahead;   /* null: when what was written ends, us */
+};
+
+static int load_library(AudioOut *out, const char *path, const Symbol *symbols,
+                        int count)
+{
+    out->lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!out->lib) {
+        INFO("Audio: %s", dlerror());
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        void *fn = dlsym(out->lib, symbols[i].symbol);
+        if (!fn) {
+            WARN("Audio: %s has no %s", path, symbols[i].symbol);
+            dlclose(out->lib);
+            out->lib = NULL;
+            return -1;
+        }
+        *(void **)((char *)&out->api + symbols[i].offset) = fn;
+    }
+    return 0;
+}
+
+static int period_bytes(const AudioOut *out, int ms)
+{
+    return out->rate * ms / 1000 * (int)sizeof(short);
+}
+
+/* --- PulseAudio, and PipeWire through pipewire-pulse --- */
+
+static int pulse_open(AudioOut *out, const char *device)
+{
+    PulseApi *pa = &out->api.pulse;
+    if (load_library(out, "libpulse-simple.so.0", pulse_symbols,
+                     sizeof(pulse_symbols) / sizeof(pulse_symbols[0])) != 0)
+        return -1;
+
+    /* A short target and a period of prebuffering keep the first sample
+     * of a message close to its write; the default is two seconds */
+    PaSampleSpec ss = { PA_SAMPLE_S16LE, out->rate, 1 };
+    PaBufferAttr attr = {
+        .maxlength = (unsigned int)-1,
+        .tlength = period_bytes(out, AUDIOOUT_BUFFER_MS),
+        .prebuf = period_bytes(out, AUDIOOUT_PERIOD_MS),
+        .minreq = period_bytes(out, AUDIOOUT_PERIOD_MS),
+        .fragsize = (unsigned int)-1,
+    };
+    int error = 0;
+    out->stream = pa->new_(NULL, "speech-dispatcher-viavoice", PA_STREAM_PLAYBACK,
+                           device[0] ? device : NULL, "speech", &ss, NULL, &attr,
+                           &error);
+    if (!out->stream) {
+        INFO("Audio: no sound server: %s", pa->strerror(error));
+        dlclose(out->lib);
+        out->lib = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static int pulse_write(AudioOut *out, const short *samples, int n)
+{
+    int error = 0;
+    if (out->api.pulse.write(out->stream, samples, n * sizeof(short), &error) < 0) {
+        ERR("Audio: write failed: %s", out->api.pulse.strerror(error));
+        return -1;
+    }
+    return 0;
+}
+
+static long pulse_delay(AudioOut *out)
+{
+    int error = 0;
+    unsigned long long us = out->api.pulse.get_latency(out->stream, &error);
+    return us == (unsigned long long)-1 ? 0 : (long)us;
+}
+
+static void pulse_flush(AudioOut *out)
+{
+    int error = 0;
+    if (out->api.pulse.flush(out->stream, &error) < 0)
+        WARN("Audio: flush failed: %s", out->api.pulse.strerror(error));
+}
+
+static void pulse_close(AudioOut *out)
+{
+    out->api.pulse.free_(out->stream);
+    dlclose(out->lib);
+}
+
+static int pipewire_open(AudioOut *out, const char *device)
+{
+    const char *remote = getenv("PIPEWIRE_REMOTE");
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    char path[512];
+    struct stat st;
+
+    if (!remote && dir)
+        snprintf(path, sizeof(path), "%s/pipewire-0", dir);
+    if (!remote && (!dir || stat(path, &st) != 0)) {
+        INFO("Audio: PipeWire is not running");
+        return -1;
+    }
+    return pulse_open(out, device);
+}
+
+/* --- ALSA --- */
+
+static int alsa_open(AudioOut *out, const char *device)
+{
+    AlsaApi *alsa = &out->api.alsa;
+    if (load_library(out, "libasound.so.2", alsa_symbols,
+                     sizeof(alsa_symbols) / sizeof(alsa_symbols[0])) != 0)
+        return -1;
+
+    const char *name = device[0] ? device : "default";
+    int err = alsa->open(&out->stream, name, SND_PCM_STREAM_PLAYBACK, 0);
+    if (err >= 0) {
+        err = alsa->set_params(out->stream, SND_PCM_FORMAT_S16_LE,
+                               SND_PCM_ACCESS_RW_INTERLEAVED, 1, out->rate, 1,
+                               AUDIOOUT_BUFFER_MS * 1000);
+        if (err < 0)
+            alsa->close(out->stream);
+    }
+    if (err < 0) {
+        INFO("Audio: cannot open %s: %s", name, alsa->strerror(err));
+        dlclose(out->lib);
+        out->lib = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static int alsa_write(AudioOut *out, const short *samples, int n)
+{
+    AlsaApi *alsa = &out->api.alsa;
+    while (n > 0) {
+        long done = alsa->writei(out->stream, samples, n);
+        if (done < 0) {
+            /* An underrun between messages is expected; start again */
+            if (alsa->recover(out->stream, (int)done, 1) < 0) {
+                ERR("Audio: write failed: %s", alsa->strerror((int)done));
+                return -1;
+            }
+            continue;
+        }
+        samples += done;
+        n -= done;
+    }
+    return 0;
+}
+
+static long alsa_delay(AudioOut *out)
+{
+    long frames = 0;
+    if (out->api.alsa.delay(out->stream, &frames) < 0 || frames < 0)
+        return 0;
+    return (long)(frames * 1000000LL / out->rate);
+}
+
+static void alsa_flush(AudioOut *out)
+{
+    out->api.alsa.drop(out->stream);
+    out->api.alsa.prepare(out->stream);
+}
+
+static void alsa_close(AudioOut *out)
+{
+    out->api.alsa.close(out->stream);
+    dlclose(out->lib);
+}
+
+/* --- null: discards the audio, taking it at the pace a device would --- */
+
+static int null_open(AudioOut *out, const char *device)
+{
+    (void)device;
+    out->ahead = 0;
+    return 0;
+}
+
+static int null_write(AudioOut *out, const short *samples, int n)
+{
+    (void)samples;
+    unsigned long long now = stats_now();
+    if (out->ahead < now)
+        out->ahead = now;
+    out->ahead += n * 1000000ULL / out->rate;
+    if (out->ahead - now > AUDIOOUT_BUFFER_MS * 1000)
+        usleep(out->ahead - now - AUDIOOUT_BUFFER_MS * 1000);
+    return 0;
+}
+
+static long null_delay(AudioOut *out)
+{
+    unsigned long long now = stats_now();
+    return out->ahead > now ? (long)(out->ahead - now) : 0;
+}
+
+static void null_flush(AudioOut *out)
+{
+    out->ahead = 0;
+}
+
+static void null_close(AudioOut *out)
+{
+    (void)out;
+}
+
+/* --- wav: everything played goes into one file, as fast as it comes --- */
+
+static void put_le(unsigned char *p, unsigned long v, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        p[i] = (v >> (8 * i)) & 0xff;
+}
+
+void audioout_wav_header(unsigned char *h, int rate, unsigned long data_bytes)
+{
+    memcpy(h, "RIFF", 4);
+    put_le(h + 4, 36 + data_bytes, 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_le(h + 16, 16, 4);                          /* fmt chunk size */
+    put_le(h + 20, 1, 2);                           /* PCM */
+    put_le(h + 22, 1, 2);                           /* mono */
+    put_le(h + 24, rate, 4);
+    put_le(h + 28, rate * sizeof(short), 4);
+    put_le(h + 32, sizeof(short), 2);
+    put_le(h + 34, 16, 2);
+    memcpy(h + 36, "data", 4);
+    put_le(h + 40, data_bytes, 4);
+}
+
+static void wav_header(AudioOut *out)
+{
+    unsigned char h[AUDIOOUT_WAV_HEADER];
+    audioout_wav_header(h, out->rate, out->data_bytes);
+    fwrite(h, sizeof(h), 1, out->file);
+}
+
+static int wav_open(AudioOut *out, const char *device)
+{
+    if (device[0] == '\0') {
+        WARN("Audio: wav needs ViaVoiceAudioDevice set to a file");
+        return -1;
+    }
+    out->file = fopen(device, "wb");
+    if (!out->file) {
+        WARN("Audio: cannot create %s", device);
+        return -1;
+    }
+    out->data_bytes = 0;
+    wav_header(out);
+    return 0;
+}
+
+static int wav_write(AudioOut *out, const short *samples, int n)
+{
+    if (fwrite(samples, sizeof(short), n, out->file) != (size_t)n) {
+        ERR("Audio: write to wav file failed");
+        return -1;
+    }
+    out->data_bytes += n * sizeof(short);
+    return 0;
+}
+
+static long wav_delay(AudioOut *out)
+{
+    fflush(out->file);
+    return 0;
+}
+
+static void wav_flush(AudioOut *out)
+{
+    fflush(out->file);
+}
+
+/* The sizes are filled in if the file can be rewound; a pipe keeps the
+ * zero sizes of a stream */
+static void wav_close(AudioOut *out)
+{
+    if (fseek(out->file, 0, SEEK_SET) == 0)
+        wav_header(out);
+    fclose(out->file);
+}
+
+static const Backend backends[] = {
+    { "pipewire", pipewire_open, pulse_write, pulse_delay, pulse_flush, pulse_close },
+    { "pulse", pulse_open, pulse_write, pulse_delay, pulse_flush, pulse_close },
+    { "alsa", alsa_open, alsa_write, alsa_delay, alsa_flush, alsa_close },
+    { "null", null_open, null_write, null_delay, null_flush, null_close },
+    { "wav", wav_open, wav_write, wav_delay, wav_flush, wav_close },
+};
+
+AudioOut *audioout_open(const char *names, const char *device, int rate)
+{
+    AudioOut *out = calloc(1, sizeof(AudioOut));
+    if (!out)
+        return NULL;
+    out->rate = rate;
+
+    const char *p = names;
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        const Backend *b = NULL;
+        for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+            if (strlen(backends[i].name) == len && strncmp(backends[i].name, p, len) == 0)
+                b = &backends[i];
+        if (!b)
+            WARN("Audio: unknown output %.*s", (int)len, p);
+        else if (b->open(out, device) == 0) {
+            out->backend = b;
+            INFO("Audio: playing through %s at %d Hz", b->name, rate);
+            return out;
+        }
+        p += len;
+        if (*p == ',')
+            p++;
+    }
+    free(out);
+    return NULL;
+}
+
+const char *audioout_name(const AudioOut *out)
+{
+    return out->backend->name;
+}
+
+int audioout_rate(const AudioOut *out)
+{
+    return out->rate;
+}
+
+int audioout_write(AudioOut *out, const short *samples, int n)
+{
+    return out->backend->write(out, samples, n);
+}
+
+long audioout_delay(AudioOut *out)
+{
+    return out->backend->delay(out);
+}
+
+void audioout_flush(AudioOut *out)
+{
+    out->backend->flush(out);
+}
+
+void audioout_close(AudioOut *out)
+{
+    if (!out)
+        return;
+    out->backend->close(out);
+    free(out);
+}
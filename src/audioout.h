@@ -0,0 +1,48 @@
+/*
+ * audioout.h - Playing audio from the module, without the server
+ *
+ * Copyright (C) 2025
+ */
+
+#ifndef _AUDIOOUT_H
+#define _AUDIOOUT_H
+
+/* Audio is written in pieces this long, so a STOP is seen between them */
+#define AUDIOOUT_PERIOD_MS 20
+
+/* What the device is asked to keep queued */
+#define AUDIOOUT_BUFFER_MS 80
+
+/* Tried in order for "auto" */
+#define AUDIOOUT_DEFAULT "pipewire,pulse,alsa"
+
+#define AUDIOOUT_WAV_HEADER 44
+
+typedef struct AudioOut AudioOut;
+
+/* The header of a 16-bit mono WAV file holding data_bytes of samples */
+void audioout_wav_header(unsigned char *h, int rate, unsigned long data_bytes);
+
+/* Open the first of the comma-separated backends in names that works,
+ * for 16-bit mono at rate.  device is the sink, PCM or file to use, ""
+ * for the backend's default.  NULL if none of them opens. */
+AudioOut *audioout_open(const char *names, const char *device, int rate);
+
+/* Name of the backend that opened */
+const char *audioout_name(const AudioOut *out);
+
+int audioout_rate(const AudioOut *out);
+
+/* Queue n samples, blocking while the device buffer is full.  Returns
+ * -1 if the device failed. */
+int audioout_write(AudioOut *out, const short *samples, int n);
+
+/* Microseconds of audio queued and not played yet */
+long audioout_delay(AudioOut *out);
+
+/* Drop everything queued, at once */
+void audioout_flush(AudioOut *out);
+
+void audioout_close(AudioOut *out);
+
+#endif /* _AUDIOOUT_H */
@@ -0,0 +1,40 @@
+/*
+ * charname.c - Spoken names of characters for CHAR messages
+ *
+ * Copyright (C) 2025
+ *
+ * ViaVoice reads neither UTF-8 nor anything past Latin-1, so moving
+ * over "→" or an emoji would say nothing.  The names come from the
+ * Unicode Character Database (data/charnames.txt), in a minimal perfect
+ * hash generated by scripts/gen_charnames.py: one bucket probe, one slot
+ * probe and one comparison, with nothing allocated.
+ */
+
+#include "charname.h"
+#include "text.h"
+#include "charnames.h"      /* generated from data/charnames.txt */
+
+/* Must match mix() in scripts/gen_charnames.py */
+static inline unsigned int mix(unsigned int x)
+{
+    x ^= x >> 16;
+    x *= 0x7FEB352Du;
+    x ^= x >> 15;
+    x *= 0x846CA68Bu;
+    x ^= x >> 16;
+    return x;
+}
+
+const char *char_name(const char *text)
+{
+    unsigned int cp;
+
+    if ((unsigned char)*text < 0x80 || !utf8_decode((const unsigned char *)text, &cp))
+        return NULL;
+
+    unsigned int disp = charname_disp[mix(cp) % CHARNAME_BUCKETS];
+    unsigned int slot = mix(cp ^ (disp * 0x9E3779B9u)) % CHARNAME_COUNT;
+    if (charname_slot[slot].cp != cp)
+        return NULL;
+    return charname_pool + charname_slot[slot].name;
+}
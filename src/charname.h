@@ -0,0 +1,16 @@
+/*
+ * charname.h - Spoken names of characters for CHAR messages
+ *
+ * Copyright (C) 2025
+ */
+
+#ifndef _CHARNAME_H
+#define _CHARNAME_H
+
+/* Name of the character at the start of UTF-8 text ("e acute",
+ * "rightwards arrow", "grinning face"), or NULL if it is ASCII, which
+ * the engine names itself, or not in data/charnames.txt.  Anything
+ * after it, like a variation selector, is ignored. */
+const char *char_name(const char *text);
+
+#endif /* _CHARNAME_H */
@@ -0,0 +1,467 @@
+/*
+ * config.c - viavoice.conf and what it names
+ *
+ * Copyright (C) 2025
+ *
+ * Shared by the module and vvrender, so both read the same file the
+ * same way and load the same dictionaries and rewrite rules.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "config.h"
+#include "wsola.h"
+#include "dsp.h"
+#include "stats.h"
+#include "log.h"
+
+const Settings default_settings = {
+    .sample_rate = 2,
+    .voice = 0,
+    .pitch_baseline = -1, .pitch_fluctuation = -1, .speed = -1, .volume = -1,
+    .head_size = -1, .roughness = -1, .breathiness = -1,
+    .phrase_prediction = 0,
+    .dictionary = 0,
+    .number_mode = -1, .text_mode = -1, .real_world_units = -1,
+    .max_stretch = 1.0,
+    .profile = {
+        [PROFILE_TEXT]       = { 1.0, 0, -1, 0 },
+        [PROFILE_SOUND_ICON] = { 1.0, 0, -1, 0 },
+        [PROFILE_CHAR]       = { 1.0, -50, -1, 1 },
+        [PROFILE_KEY]        = { 1.0, -50, -1, 0 },
+    },
+    .trim_pad_ms = 10,
+    .max_pause_ms = 0,
+    .dsp_stages = 0,
+    .gain_db = 0.0,
+    .loudness_target = -20.0,
+    .incremental = 0,
+    .trace_events = 65536,
+    .log_level = -1,
+    .audio_output = "server",
+};
+
+const IntSetting int_settings[INT_SETTINGS] = {
+    { "ViaVoicePitchBaseline", "viavoice_pitch_baseline",
+      offsetof(Settings, pitch_baseline), 0, 100, "pitch baseline" },
+    { "ViaVoicePitchFluctuation", "viavoice_pitch_fluctuation",
+      offsetof(Settings, pitch_fluctuation), 0, 100, "pitch fluctuation" },
+    { "ViaVoiceSpeed", "viavoice_speed",
+      offsetof(Settings, speed), 0, 250, "speed" },
+    { "ViaVoiceVolume", "viavoice_volume",
+      offsetof(Settings, volume), 0, 100, "volume" },
+    { "ViaVoiceHeadSize", "viavoice_head_size",
+      offsetof(Settings, head_size), 0, 100, "head size" },
+    { "ViaVoiceRoughness", "viavoice_roughness",
+      offsetof(Settings, roughness), 0, 100, "roughness" },
+    { "ViaVoiceBreathiness", "viavoice_breathiness",
+      offsetof(Settings, breathiness), 0, 100, "breathiness" },
+    { "ViaVoicePhrasePrediction", "viavoice_phrase_prediction",
+      offsetof(Settings, phrase_prediction), 0, 1, "phrase prediction" },
+    { "ViaVoiceDictionary", "viavoice_dictionary",
+      offsetof(Settings, dictionary), 0, 1, "dictionary (abbreviations)" },
+    { "ViaVoiceNumberMode", "viavoice_number_mode",
+      offsetof(Settings, number_mode), 0, INT_MAX, "number mode" },
+    { "ViaVoiceTextMode", "viavoice_text_mode",
+      offsetof(Settings, text_mode), 0, INT_MAX, "text mode" },
+    { "ViaVoiceRealWorldUnits", "viavoice_real_world_units",
+      offsetof(Settings, real_world_units), 0, 1, "real world units" },
+};
+
+const char *const voice_name_table[ECI_PRESET_VOICES] = {
+    "Wade", "Flo", "Bobbie", "Male2", "Male3", "Female2", "Grandma", "Grandpa"
+};
+
+/* Parse a silence threshold: "off" or a level in dBFS */
+static int parse_trim_db(const char *value, int *db)
+{
+    if (strcasecmp(value, "off") == 0) {
+        *db = 0;
+        return 1;
+    }
+    int v = atoi(value);
+    if (v >= -96 && v <= -1) {
+        *db = v;
+        return 1;
+    }
+    return 0;
+}
+
+const IntSetting *config_int_setting(const char *name, int var)
+{
+    for (int i = 0; i < INT_SETTINGS; i++)
+        if (strcasecmp(name, var ? int_settings[i].var : int_settings[i].key) == 0)
+            return &int_settings[i];
+    return NULL;
+}
+
+int config_parse_int(const IntSetting *is, const char *value, int *v)
+{
+    char *end;
+    errno = 0;
+    long l = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || errno || l < is->min || l > is->max)
+        return 0;
+    *v = (int)l;
+    return 1;
+}
+
+/* Section names, in PROFILE_* order */
+static const char *const profile_names[PROFILE_TYPES] = {
+    "text", "sound_icon", "char", "key"
+};
+
+/* Parse one line of a [section]: Rate, Trim, Voice or Cache */
+static int parse_profile(const char *key, const char *value, Profile *p)
+{
+    if (strcasecmp(key, "Rate") == 0) {
+        double v = atof(value);
+        if (v < 0.25 || v > 4.0)
+            return 0;
+        p->rate = v;
+        return 1;
+    }
+    if (strcasecmp(key, "Trim") == 0)
+        return parse_trim_db(value, &p->trim_db);
+    if (strcasecmp(key, "Voice") == 0) {
+        if (strcasecmp(value, "default") == 0) {
+            p->voice = -1;
+            return 1;
+        }
+        for (int i = 0; i < ECI_PRESET_VOICES; i++)
+            if (strcasecmp(value, voice_name_table[i]) == 0) {
+                p->voice = i;
+                return 1;
+            }
+        if (value[0] < '0' || value[0] > '7' || value[1] != '\0')
+            return 0;
+        p->voice = value[0] - '0';
+        return 1;
+    }
+    if (strcasecmp(key, "Cache") == 0) {
+        if (strcasecmp(value, "on") && strcasecmp(value, "off"))
+            return 0;
+        p->cache = strcasecmp(value, "on") == 0;
+        return 1;
+    }
+    return 0;
+}
+
+int config_parse(const char *path, Settings *s)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    
+    char line[256];
+    Profile *section = NULL;    /* [section] being read */
+    const IntSetting *is;
+    while (fgets(line, sizeof(line), f)) {
+        /* Skip comments and empty lines */
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\0') continue;
+        
+        /* Section headers pick the message type later keys apply to */
+        char name[64];
+        if (sscanf(p, "[%63[^]]]", name) == 1) {
+            section = NULL;
+            for (int i = 0; i < PROFILE_TYPES; i++)
+                if (strcasecmp(name, profile_names[i]) == 0)
+                    section = &s->profile[i];
+            if (!section)
+                WARN("Config: unknown section [%s]", name);
+            else
+                INFO("Config: section [%s]", name);
+            continue;
+        }
+
+        /* Parse key-value pairs */
+        char key[64], value[64];
+        if (sscanf(p, "%63s %63s", key, value) == 2) {
+            DBG("Config line: key='%s' value='%s'", key, value);
+            if (strncasecmp(key, "ViaVoice", 8) != 0) {
+                if (section && parse_profile(key, value, section))
+                    INFO("Config: %s %s", key, value);
+                else if (section)
+                    WARN("Config: bad %s %s in a section", key, value);
+            }
+            else if ((is = config_int_setting(key, 0)) != NULL) {
+                int v;
+                if (config_parse_int(is, value, &v)) {
+                    *(int *)((char *)s + is->offset) = v;
+                    INFO("Config: %s %d", is->what, v);
+                }
+            }
+            else if (strcasecmp(key, "ViaVoiceSampleRate") == 0) {
+                int v = atoi(value);
+                if (v >= 0 && v <= 2) {
+                    s->sample_rate = v;
+                    INFO("Config: sample rate %d", v);
+                }
+            }
+            else if (strcasecmp(key, "ViaVoiceDefaultVoice") == 0) {
+                int v = atoi(value);
+                if (v >= 0 && v <= 7) {
+                    s->voice = v;
+                    INFO("Config: voice %d (%s)", s->voice, voice_name_table[s->voice]);
+                }
+            }
+            else if (strcasecmp(key, "ViaVoiceMaxStretch") == 0) {
+                double v = atof(value);
+                if (v >= 1.0 && v <= WSOLA_MAX_SPEED) {
+                    s->max_stretch = v;
+                    INFO("Config: max stretch %.2f", v);
+                }
+            }
+            else if (strcasecmp(key, "ViaVoiceTrimText") == 0) {
+                if (parse_trim_db(value, &s->profile[PROFILE_TEXT].trim_db))
+                    INFO("Config: trim text %s", value);
+            }
+            else if (strcasecmp(key, "ViaVoiceTrimSoundIcon") == 0) {
+                if (parse_trim_db(value, &s->profile[PROFILE_SOUND_ICON].trim_db))
+                    INFO("Config: trim sound icon %s", value);
+            }
+            else if (strcasecmp(key, "ViaVoiceTrimChar") == 0) {
+                if (parse_trim_db(value, &s->profile[PROFILE_CHAR].trim_db))
+                    INFO("Config: trim char %s", value);
+            }
+            else if (strcasecmp(key, "ViaVoiceTrimKey") == 0) {
+                if (parse_trim_db(value, &s->profile[PROFILE_KEY].trim_db))
+                    INFO("Config: trim key %s", value);
+            }
+            else if (strcasecmp(key, "ViaVoiceTrimPad") == 0) {
+                int v = atoi(value);
+                if (v >= 0 && v <= 500) {
+                    s->trim_pad_ms = v;
+                    INFO("Config: trim pad %d ms", v);
+                }
+            }
+            else if (strcasecmp(key, "ViaVoiceMaxPause") == 0) {
+                int v = atoi(value);
+                if (v >= 0 && v <= 5000) {
+                    s->max_pause_ms = v;
+                    INFO("Config: max pause %d ms", v);
+                }
+            }
+            else if (strcasecmp(key, "ViaVoiceDsp") == 0) {
+                int v = dsp_parse_stages(value);
+                if (v >= 0) {
+                    s->dsp_stages = v;
+                    INFO("Config: DSP stages %s", value);
+                } else {
+                    WARN("Config: unknown DSP stage in %s", value);
+                }
+            }
+            else if (strcasecmp(key, "ViaVoiceGain") == 0) {
+                double v = atof(value);
+                if (v >= -20.0 && v <= 20.0) {
+                    s->gain_db = v;
+                    INFO("Config: gain %.1f dB", v);
+                }
+            }
+            else if (strcasecmp(key, "ViaVoiceLoudnessTarget") == 0) {
+                double v = atof(value);
+                if (v >= -40.0 && v <= -6.0) {
+                    s->loudness_target = v;
+                    INFO("Config: loudness target %.1f dBFS", v);
+                }
+            }
+            else if (strcasecmp(key, "ViaVoiceIncremental") == 0) {
+                int v = atoi(value);
+                if (v >= 0 && v <= 1) {
+                    s->incremental = v;
+                    INFO("Config: incremental synthesis %d", v);
+                }
+            }
+            else if (strcasecmp(key, "ViaVoiceTrace") == 0) {
+                strncpy(s->trace_path, value, sizeof(s->trace_path) - 1);
+                s->trace_path[sizeof(s->trace_path) - 1] = '\0';
+                INFO("Config: trace file %s", s->trace_path);
+            }
+            else if (strcasecmp(key, "ViaVoiceTraceEvents") == 0) {
+                int v = atoi(value);
+                if (v >= 1024 && v <= 16777216) {
+                    s->trace_events = v;
+                    INFO("Config: trace ring %d events", v);
+                }
+            }
+            else if (strcasecmp(key, "ViaVoiceLogLevel") == 0) {
+                int v = atoi(value);
+                if (v >= 0 && v <= LOG_LEVEL_DEBUG) {
+                    s->log_level = v;
+                    INFO("Config: log level %d", v);
+                }
+            }
+            else if (strcasecmp(key, "ViaVoiceAudioOutput") == 0) {
+                strncpy(s->audio_output, value, sizeof(s->audio_output) - 1);
+                s->audio_output[sizeof(s->audio_output) - 1] = '\0';
+                INFO("Config: audio output %s", s->audio_output);
+            }
+            else if (strcasecmp(key, "ViaVoiceAudioDevice") == 0) {
+                strncpy(s->audio_device, value, sizeof(s->audio_device) - 1);
+                s->audio_device[sizeof(s->audio_device) - 1] = '\0';
+                INFO("Config: audio device %s", s->audio_device);
+            }
+            else if (strcasecmp(key, "ViaVoiceMainDict") == 0) {
+                strncpy(s->main_dict, value, sizeof(s->main_dict) - 1);
+                s->main_dict[sizeof(s->main_dict) - 1] = '\0';
+                INFO("Config: main dictionary %s", s->main_dict);
+            }
+            else if (strcasecmp(key, "ViaVoiceRootDict") == 0) {
+                strncpy(s->root_dict, value, sizeof(s->root_dict) - 1);
+                s->root_dict[sizeof(s->root_dict) - 1] = '\0';
+                INFO("Config: root dictionary %s", s->root_dict);
+            }
+            else if (strcasecmp(key, "ViaVoiceAbbrevDict") == 0) {
+                strncpy(s->abbrev_dict, value, sizeof(s->abbrev_dict) - 1);
+                s->abbrev_dict[sizeof(s->abbrev_dict) - 1] = '\0';
+                INFO("Config: abbreviation dictionary %s", s->abbrev_dict);
+            }
+            else if (strcasecmp(key, "ViaVoiceRewriteRules") == 0) {
+                strncpy(s->rewrite_rules, value, sizeof(s->rewrite_rules) - 1);
+                s->rewrite_rules[sizeof(s->rewrite_rules) - 1] = '\0';
+                INFO("Config: rewrite rules %s", s->rewrite_rules);
+            }
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+/* Load one dictionary volume into dict, reporting how long it took */
+static void load_dict_volume(ECIHand h, ECIDictHand dict, ECIDictVolume volume,
+                             const char *name, const char *path)
+{
+    if (path[0] == '\0')
+        return;
+
+    unsigned long long start = stats_now();
+    ECIDictError err = eciLoadDict(h, dict, volume, path);
+    unsigned long long ms = (stats_now() - start) / 1000;
+
+    if (err == DictNoError)
+        NOTICE("Loaded %s dictionary %s in %llu ms", name, path, ms);
+    else
+        WARN("Failed to load %s dictionary: %s (error %d)", name, path, err);
+}
+
+ECIDictHand config_dictionary(ECIHand h, const Settings *s)
+{
+    ECIDictHand dict = eciNewDict(h);
+    if (dict == NULL_DICT_HAND) {
+        WARN("Failed to create dictionary handle");
+        return NULL_DICT_HAND;
+    }
+
+    load_dict_volume(h, dict, eciMainDict, "main", s->main_dict);
+    load_dict_volume(h, dict, eciRootDict, "root", s->root_dict);
+    load_dict_volume(h, dict, eciAbbvDict, "abbreviation", s->abbrev_dict);
+    return dict;
+}
+
+void config_engine(ECIHand h, const Settings *s, EngineParams *p)
+{
+    engparams_init(p, h);
+    EngineValues defaults = p->have;
+    if (s->voice != 0 && eciCopyVoice(h, s->voice, 0))
+        engparams_voice_copied(p, h);
+    config_voice_params(s, p);
+    config_engine_params(s, p, &defaults);
+    engparams_commit(p, h);
+
+    if (config_has_dictionaries(s)) {
+        ECIDictHand dict = config_dictionary(h, s);
+        if (dict != NULL_DICT_HAND && eciSetDict(h, dict) != DictNoError) {
+            WARN("Failed to activate dictionary");
+            eciDeleteDict(h, dict);
+        }
+    }
+}
+
+void config_voice_params(const Settings *s, EngineParams *p)
+{
+    if (s->pitch_baseline >= 0)
+        engparams_voice(p, eciPitchBaseline, s->pitch_baseline);
+    if (s->pitch_fluctuation >= 0)
+        engparams_voice(p, eciPitchFluctuation, s->pitch_fluctuation);
+    if (s->speed >= 0)
+        engparams_voice(p, eciSpeed, s->speed);
+    if (s->volume >= 0)
+        engparams_voice(p, eciVolume, s->volume);
+    if (s->head_size >= 0)
+        engparams_voice(p, eciHeadSize, s->head_size);
+    if (s->roughness >= 0)
+        engparams_voice(p, eciRoughness, s->roughness);
+    if (s->breathiness >= 0)
+        engparams_voice(p, eciBreathiness, s->breathiness);
+}
+
+void config_engine_params(const Settings *s, EngineParams *p,
+                          const EngineValues *defaults)
+{
+    engparams_set(p, eciSampleRate, s->sample_rate);
+    engparams_set(p, eciPhrasePrediction, s->phrase_prediction >= 0 ?
+                  s->phrase_prediction : defaults->param[eciPhrasePrediction]);
+    /* ECI uses 0=enabled, 1=disabled; we invert for consistent config convention */
+    engparams_set(p, eciDictionary, s->dictionary >= 0 ?
+                  !s->dictionary : defaults->param[eciDictionary]);
+    engparams_set(p, eciNumberMode, s->number_mode >= 0 ?
+                  s->number_mode : defaults->param[eciNumberMode]);
+    engparams_set(p, eciTextMode, s->text_mode >= 0 ?
+                  s->text_mode : defaults->param[eciTextMode]);
+    engparams_set(p, eciRealWorldUnits, s->real_world_units >= 0 ?
+                  s->real_world_units : defaults->param[eciRealWorldUnits]);
+}
+
+int config_sample_rate_hz(int sample_rate)
+{
+    switch (sample_rate) {
+        case 0: return 8000;
+        case 1: return 11025;
+        default: return 22050;
+    }
+}
+
+int config_has_dictionaries(const Settings *s)
+{
+    return s->main_dict[0] != '\0' || s->root_dict[0] != '\0' || s->abbrev_dict[0] != '\0';
+}
+
+Rewriter *config_rewriter(const Settings *s)
+{
+    static const char *const how_names[] = {
+        [REWRITE_TEXT] = "compiled",
+        [REWRITE_IMAGE] = "mapped",
+        [REWRITE_STALE] = "compiled the changed sources of",
+        [REWRITE_STALE_KEPT] = "mapped stale",
+    };
+    int how = REWRITE_TEXT;
+
+    if (s->rewrite_rules[0] == '\0')
+        return rewrite_load(NULL, 0);
+
+    unsigned long long start = stats_now();
+    Rewriter *rw = rewrite_open(s->rewrite_rules, &how);
+    unsigned long long us = stats_now() - start;
+
+    if (!rw) {
+        WARN("Failed to load rewrite rules %s: %s", s->rewrite_rules, strerror(errno));
+        return NULL;
+    }
+
+    if (how == REWRITE_STALE_KEPT)
+        WARN("Rule files of %s changed but failed to compile: %s", s->rewrite_rules, strerror(errno));
+
+    int rules, states;
+    size_t bytes;
+    rewrite_size(rw, &rules, &states, &bytes);
+    NOTICE("Rewrite rules: %s %s in %llu us, %d rules (%d states, %zu KiB)",
+           how_names[how], s->rewrite_rules, us, rules, states, bytes / 1024);
+    return rw;
+}
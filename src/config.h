@@ -0,0 +1,135 @@
+/*
+ * config.h - viavoice.conf and what it names
+ *
+ * Copyright (C) 2025
+ */
+
+#ifndef _CONFIG_H
+#define _CONFIG_H
+
+#include <stddef.h>
+
+#include "eci_viavoice.h"
+#include "engparams.h"
+#include "rewrite.h"
+
+/* How each message type is spoken, from the [text], [sound_icon], [char]
+ * and [key] sections of viavoice.conf.  begin_utterance() picks one by
+ * message type, so nothing is parsed per message. */
+enum { PROFILE_TEXT, PROFILE_SOUND_ICON, PROFILE_CHAR, PROFILE_KEY, PROFILE_TYPES };
+
+typedef struct {
+    double rate;                /* multiplies the speech-dispatcher rate */
+    int trim_db;                /* silence threshold in dBFS, 0 = off */
+    int voice;                  /* 0-7 preset, -1 = ViaVoiceDefaultVoice */
+    int cache;                  /* one-character messages from the character cache */
+} Profile;
+
+/* Everything viavoice.conf sets.  A reload parses the file into a new
+ * Settings and the synthesis thread switches to it between messages. */
+typedef struct {
+    int sample_rate;            /* 0=8000, 1=11025, 2=22050 */
+    int voice;                  /* 0-7 ViaVoice preset, ViaVoiceDefaultVoice */
+
+    /* Custom voice parameters on top of the preset, -1 = voice default */
+    int pitch_baseline;
+    int pitch_fluctuation;
+    int speed;
+    int volume;
+    int head_size;
+    int roughness;
+    int breathiness;
+
+    /* Dictionary paths */
+    char main_dict[256];
+    char root_dict[256];
+    char abbrev_dict[256];
+
+    char rewrite_rules[256];    /* module-side rewrite rules, "" = none */
+
+    /* Global ECI parameters, -1 = engine default */
+    int phrase_prediction;
+    int dictionary;             /* abbreviation dictionaries */
+    int number_mode;
+    int text_mode;
+    int real_world_units;
+
+    double max_stretch;         /* time compression past rate 250, 1.0 = off */
+
+    Profile profile[PROFILE_TYPES];
+    int trim_pad_ms;
+    int max_pause_ms;           /* 0 = keep internal pauses */
+
+    int dsp_stages;             /* DSP_STAGE_* bits */
+    double gain_db;
+    double loudness_target;     /* dBFS over voiced frames */
+
+    int incremental;            /* synthesize TEXT while it arrives */
+
+    char trace_path[256];       /* timeline trace, "" = off */
+    int trace_events;
+
+    int log_level;              /* -1 = leave as is */
+
+    /* Where the module plays audio: "server", "auto", or backends to
+     * try in order; taken at startup only */
+    char audio_output[64];
+    char audio_device[256];     /* sink, PCM or wav file, "" = default */
+} Settings;
+
+/* Integer engine and voice parameters, which viavoice.conf and SET
+ * both set, with the ranges either accepts */
+typedef struct {
+    const char *key;            /* in viavoice.conf */
+    const char *var;            /* SET variable */
+    size_t offset;              /* of the int in Settings */
+    int min, max;
+    const char *what;           /* for the log */
+} IntSetting;
+
+#define INT_SETTINGS 12
+
+extern const Settings default_settings;
+extern const IntSetting int_settings[INT_SETTINGS];
+extern const char *const voice_name_table[ECI_PRESET_VOICES];
+
+/* Read viavoice.conf into s, on top of what s already holds.  Returns
+ * -1 with errno set if it cannot be opened. */
+int config_parse(const char *path, Settings *s);
+
+/* The entry of int_settings with this viavoice.conf key, or SET
+ * variable if var is set */
+const IntSetting *config_int_setting(const char *name, int var);
+
+/* Parse value for is, within its range */
+int config_parse_int(const IntSetting *is, const char *value, int *v);
+
+/* Record in p the parameters s customizes voice 0 with, to follow a
+ * copy of the preset to voice 0 */
+void config_voice_params(const Settings *s, EngineParams *p);
+
+/* Record in p the engine parameters s sets.  Those it leaves unset go
+ * back to defaults, the engine's values at startup. */
+void config_engine_params(const Settings *s, EngineParams *p,
+                          const EngineValues *defaults);
+
+/* Set up a new engine from s for the tools: s's voice in voice 0 with
+ * its parameters, the engine parameters and the dictionaries.  p is
+ * initialized from the engine and left holding what it was set to. */
+void config_engine(ECIHand h, const Settings *s, EngineParams *p);
+
+/* ViaVoiceSampleRate's 0, 1 or 2 in Hz */
+int config_sample_rate_hz(int sample_rate);
+
+int config_has_dictionaries(const Settings *s);
+
+/* Build a complete dictionary for h from s's paths, reporting how long
+ * each volume took.  The engine does not use it until eciSetDict(). */
+ECIDictHand config_dictionary(ECIHand h, const Settings *s);
+
+/* Load s's rewrite rules, mapping them when they are a compiled image,
+ * and report how long it took.  Without a rule file the result is an
+ * empty set, which turns rewriting off. */
+Rewriter *config_rewriter(const Settings *s);
+
+#endif /* _CONFIG_H */
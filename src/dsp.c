@@ -0,0 +1,255 @@
+/*
+ * dsp.c - SIMD kernels for the post-synthesis audio path
+ *
+ * Copyright (C) 2025
+ *
+ * Each kernel works on 16-bit mono PCM as delivered by the engine.  The
+ * SSE2 versions handle eight samples per step; the scalar loops cover
+ * the tail and builds without SSE2.
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "dsp.h"
+
+long long dsp_sum_squares(const short *x, int n)
+{
+    long long sum = 0;
+    int i = 0;
+
+#ifdef __SSE2__
+    /* Halve the samples so a pair of squares always fits an int32
+     * lane, then widen into two int64 lanes every step. */
+    __m128i acc = _mm_setzero_si128();
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_srai_epi16(_mm_loadu_si128((const __m128i *)(x + i)), 1);
+        __m128i sq = _mm_madd_epi16(v, v);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+    }
+    long long lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    sum = (lanes[0] + lanes[1]) * 4;
+#endif
+
+    for (; i < n; i++)
+        sum += (long long)x[i] * x[i];
+    return sum;
+}
+
+long long dsp_sum(const short *x, int n)
+{
+    long long sum = 0;
+    int i = 0;
+
+#ifdef __SSE2__
+    /* Pairwise sums against 1 fit an int32 lane for 32k steps; flush
+     * well before that. */
+    const __m128i ones = _mm_set1_epi16(1);
+    while (i + 8 <= n) {
+        __m128i acc = _mm_setzero_si128();
+        int end = i + 8 * 4096 < n ? i + 8 * 4096 : n;
+        for (; i + 8 <= end; i += 8)
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(x + i)), ones));
+        int lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        sum += (long long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+#endif
+
+    for (; i < n; i++)
+        sum += x[i];
+    return sum;
+}
+
+void dsp_offset(short *x, int n, int offset)
+{
+    int i = 0;
+
+    if (offset > 32767) offset = 32767;
+    if (offset < -32767) offset = -32767;
+
+#ifdef __SSE2__
+    const __m128i off = _mm_set1_epi16((short)offset);
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+        _mm_storeu_si128((__m128i *)(x + i), _mm_subs_epi16(v, off));
+    }
+#endif
+
+    for (; i < n; i++) {
+        int v = x[i] - offset;
+        x[i] = v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+    }
+}
+
+void dsp_gain(short *x, int n, int gain_q12)
+{
+    int i = 0;
+
+    if (gain_q12 > 32767) gain_q12 = 32767;
+    if (gain_q12 < 0) gain_q12 = 0;
+
+#ifdef __SSE2__
+    /* 16x16 -> 32-bit products from mullo/mulhi, round, shift back to
+     * Q0 and pack with saturation */
+    const __m128i g = _mm_set1_epi16((short)gain_q12);
+    const __m128i round = _mm_set1_epi32(1 << 11);
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+        __m128i lo = _mm_mullo_epi16(v, g);
+        __m128i hi = _mm_mulhi_epi16(v, g);
+        __m128i p0 = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi16(lo, hi), round), 12);
+        __m128i p1 = _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi16(lo, hi), round), 12);
+        _mm_storeu_si128((__m128i *)(x + i), _mm_packs_epi32(p0, p1));
+    }
+#endif
+
+    for (; i < n; i++) {
+        int v = (x[i] * gain_q12 + (1 << 11)) >> 12;
+        x[i] = v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+    }
+}
+
+/* Above the knee, y = k + (1 - k) * t / (1 + t) with t = (|x| - k) / (1 - k):
+ * continuous slope at the knee and an asymptote at full scale. */
+static inline float limit_one(float v, float k, float range)
+{
+    float a = fabsf(v);
+    if (a <= k)
+        return v;
+    float t = (a - k) / range;
+    float y = k + range * t / (1.0f + t);
+    return v < 0 ? -y : y;
+}
+
+void dsp_soft_limit(short *x, int n, float gain, float knee)
+{
+    const float full = 32767.0f;
+    float k = knee * full;
+    float range = full - k;
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128 vg = _mm_set1_ps(gain);
+    const __m128 vk = _mm_set1_ps(k);
+    const __m128 vrange = _mm_set1_ps(range);
+    const __m128 vinv = _mm_set1_ps(1.0f / range);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 zero = _mm_setzero_ps();
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+        __m128i w[2] = {
+            _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16),
+            _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16),
+        };
+        for (int h = 0; h < 2; h++) {
+            __m128 f = _mm_mul_ps(_mm_cvtepi32_ps(w[h]), vg);
+            __m128 s = _mm_and_ps(f, sign);
+            __m128 a = _mm_andnot_ps(sign, f);
+            __m128 t = _mm_mul_ps(_mm_max_ps(_mm_sub_ps(a, vk), zero), vinv);
+            __m128 y = _mm_add_ps(_mm_min_ps(a, vk),
+                                  _mm_div_ps(_mm_mul_ps(vrange, t), _mm_add_ps(one, t)));
+            w[h] = _mm_cvtps_epi32(_mm_or_ps(y, s));
+        }
+        _mm_storeu_si128((__m128i *)(x + i), _mm_packs_epi32(w[0], w[1]));
+    }
+#endif
+
+    for (; i < n; i++) {
+        float y = limit_one(x[i] * gain, k, range);
+        x[i] = (short)lrintf(y > full ? full : y < -full ? -full : y);
+    }
+}
+
+double dsp_level_db(const short *x, int n, int sample_rate)
+{
+    int frame = sample_rate / 100;
+    double gate = 32768.0 * 32768.0 * 1e-5;     /* -50 dBFS */
+    double energy = 0;
+    long voiced = 0;
+
+    for (int i = 0; i + frame <= n; i += frame) {
+        double e = (double)dsp_sum_squares(x + i, frame);
+        if (e >= gate * frame) {
+            energy += e;
+            voiced += frame;
+        }
+    }
+    if (!voiced)
+        return -100.0;
+    return 10.0 * log10(energy / voiced / (32768.0 * 32768.0));
+}
+
+int dsp_parse_stages(const char *list)
+{
+    static const struct { const char *name; int bit; } names[] = {
+        { "dc",        DSP_STAGE_DC },
+        { "normalize", DSP_STAGE_NORMALIZE },
+        { "gain",      DSP_STAGE_GAIN },
+        { "limit",     DSP_STAGE_LIMIT },
+    };
+    int stages = 0;
+
+    while (*list) {
+        size_t len = strcspn(list, ",");
+        int found = 0;
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+            if (strlen(names[i].name) == len && !strncasecmp(list, names[i].name, len)) {
+                stages |= names[i].bit;
+                found = 1;
+            }
+        }
+        if (!found && len)
+            return -1;
+        list += len;
+        if (*list == ',')
+            list++;
+    }
+    return stages;
+}
+
+void dsp_chain_init(DspChain *chain, int stages, int sample_rate, double gain_db)
+{
+    chain->stages = stages;
+    chain->gain = (float)pow(10.0, gain_db / 20.0);
+    chain->normalize = 1.0f;
+    chain->knee = 0.9f;
+    chain->dc = 0.0f;
+    chain->dc_window = sample_rate / 2;
+}
+
+void dsp_chain_process(DspChain *chain, short *buf, int n)
+{
+    if (n <= 0)
+        return;
+
+    if (chain->stages & DSP_STAGE_DC) {
+        float mean = (float)dsp_sum(buf, n) / n;
+        float weight = n < chain->dc_window ? (float)n / chain->dc_window : 1.0f;
+        chain->dc += (mean - chain->dc) * weight;
+        int offset = (int)lrintf(chain->dc);
+        if (offset)
+            dsp_offset(buf, n, offset);
+    }
+
+    float g = 1.0f;
+    if (chain->stages & DSP_STAGE_NORMALIZE)
+        g *= chain->normalize;
+    if (chain->stages & DSP_STAGE_GAIN)
+        g *= chain->gain;
+
+    if (chain->stages & DSP_STAGE_LIMIT)
+        dsp_soft_limit(buf, n, g, chain->knee);
+    else if (g != 1.0f)
+        dsp_gain(buf, n, (int)lrintf(g * 4096.0f));
+}
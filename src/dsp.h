@@ -0,0 +1,58 @@
+/*
+ * dsp.h - SIMD kernels for the post-synthesis audio path
+ *
+ * Copyright (C) 2025
+ */
+
+#ifndef _DSP_H
+#define _DSP_H
+
+/* Sum of squares of n int16 samples */
+long long dsp_sum_squares(const short *x, int n);
+
+/* Sum of n int16 samples */
+long long dsp_sum(const short *x, int n);
+
+/* Subtract a constant from every sample, saturating */
+void dsp_offset(short *x, int n, int offset);
+
+/* Multiply by a Q12 fixed-point gain (4096 = unity), saturating */
+void dsp_gain(short *x, int n, int gain_q12);
+
+/* Multiply by gain, then round off peaks above knee (fraction of full
+ * scale) instead of clipping them */
+void dsp_soft_limit(short *x, int n, float gain, float knee);
+
+/* Level in dBFS of the voiced 10 ms frames of x, -100 if all silent */
+double dsp_level_db(const short *x, int n, int sample_rate);
+
+
+/* Post-synthesis chain.  Stages always run in this order; gain stages
+ * feed the limiter, so boosted peaks are rounded off rather than
+ * clipped. */
+enum {
+    DSP_STAGE_DC        = 1 << 0,   /* DC-offset removal */
+    DSP_STAGE_NORMALIZE = 1 << 1,   /* per-voice loudness correction */
+    DSP_STAGE_GAIN      = 1 << 2,   /* fixed user gain */
+    DSP_STAGE_LIMIT     = 1 << 3,   /* soft limiter */
+};
+
+typedef struct {
+    int stages;         /* DSP_STAGE_* bits */
+    float gain;         /* linear user gain */
+    float normalize;    /* linear loudness correction */
+    float knee;         /* limiter knee, fraction of full scale */
+    float dc;           /* running DC estimate */
+    int dc_window;      /* samples the DC estimate averages over */
+} DspChain;
+
+/* Parse a comma-separated stage list ("dc,normalize,gain,limit").
+ * Returns the DSP_STAGE_* bits, or -1 on an unknown name. */
+int dsp_parse_stages(const char *list);
+
+void dsp_chain_init(DspChain *chain, int stages, int sample_rate, double gain_db);
+
+/* Process one engine buffer in place */
+void dsp_chain_process(DspChain *chain, short *buf, int n);
+
+#endif /* _DSP_H */
@@ -0,0 +1,81 @@
+/*
+ * engparams.c - Shadow of the engine's parameters
+ *
+ * Copyright (C) 2025
+ *
+ * The module sets the rate, pitch and volume for every message, and the
+ * text mode and pitch again around every spelling pass, while they
+ * rarely change between messages.  Each is a call into the engine.  The
+ * values set are kept here and a call is only made for a value the
+ * engine does not already hold.  What the engine holds also describes
+ * the voice exactly, so the character cache is keyed on it.
+ */
+
+#include "engparams.h"
+#include "stats.h"
+
+void engparams_init(EngineParams *p, ECIHand h)
+{
+    for (int i = 0; i < eciNumParams; i++)
+        p->have.param[i] = eciGetParam(h, (ECIParam)i);
+    for (int i = 0; i < eciNumVoiceParams; i++)
+        p->have.voice[i] = eciGetVoiceParam(h, 0, (ECIVoiceParam)i);
+    p->want = p->have;
+    p->touched = p->touched_voice = 0;
+}
+
+void engparams_set(EngineParams *p, ECIParam param, int value)
+{
+    p->want.param[param] = value;
+    p->touched |= 1u << param;
+}
+
+void engparams_voice(EngineParams *p, ECIVoiceParam param, int value)
+{
+    p->want.voice[param] = value;
+    p->touched_voice |= 1u << param;
+}
+
+void engparams_voice_copied(EngineParams *p, ECIHand h)
+{
+    for (int i = 0; i < eciNumVoiceParams; i++)
+        p->have.voice[i] = p->want.voice[i] = eciGetVoiceParam(h, 0, (ECIVoiceParam)i);
+    p->touched_voice = 0;
+}
+
+int engparams_commit(EngineParams *p, ECIHand h)
+{
+    int calls = 0, skipped = 0, failed = 0;
+
+    for (int i = 0; i < eciNumParams; i++) {
+        if (p->want.param[i] == p->have.param[i]) {
+            skipped += (p->touched >> i) & 1;
+            continue;
+        }
+        calls++;
+        if (eciSetParam(h, (ECIParam)i, p->want.param[i]) < 0) {
+            failed++;
+            p->want.param[i] = p->have.param[i];
+        } else {
+            p->have.param[i] = p->want.param[i];
+        }
+    }
+    for (int i = 0; i < eciNumVoiceParams; i++) {
+        if (p->want.voice[i] == p->have.voice[i]) {
+            skipped += (p->touched_voice >> i) & 1;
+            continue;
+        }
+        calls++;
+        if (eciSetVoiceParam(h, 0, (ECIVoiceParam)i, p->want.voice[i]) < 0) {
+            failed++;
+            p->want.voice[i] = p->have.voice[i];
+        } else {
+            p->have.voice[i] = p->want.voice[i];
+        }
+    }
+    p->touched = p->touched_voice = 0;
+
+    stats_count(STAT_PARAM_CALLS, calls);
+    stats_count(STAT_PARAM_SKIPPED, skipped);
+    return failed;
+}
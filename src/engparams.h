@@ -0,0 +1,44 @@
+/*
+ * engparams.h - Shadow of the engine's parameters
+ *
+ * Copyright (C) 2025
+ */
+
+#ifndef _ENGPARAMS_H
+#define _ENGPARAMS_H
+
+#include "eci_viavoice.h"
+
+/* Every engine parameter and every parameter of voice 0, the voice the
+ * engine speaks with */
+typedef struct {
+    int param[eciNumParams];
+    int voice[eciNumVoiceParams];
+} EngineValues;
+
+/* What the module wants the engine's parameters to be and what they are
+ * known to be.  Setting a parameter only records the wish;
+ * engparams_commit() makes the calls for the ones that differ. */
+typedef struct {
+    EngineValues want;
+    EngineValues have;          /* as the engine holds them */
+    unsigned int touched;       /* parameters set since the last commit */
+    unsigned int touched_voice;
+} EngineParams;
+
+/* Read every parameter from the engine */
+void engparams_init(EngineParams *p, ECIHand h);
+
+void engparams_set(EngineParams *p, ECIParam param, int value);
+void engparams_voice(EngineParams *p, ECIVoiceParam param, int value);
+
+/* Voice 0 was overwritten with eciCopyVoice(): read it back, and drop
+ * the wishes for it that were not committed */
+void engparams_voice_copied(EngineParams *p, ECIHand h);
+
+/* Make the engine calls for the parameters that differ from what the
+ * engine holds, counting them and the ones that did not need a call
+ * in the stats.  Returns the number of calls that failed. */
+int engparams_commit(EngineParams *p, ECIHand h);
+
+#endif /* _ENGPARAMS_H */
@@ -0,0 +1,374 @@
+/*
+ * log.c - Leveled asynchronous logging
+ *
+ * Copyright (C) 2025
+ *
+ * A disabled level costs one comparison in the LOG() macro.  An enabled
+ * one captures its arguments into a slot of a bounded lock-free queue
+ * (strings are copied, everything else is stored by value) and wakes a
+ * writer thread, which does the printf formatting and the possibly
+ * blocking write.  The synthesis thread therefore never waits on a slow
+ * journal; if the writer falls behind, messages are dropped and counted
+ * rather than queued without bound.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "log.h"
+
+#define LOG_SLOTS 256           /* power of two */
+#define LOG_MAX_ARGS 12
+#define LOG_STR_BYTES 240
+#define LOG_LINE 1024
+
+enum { ARG_INT, ARG_UINT, ARG_DOUBLE, ARG_STR, ARG_PTR };
+
+typedef struct {
+    unsigned int seq;           /* slot protocol, see log_submit() */
+    int level;
+    const char *fmt;
+    struct timespec ts;
+    int nargs;
+    unsigned char type[LOG_MAX_ARGS];
+    union {
+        long long i;
+        unsigned long long u;
+        double d;
+        const void *p;
+        int str;                /* offset into str[] */
+    } arg[LOG_MAX_ARGS];
+    char str[LOG_STR_BYTES];
+} LogSlot;
+
+int log_level = LOG_LEVEL_NOTICE;
+
+static LogSlot ring[LOG_SLOTS];
+static unsigned int head = 0;       /* next slot producers claim */
+static unsigned int tail = 0;       /* next slot the writer reads */
+static unsigned int dropped = 0;
+static sem_t pending;
+static pthread_t writer;
+static int running = 0;
+static volatile int closing = 0;
+
+static char prefix[32] = "";
+static FILE *out = NULL;            /* NULL = stderr */
+static pthread_mutex_t out_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Parse the conversion after a '%'.  Returns the conversion character,
+ * sets *end past it, *stars to the number of '*' fields and *longness
+ * to 0 (int), 1 (long, size_t) or 2 (long long). */
+static char parse_spec(const char *p, const char **end, int *stars, int *longness)
+{
+    *stars = 0;
+    *longness = 0;
+
+    while (*p && strchr("-+ #0", *p))
+        p++;
+    while (*p == '*' || (*p >= '0' && *p <= '9') || *p == '.') {
+        if (*p == '*')
+            (*stars)++;
+        p++;
+    }
+    while (*p && strchr("hlLqjzt", *p)) {
+        if (*p == 'l' || *p == 'z' || *p == 't')
+            (*longness)++;
+        else if (*p == 'q' || *p == 'j')
+            *longness = 2;
+        p++;
+    }
+    if (*longness > 2)
+        *longness = 2;
+    *end = *p ? p + 1 : p;
+    return *p;
+}
+
+void log_submit(int level, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+
+    if (!running) {
+        /* Before log_open() or after log_close(): write directly */
+        fprintf(stderr, "%s%s", prefix, prefix[0] ? ": " : "");
+        vfprintf(stderr, fmt, ap);
+        fputc('\n', stderr);
+        va_end(ap);
+        return;
+    }
+
+    /* Claim a slot: it is free when its sequence equals the position */
+    LogSlot *slot;
+    unsigned int pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    while (1) {
+        slot = &ring[pos & (LOG_SLOTS - 1)];
+        int dif = (int)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            va_end(ap);
+            return;
+        } else {
+            pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->level = level;
+    slot->fmt = fmt;
+    clock_gettime(CLOCK_REALTIME, &slot->ts);
+    slot->nargs = 0;
+
+    int str_used = 0;
+    const char *p = fmt;
+    while ((p = strchr(p, '%')) != NULL) {
+        int stars, longness;
+        char conv = parse_spec(p + 1, &p, &stars, &longness);
+        int n = slot->nargs;
+
+        if (conv == '%' || conv == '\0')
+            continue;
+        if (n + stars >= LOG_MAX_ARGS)
+            break;
+
+        for (int s = 0; s < stars; s++) {
+            slot->type[n] = ARG_INT;
+            slot->arg[n++].i = va_arg(ap, int);
+        }
+
+        switch (conv) {
+        case 'd': case 'i': case 'c':
+            slot->type[n] = ARG_INT;
+            slot->arg[n].i = longness == 2 ? va_arg(ap, long long) :
+                             longness == 1 ? va_arg(ap, long) : va_arg(ap, int);
+            break;
+        case 'u': case 'o': case 'x': case 'X':
+            slot->type[n] = ARG_UINT;
+            slot->arg[n].u = longness == 2 ? va_arg(ap, unsigned long long) :
+                             longness == 1 ? va_arg(ap, unsigned long) :
+                                             va_arg(ap, unsigned int);
+            break;
+        case 'e': case 'E': case 'f': case 'F':
+        case 'g': case 'G': case 'a': case 'A':
+            slot->type[n] = ARG_DOUBLE;
+            slot->arg[n].d = va_arg(ap, double);
+            break;
+        case 's': {
+            const char *s = va_arg(ap, const char *);
+            size_t len;
+            if (!s)
+                s = "(null)";
+            len = strnlen(s, LOG_STR_BYTES - 1 - str_used);
+            memcpy(slot->str + str_used, s, len);
+            slot->str[str_used + len] = '\0';
+            slot->type[n] = ARG_STR;
+            slot->arg[n].str = str_used;
+            str_used += len + (str_used + len < LOG_STR_BYTES - 1);
+            break;
+        }
+        default:
+            slot->type[n] = ARG_PTR;
+            slot->arg[n].p = va_arg(ap, const void *);
+            break;
+        }
+        slot->nargs = n + 1;
+    }
+    va_end(ap);
+
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    sem_post(&pending);
+}
+
+/* Expand a captured message into line; returns its length */
+static int format_slot(const LogSlot *slot, char *line, int size)
+{
+    const char *p = slot->fmt;
+    int len = 0, a = 0;
+
+    while (*p && len < size - 1) {
+        if (*p != '%') {
+            line[len++] = *p++;
+            continue;
+        }
+
+        const char *start = p, *end;
+        int stars, longness;
+        char conv = parse_spec(p + 1, &end, &stars, &longness);
+        p = end;
+
+        if (conv == '%') {
+            line[len++] = '%';
+            continue;
+        }
+        if (conv == '\0' || a + stars >= slot->nargs) {
+            /* Not captured: show the conversion itself */
+            int n = end - start < size - 1 - len ? end - start : size - 1 - len;
+            memcpy(line + len, start, n);
+            len += n;
+            continue;
+        }
+
+        /* Rebuild the conversion with a length modifier matching how
+         * the argument was stored */
+        char spec[32];
+        int s = 0;
+        for (const char *q = start; q < end - 1 && s < (int)sizeof(spec) - 4; q++)
+            if (!strchr("hlLqjzt", *q))
+                spec[s++] = *q;
+        if (slot->type[a + stars] == ARG_INT || slot->type[a + stars] == ARG_UINT) {
+            if (conv != 'c') {
+                spec[s++] = 'l';
+                spec[s++] = 'l';
+            }
+        }
+        spec[s++] = conv;
+        spec[s] = '\0';
+
+        int w[2] = { 0, 0 };
+        for (int i = 0; i < stars; i++)
+            w[i] = (int)slot->arg[a++].i;
+
+        char *dst = line + len;
+        size_t room = size - len;
+        int n = 0;
+#define EMIT(value) \
+        (stars == 0 ? snprintf(dst, room, spec, value) : \
+         stars == 1 ? snprintf(dst, room, spec, w[0], value) : \
+                      snprintf(dst, room, spec, w[0], w[1], value))
+        switch (slot->type[a]) {
+        case ARG_INT:
+            n = conv == 'c' ? EMIT((int)slot->arg[a].i) : EMIT(slot->arg[a].i);
+            break;
+        case ARG_UINT:
+            n = EMIT(slot->arg[a].u);
+            break;
+        case ARG_DOUBLE:
+            n = EMIT(slot->arg[a].d);
+            break;
+        case ARG_STR:
+            n = EMIT(slot->str + slot->arg[a].str);
+            break;
+        default:
+            n = EMIT(slot->arg[a].p);
+            break;
+        }
+#undef EMIT
+        a++;
+        if (n > 0)
+            len += n < (int)room ? n : (int)room - 1;
+    }
+    line[len] = '\0';
+    return len;
+}
+
+static void write_line(const LogSlot *slot, const char *text)
+{
+    pthread_mutex_lock(&out_mutex);
+    if (out) {
+        struct tm tm;
+        localtime_r(&slot->ts.tv_sec, &tm);
+        fprintf(out, "[%02d:%02d:%02d.%03ld] %s: %s\n", tm.tm_hour, tm.tm_min,
+                tm.tm_sec, slot->ts.tv_nsec / 1000000, prefix, text);
+        fflush(out);
+    } else {
+        fprintf(stderr, "%s: %s\n", prefix, text);
+    }
+    pthread_mutex_unlock(&out_mutex);
+}
+
+static void *writer_thread(void *arg)
+{
+    char line[LOG_LINE];
+    unsigned int reported = 0;
+    (void)arg;
+
+    /* A wake-up is only a hint: a slot can be published after the post
+     * for a later one was consumed, so each time print every slot that
+     * is ready, and on closing all of them before leaving */
+    while (1) {
+        while (sem_wait(&pending) != 0 && errno == EINTR)
+            ;
+
+        while (1) {
+            LogSlot *slot = &ring[tail & (LOG_SLOTS - 1)];
+            if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != tail + 1)
+                break;
+            format_slot(slot, line, sizeof(line));
+            write_line(slot, line);
+            __atomic_store_n(&slot->seq, tail + LOG_SLOTS, __ATOMIC_RELEASE);
+            tail++;
+
+            unsigned int lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+            if (lost != reported) {
+                LogSlot note = { .ts = slot->ts };
+                snprintf(line, sizeof(line), "%u log messages dropped", lost - reported);
+                write_line(&note, line);
+                reported = lost;
+            }
+        }
+        if (closing)
+            break;
+    }
+    return NULL;
+}
+
+int log_open(const char *name)
+{
+    sigset_t all, old;
+
+    snprintf(prefix, sizeof(prefix), "%s", name);
+    for (unsigned int i = 0; i < LOG_SLOTS; i++)
+        ring[i].seq = i;
+    if (sem_init(&pending, 0, 0) != 0)
+        return -1;
+
+    /* The writer must never be picked to handle a signal */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int ret = pthread_create(&writer, NULL, writer_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (ret != 0)
+        return -1;
+
+    running = 1;
+    return 0;
+}
+
+int log_set_file(const char *path)
+{
+    FILE *f = NULL;
+
+    if (path) {
+        f = fopen(path, "a");
+        if (!f)
+            return -1;
+    }
+
+    pthread_mutex_lock(&out_mutex);
+    if (out)
+        fclose(out);
+    out = f;
+    pthread_mutex_unlock(&out_mutex);
+    return 0;
+}
+
+void log_close(void)
+{
+    if (!running)
+        return;
+    closing = 1;
+    sem_post(&pending);
+    pthread_join(writer, NULL);
+    running = 0;
+    log_set_file(NULL);
+}
@@ -0,0 +1,46 @@
+/*
+ * log.h - Leveled asynchronous logging
+ *
+ * Copyright (C) 2025
+ */
+
+#ifndef _LOG_H
+#define _LOG_H
+
+/* Levels as used by speech-dispatcher's LOGLEVEL: higher is chattier */
+#define LOG_LEVEL_ERROR   1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_NOTICE  3
+#define LOG_LEVEL_INFO    4
+#define LOG_LEVEL_DEBUG   5
+
+extern int log_level;
+
+/* Arguments are only evaluated when the level is enabled.  The format
+ * must be a string literal (only the pointer is kept); %s arguments are
+ * copied, up to a couple of hundred bytes per message. */
+#define LOG(level, fmt, ...) \
+    do { if ((level) <= log_level) log_submit(level, fmt, ##__VA_ARGS__); } while (0)
+
+#define ERR(fmt, ...)    LOG(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define WARN(fmt, ...)   LOG(LOG_LEVEL_WARNING, fmt, ##__VA_ARGS__)
+#define NOTICE(fmt, ...) LOG(LOG_LEVEL_NOTICE, fmt, ##__VA_ARGS__)
+#define INFO(fmt, ...)   LOG(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define DBG(fmt, ...)    LOG(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+/* Start the writer thread.  Messages go to stderr, prefixed with
+ * "<prefix>: ", until log_set_file() says otherwise. */
+int log_open(const char *prefix);
+
+/* Queue a message for the writer thread.  Never blocks; if the queue is
+ * full the message is dropped and counted. */
+void log_submit(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* Send output to a file (timestamped), or back to stderr with NULL */
+int log_set_file(const char *path);
+
+/* Write out everything queued and stop the writer thread */
+void log_close(void);
+
+#endif /* _LOG_H */
@@ -35,6 +35,8 @@
 
 #include <spd_audio.h>
 #include "spd_module_main.h"
+#include "stats.h"
+#include "trace.h"
 
 pthread_mutex_t module_stdout_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -77,7 +79,10 @@ static void module_tts_output_send_server(const AudioTrack *track, AudioFormat f
 {
 	const char *p, *end;
 	size_t size = track->num_channels * track->num_samples * track->bits / 8;
+	unsigned long long start = stats_now();
+	unsigned long escapes = 0;
 
+	TRACE_BEGIN("send");
 	pthread_mutex_lock(&module_stdout_mutex);
 	printf("705-bits=%d\n", track->bits);
 	printf("705-num_channels=%d\n", track->num_channels);
@@ -116,6 +121,7 @@ static void module_tts_output_send_server(const AudioTrack *track, AudioFormat f
 		if (stop < end) {
 			putc(escape, stdout);
 			putc((*stop) ^ invert, stdout);
+			escapes++;
 		}
 
 		p = next;
@@ -125,6 +131,11 @@ static void module_tts_output_send_server(const AudioTrack *track, AudioFormat f
 
 	pthread_mutex_unlock(&module_stdout_mutex);
 	fflush(stdout);
+
+	TRACE_END("send");
+	stats_record(STAT_SEND, start);
+	stats_count(STAT_SEND_BYTES, size);
+	stats_count(STAT_ESCAPES, escapes);
 }
 
 /* Arbitrary chunk size in bytes, large enough to get efficient transfer
@@ -174,6 +185,14 @@ void module_tts_output_server(const AudioTrack *track, AudioFormat format)
 #define bad_internal() print("401 ERROR INTERNAL")
 #define bad_memory() print("402 ERROR OUT OF MEMORY")
 
+/* Drop a message module_speak_partial has seen part of */
+static void speak_abort(int partial)
+{
+#pragma weak module_speak_abort
+	if (partial && module_speak_abort)
+		module_speak_abort();
+}
+
 /* some text
  * at will
  * .
@@ -186,7 +205,10 @@ static void cmd_speak(int fd, SPDMessageType msgtype)
 	size_t len;
 	int ret;
 	int nlines = 0;
+	int partial = 0;
+	unsigned long long start = stats_now();
 
+	TRACE_BEGIN("receive");
 	print("202 OK RECEIVING MESSAGE");
 
 	while (1) {
@@ -194,7 +216,9 @@ static void cmd_speak(int fd, SPDMessageType msgtype)
 		int offset = 0;
 		if (!line) {
 			/* EOF */
+			TRACE_END("receive");
 			free(text);
+			speak_abort(partial);
 			return;
 		}
 
@@ -205,6 +229,8 @@ static void cmd_speak(int fd, SPDMessageType msgtype)
 				text[text_len] = 0;
 			}
 			free(line);
+			stats_record(STAT_RECEIVE, start);
+			TRACE_END("receive");
 			break;
 		}
 
@@ -225,6 +251,7 @@ static void cmd_speak(int fd, SPDMessageType msgtype)
 			if (!new_text) {
 				free(line);
 				free(text);
+				speak_abort(partial);
 				bad_internal();
 				return;
 			}
@@ -234,10 +261,20 @@ static void cmd_speak(int fd, SPDMessageType msgtype)
 		memcpy(text + text_len, line, len);
 		text_len += len;
 		free(line - offset);
+
+		/* Other types must be single-line, so only text can be
+		 * started before the final dot */
+#pragma weak module_speak_partial
+		if (msgtype == SPD_MSGTYPE_TEXT && module_speak_partial
+		    && !module_readline_ready()) {
+			module_speak_partial(fd, text, text_len);
+			partial = 1;
+		}
 	}
 
 	if (!text_len) {
 		free(text);
+		speak_abort(partial);
 		print("301 ERROR CANT SPEAK");
 		return;
 	}
@@ -307,12 +344,14 @@ void module_speak_error(void)
 
 static void cmd_stop(void)
 {
+	TRACE_INSTANT("STOP");
 	module_should_stop = 1;
 	module_stop();
 }
 
 static void cmd_pause(void)
 {
+	TRACE_INSTANT("PAUSE");
 	module_should_stop = 1;
 	module_pause();
 }
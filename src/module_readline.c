@@ -77,7 +77,7 @@ char *module_readline(int fd, int block)
 					data_used -= len;
 					if (!data_used)
 						/* Emptied the buffer, just start over */
-						data_ptr = 0;
+						data_ptr = data_no_lf = 0;
 					else
 						data_ptr += len;
 					return str;
@@ -170,8 +170,13 @@ char *module_readline(int fd, int block)
 			return NULL;
 		}
 
-		/* Some more data */
+		/* Some more data; what was already scanned holds no \n */
 		data_used += ret;
-		data_no_lf = 0;
 	}
 }
+
+/* Whether module_readline() can return a line without reading more */
+int module_readline_ready(void)
+{
+	return data_used && memchr(data + data_ptr, '\n', data_used) != NULL;
+}
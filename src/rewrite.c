@@ -0,0 +1,659 @@
+/*
+ * rewrite.c - Pronunciation rewriting before the engine
+ *
+ * Copyright (C) 2025
+ *
+ * All patterns are compiled into one Aho-Corasick automaton, expanded to
+ * a full DFA so that each input byte costs one table lookup however many
+ * rules there are.  Bytes that occur in no pattern share input class 0,
+ * and the two cases of a letter share a class, which keeps the table at
+ * states x classes entries instead of states x 256 and makes matching
+ * case-insensitive at no cost.
+ *
+ * The tables use fixed-width types only, so rewrite_save() can write
+ * them to an image that rewrite_open() maps back without parsing,
+ * whatever the word size of the program that compiled it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rewrite.h"
+
+#define LINE_MAX_BYTES 1024
+
+/* Whole-word requirements of a rule */
+#define RULE_WORD_START 1
+#define RULE_WORD_END   2
+
+typedef struct {
+    uint32_t repl;              /* offset into pool */
+    uint16_t repl_len;
+    uint16_t len;               /* bytes of text matched */
+    uint8_t flags;              /* RULE_WORD_* */
+    uint8_t pad[3];
+} Rule;
+
+struct Rewriter {
+    int nrules;
+    int nstates;
+    int nclasses;
+    uint32_t pool_size;
+    uint8_t cls[256];           /* byte -> input class */
+    uint32_t *next;             /* nstates x nclasses transitions */
+    int32_t *rule;              /* rule ending at a state, -1 = none */
+    uint32_t *out;              /* nearest state on the suffix chain, itself
+                                 * included, where a rule ends; 0 = none */
+    uint32_t *more;             /* the one after that for a state in out[] */
+    Rule *rules;
+    char *pool;                 /* replacement strings */
+
+    void *map;                  /* image the tables point into, or NULL */
+    size_t map_size;
+};
+
+/* Image layout: the header, then each section at an 8-byte aligned
+ * offset.  Offsets and counts are 32-bit, in the byte order of the
+ * machine that wrote it, which IMAGE_BYTE_ORDER checks. */
+#define IMAGE_MAGIC "VVRULES"
+#define IMAGE_VERSION 1
+#define IMAGE_BYTE_ORDER 0x01020304u
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t size;              /* of the whole file */
+    uint32_t nrules, nstates, nclasses, nsources;
+    uint32_t pool_size, paths_size;
+    uint32_t cls, next, rule, out, more, rules, pool, sources, paths;
+    uint32_t pad;
+} ImageHeader;
+
+/* A rule file the image was compiled from, to tell when it is stale */
+typedef struct {
+    uint64_t size;
+    int64_t mtime;
+    uint32_t mtime_ns;
+    uint32_t path;              /* offset of its name in the paths section */
+} ImageSource;
+
+/* A rule as read from the file, before compiling */
+typedef struct {
+    char *pattern;              /* lower-cased, '*' removed */
+    int len;
+    char *repl;
+    int flags;
+} RawRule;
+
+static int is_word(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+static unsigned char fold(unsigned char c)
+{
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+/* Parse one line into r.  Returns 0 if it holds a rule. */
+static int parse_rule(char *line, RawRule *r)
+{
+    size_t n = strcspn(line, "\r\n");
+    line[n] = '\0';
+    if (line[0] == '#' || line[0] == '\0')
+        return -1;
+
+    char *tab = strchr(line, '\t');
+    if (!tab)
+        return -1;
+    *tab = '\0';
+
+    char *pat = line, *end = tab;
+    r->flags = 0;
+    if (*pat == '*')
+        pat++;
+    else if (is_word(*pat))
+        r->flags |= RULE_WORD_START;
+    if (end > pat && end[-1] == '*')
+        end--;
+    else if (end > pat && is_word(end[-1]))
+        r->flags |= RULE_WORD_END;
+
+    r->len = end - pat;
+    if (r->len == 0 || r->len > 0xffff || strlen(tab + 1) > 0xffff)
+        return -1;
+
+    r->pattern = malloc(r->len);
+    r->repl = strdup(tab + 1);
+    if (!r->pattern || !r->repl) {
+        free(r->pattern);
+        free(r->repl);
+        return -1;
+    }
+    for (int i = 0; i < r->len; i++)
+        r->pattern[i] = fold(pat[i]);
+    return 0;
+}
+
+static void free_raw(RawRule *raw, int count)
+{
+    for (int i = 0; i < count; i++) {
+        free(raw[i].pattern);
+        free(raw[i].repl);
+    }
+    free(raw);
+}
+
+/* Build the trie, then turn it into the DFA breadth first: a missing
+ * transition takes the one of the longest proper suffix's state. */
+static int compile(Rewriter *rw, RawRule *raw, int count)
+{
+    size_t max_states = 1, pool_size = 0;
+    int nc = rw->nclasses;
+
+    for (int i = 0; i < count; i++) {
+        max_states += raw[i].len;
+        pool_size += strlen(raw[i].repl) + 1;
+    }
+
+    uint32_t *fail = malloc(max_states * sizeof(uint32_t));
+    uint32_t *queue = malloc(max_states * sizeof(uint32_t));
+    rw->next = calloc(max_states * nc, sizeof(uint32_t));
+    rw->rule = malloc(max_states * sizeof(int32_t));
+    rw->rules = malloc((count ? count : 1) * sizeof(Rule));
+    rw->pool = malloc(pool_size ? pool_size : 1);
+    if (!fail || !queue || !rw->next || !rw->rule || !rw->rules || !rw->pool) {
+        free(fail);
+        free(queue);
+        return -1;
+    }
+
+    rw->nstates = 1;
+    rw->rule[0] = -1;
+    size_t pool_used = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t s = 0;
+        for (int k = 0; k < raw[i].len; k++) {
+            uint32_t *t = &rw->next[s * nc + rw->cls[(unsigned char)raw[i].pattern[k]]];
+            if (*t == 0) {
+                *t = rw->nstates;
+                rw->rule[rw->nstates++] = -1;
+            }
+            s = *t;
+        }
+        if (rw->rule[s] >= 0)
+            continue;           /* same pattern again: the first one wins */
+
+        Rule *r = &rw->rules[rw->nrules];
+        r->repl = pool_used;
+        r->repl_len = strlen(raw[i].repl);
+        r->len = raw[i].len;
+        r->flags = raw[i].flags;
+        memcpy(rw->pool + pool_used, raw[i].repl, r->repl_len + 1);
+        pool_used += r->repl_len + 1;
+        rw->rule[s] = rw->nrules++;
+    }
+    rw->pool_size = pool_used;
+
+    rw->out = malloc(rw->nstates * sizeof(uint32_t));
+    rw->more = malloc(rw->nstates * sizeof(uint32_t));
+    if (!rw->out || !rw->more) {
+        free(fail);
+        free(queue);
+        return -1;
+    }
+
+    int head = 0, tail = 0;
+    fail[0] = 0;
+    rw->out[0] = rw->more[0] = 0;
+    for (int c = 0; c < nc; c++) {
+        uint32_t v = rw->next[c];
+        if (v) {
+            fail[v] = 0;
+            queue[tail++] = v;
+        }
+    }
+    while (head < tail) {
+        uint32_t u = queue[head++];
+        rw->out[u] = rw->rule[u] >= 0 ? u : rw->out[fail[u]];
+        rw->more[u] = rw->out[fail[u]];
+        for (int c = 0; c < nc; c++) {
+            uint32_t *t = &rw->next[u * nc + c];
+            if (*t) {
+                fail[*t] = rw->next[fail[u] * nc + c];
+                queue[tail++] = *t;
+            } else {
+                *t = rw->next[fail[u] * nc + c];
+            }
+        }
+    }
+    free(fail);
+    free(queue);
+
+    /* Give back what duplicate prefixes did not use */
+    uint32_t *shrunk = realloc(rw->next, (size_t)rw->nstates * nc * sizeof(uint32_t));
+    if (shrunk)
+        rw->next = shrunk;
+    return 0;
+}
+
+/* Append the rules in path to *raw.  Returns -1 with errno set on
+ * failure. */
+static int read_rules(const char *path, RawRule **raw, int *count, int *allocated)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    char line[LINE_MAX_BYTES];
+    while (fgets(line, sizeof(line), f)) {
+        RawRule r;
+        if (parse_rule(line, &r) != 0)
+            continue;
+        if (*count == *allocated) {
+            int size = *allocated ? *allocated * 2 : 256;
+            RawRule *grown = realloc(*raw, size * sizeof(RawRule));
+            if (!grown) {
+                free(r.pattern);
+                free(r.repl);
+                fclose(f);
+                errno = ENOMEM;
+                return -1;
+            }
+            *raw = grown;
+            *allocated = size;
+        }
+        (*raw)[(*count)++] = r;
+    }
+    fclose(f);
+    return 0;
+}
+
+Rewriter *rewrite_load(const char *const *paths, int npaths)
+{
+    RawRule *raw = NULL;
+    int count = 0, allocated = 0;
+
+    for (int i = 0; i < npaths; i++)
+        if (read_rules(paths[i], &raw, &count, &allocated) != 0) {
+            int err = errno;
+            free_raw(raw, count);
+            errno = err;
+            return NULL;
+        }
+
+    Rewriter *rw = calloc(1, sizeof(Rewriter));
+    if (!rw) {
+        free_raw(raw, count);
+        return NULL;
+    }
+
+    /* Class 0 is every byte no pattern uses */
+    rw->nclasses = 1;
+    for (int i = 0; i < count; i++)
+        for (int k = 0; k < raw[i].len; k++) {
+            unsigned char c = raw[i].pattern[k];
+            if (rw->cls[c] == 0)
+                rw->cls[c] = rw->nclasses++;
+        }
+    for (int c = 'A'; c <= 'Z'; c++)
+        rw->cls[c] = rw->cls[c + ('a' - 'A')];
+
+    int ret = compile(rw, raw, count);
+    free_raw(raw, count);
+    if (ret != 0) {
+        rewrite_free(rw);
+        return NULL;
+    }
+    return rw;
+}
+
+char *rewrite_apply(const Rewriter *rw, const char *text, int *matches)
+{
+    const unsigned char *src = (const unsigned char *)text;
+    size_t len = strlen(text);
+    int found = 0;
+
+    *matches = 0;
+    if (rw->nrules == 0 || len == 0)
+        return strdup(text);
+
+    /* Longest rule that matches from each position */
+    int32_t *from = malloc(len * sizeof(int32_t));
+    if (!from)
+        return NULL;
+    memset(from, 0xff, len * sizeof(int32_t));
+
+    uint32_t s = 0;
+    for (size_t i = 0; i < len; i++) {
+        s = rw->next[s * rw->nclasses + rw->cls[src[i]]];
+        for (uint32_t o = rw->out[s]; o; o = rw->more[o]) {
+            const Rule *r = &rw->rules[rw->rule[o]];
+            if (r->len > i + 1)
+                continue;       /* only from a damaged image */
+            size_t start = i + 1 - r->len;
+            if ((r->flags & RULE_WORD_START) && start > 0 && is_word(src[start - 1]))
+                continue;
+            if ((r->flags & RULE_WORD_END) && i + 1 < len && is_word(src[i + 1]))
+                continue;
+            /* A shorter one ending here starts later, and may be the one
+             * that applies when the longest ends before its start */
+            if (from[start] < 0 || rw->rules[from[start]].len < r->len)
+                from[start] = rw->rule[o];
+            found = 1;
+        }
+    }
+    if (!found) {
+        free(from);
+        return strdup(text);
+    }
+
+    size_t size = 0;
+    for (size_t i = 0; i < len; ) {
+        if (from[i] >= 0) {
+            size += rw->rules[from[i]].repl_len;
+            i += rw->rules[from[i]].len;
+        } else {
+            size++;
+            i++;
+        }
+    }
+
+    char *result = malloc(size + 1), *dst = result;
+    if (result) {
+        for (size_t i = 0; i < len; ) {
+            if (from[i] >= 0) {
+                const Rule *r = &rw->rules[from[i]];
+                memcpy(dst, rw->pool + r->repl, r->repl_len);
+                dst += r->repl_len;
+                i += r->len;
+                (*matches)++;
+            } else {
+                *dst++ = src[i++];
+            }
+        }
+        *dst = '\0';
+    }
+    free(from);
+    return result;
+}
+
+void rewrite_size(const Rewriter *rw, int *rules, int *states, size_t *bytes)
+{
+    *rules = rw->nrules;
+    *states = rw->nstates;
+    *bytes = (size_t)rw->nstates * (rw->nclasses + 3) * sizeof(uint32_t);
+}
+
+static uint32_t align8(uint32_t n)
+{
+    return (n + 7) & ~7u;
+}
+
+static int write_section(FILE *f, const void *data, size_t size)
+{
+    static const char zeros[8];
+    size_t pad = align8(size) - size;
+    return (size && fwrite(data, size, 1, f) != 1) ||
+           (pad && fwrite(zeros, pad, 1, f) != 1) ? -1 : 0;
+}
+
+int rewrite_save(const Rewriter *rw, const char *path,
+                 const char *const *sources, int nsources)
+{
+    ImageHeader h = { .magic = IMAGE_MAGIC };
+    size_t paths_size = 0;
+
+    for (int i = 0; i < nsources; i++)
+        paths_size += strlen(sources[i]) + 1;
+    ImageSource *src = calloc(nsources ? nsources : 1, sizeof(ImageSource));
+    char *names = malloc(paths_size ? paths_size : 1);
+    if (!src || !names) {
+        free(src);
+        free(names);
+        return -1;
+    }
+
+    paths_size = 0;
+    for (int i = 0; i < nsources; i++) {
+        struct stat st;
+        if (stat(sources[i], &st) != 0) {
+            free(src);
+            free(names);
+            return -1;
+        }
+        src[i].size = st.st_size;
+        src[i].mtime = st.st_mtim.tv_sec;
+        src[i].mtime_ns = st.st_mtim.tv_nsec;
+        src[i].path = paths_size;
+        strcpy(names + paths_size, sources[i]);
+        paths_size += strlen(sources[i]) + 1;
+    }
+
+    size_t nstates = rw->nstates;
+    h.version = IMAGE_VERSION;
+    h.byte_order = IMAGE_BYTE_ORDER;
+    h.nrules = rw->nrules;
+    h.nstates = rw->nstates;
+    h.nclasses = rw->nclasses;
+    h.nsources = nsources;
+    h.pool_size = rw->pool_size;
+    h.paths_size = paths_size;
+    h.cls = align8(sizeof(h));
+    h.next = h.cls + align8(sizeof(rw->cls));
+    h.rule = h.next + align8(nstates * rw->nclasses * sizeof(uint32_t));
+    h.out = h.rule + align8(nstates * sizeof(int32_t));
+    h.more = h.out + align8(nstates * sizeof(uint32_t));
+    h.rules = h.more + align8(nstates * sizeof(uint32_t));
+    h.pool = h.rules + align8(rw->nrules * sizeof(Rule));
+    h.sources = h.pool + align8(rw->pool_size);
+    h.paths = h.sources + align8(nsources * sizeof(ImageSource));
+    h.size = h.paths + align8(paths_size);
+
+    /* Written beside the old image and renamed over it, so a module
+     * that has the old one mapped keeps reading a complete file */
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        free(src);
+        free(names);
+        return -1;
+    }
+
+    int ret = write_section(f, &h, sizeof(h)) |
+              write_section(f, rw->cls, sizeof(rw->cls)) |
+              write_section(f, rw->next, nstates * rw->nclasses * sizeof(uint32_t)) |
+              write_section(f, rw->rule, nstates * sizeof(int32_t)) |
+              write_section(f, rw->out, nstates * sizeof(uint32_t)) |
+              write_section(f, rw->more, nstates * sizeof(uint32_t)) |
+              write_section(f, rw->rules, rw->nrules * sizeof(Rule)) |
+              write_section(f, rw->pool, rw->pool_size) |
+              write_section(f, src, nsources * sizeof(ImageSource)) |
+              write_section(f, names, paths_size);
+    free(src);
+    free(names);
+
+    if (fclose(f) != 0 || ret != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* Whether a source file has changed since the image was compiled.  A
+ * missing source is not: the image is all there is to go by. */
+static int source_changed(const ImageSource *src, const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return 0;
+    return (uint64_t)st.st_size != src->size || st.st_mtim.tv_sec != src->mtime ||
+           (uint32_t)st.st_mtim.tv_nsec != src->mtime_ns;
+}
+
+/* Whether a section of n items of item bytes at offset lies inside an
+ * image of size bytes, in 64 bits so that nothing wraps */
+static int section_fits(uint32_t offset, uint64_t n, uint64_t item, size_t size)
+{
+    return offset + n * item <= size;
+}
+
+/* Whether every index in the tables is in range, so that a damaged
+ * image cannot make rewrite_apply() read outside them */
+static int tables_valid(const Rewriter *rw)
+{
+    uint32_t nstates = rw->nstates, nrules = rw->nrules;
+
+    for (int c = 0; c < 256; c++)
+        if (rw->cls[c] >= rw->nclasses)
+            return 0;
+    for (uint64_t i = 0; i < (uint64_t)nstates * rw->nclasses; i++)
+        if (rw->next[i] >= nstates)
+            return 0;
+    for (uint32_t s = 0; s < nstates; s++) {
+        if (rw->rule[s] < -1 || rw->rule[s] >= (int64_t)nrules ||
+            rw->out[s] >= nstates || rw->more[s] >= nstates ||
+            (rw->out[s] && rw->rule[rw->out[s]] < 0) ||
+            (rw->more[s] && rw->rule[rw->more[s]] < 0))
+            return 0;
+    }
+    for (uint32_t i = 0; i < nrules; i++) {
+        const Rule *r = &rw->rules[i];
+        if (r->len == 0 || (uint64_t)r->repl + r->repl_len > rw->pool_size)
+            return 0;
+    }
+    return 1;
+}
+
+/* Point rw's tables into a mapped image after checking that its
+ * sections lie inside it and its indexes inside the tables */
+static int map_image(Rewriter *rw, void *map, size_t size)
+{
+    const ImageHeader *h = map;
+    char *base = map;
+
+    if (size < sizeof(*h) || memcmp(h->magic, IMAGE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != IMAGE_VERSION || h->byte_order != IMAGE_BYTE_ORDER ||
+        h->size != size || h->nstates == 0 || h->nstates > INT32_MAX ||
+        h->nrules > INT32_MAX || h->nclasses == 0 || h->nclasses > 256 ||
+        !section_fits(h->cls, 256, 1, size) ||
+        !section_fits(h->next, (uint64_t)h->nstates * h->nclasses, sizeof(uint32_t), size) ||
+        !section_fits(h->rule, h->nstates, sizeof(int32_t), size) ||
+        !section_fits(h->out, h->nstates, sizeof(uint32_t), size) ||
+        !section_fits(h->more, h->nstates, sizeof(uint32_t), size) ||
+        !section_fits(h->rules, h->nrules, sizeof(Rule), size) ||
+        !section_fits(h->pool, h->pool_size, 1, size) ||
+        !section_fits(h->sources, h->nsources, sizeof(ImageSource), size) ||
+        !section_fits(h->paths, h->paths_size, 1, size) ||
+        (h->paths_size && base[h->paths + h->paths_size - 1] != '\0'))
+        return -1;
+
+    const ImageSource *src = (const ImageSource *)(base + h->sources);
+    for (uint32_t i = 0; i < h->nsources; i++)
+        if (src[i].path >= h->paths_size)
+            return -1;
+
+    rw->nrules = h->nrules;
+    rw->nstates = h->nstates;
+    rw->nclasses = h->nclasses;
+    rw->pool_size = h->pool_size;
+    memcpy(rw->cls, base + h->cls, sizeof(rw->cls));
+    rw->next = (uint32_t *)(base + h->next);
+    rw->rule = (int32_t *)(base + h->rule);
+    rw->out = (uint32_t *)(base + h->out);
+    rw->more = (uint32_t *)(base + h->more);
+    rw->rules = (Rule *)(base + h->rules);
+    rw->pool = base + h->pool;
+    if (!tables_valid(rw))
+        return -1;
+    rw->map = map;
+    rw->map_size = size;
+    return 0;
+}
+
+Rewriter *rewrite_open(const char *path, int *how)
+{
+    char magic[sizeof(IMAGE_MAGIC)];
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) != 0 || pread(fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+        memcmp(magic, IMAGE_MAGIC, sizeof(magic)) != 0) {
+        close(fd);
+        *how = REWRITE_TEXT;
+        return rewrite_load(&path, 1);
+    }
+
+    /* Private and read-only: every module maps the same page cache pages */
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    Rewriter *rw = calloc(1, sizeof(Rewriter));
+    if (!rw || map_image(rw, map, st.st_size) != 0) {
+        free(rw);
+        munmap(map, st.st_size);
+        errno = ENOEXEC;
+        return NULL;
+    }
+
+    const ImageHeader *h = map;
+    const ImageSource *src = (const ImageSource *)((char *)map + h->sources);
+    const char *names = (char *)map + h->paths;
+    int stale = 0;
+    for (uint32_t i = 0; i < h->nsources && !stale; i++)
+        stale = source_changed(&src[i], names + src[i].path);
+    if (!stale) {
+        *how = REWRITE_IMAGE;
+        return rw;
+    }
+
+    /* Compile the sources instead, in the order they were given; if
+     * that fails, stale rules are better than none */
+    const char **paths = malloc(h->nsources * sizeof(char *));
+    Rewriter *fresh = NULL;
+    if (paths) {
+        for (uint32_t i = 0; i < h->nsources; i++)
+            paths[i] = names + src[i].path;
+        fresh = rewrite_load(paths, h->nsources);
+        free(paths);
+    }
+    if (!fresh) {
+        *how = REWRITE_STALE_KEPT;
+        return rw;
+    }
+    rewrite_free(rw);
+    *how = REWRITE_STALE;
+    return fresh;
+}
+
+void rewrite_free(Rewriter *rw)
+{
+    if (!rw)
+        return;
+    if (rw->map) {
+        munmap(rw->map, rw->map_size);
+        free(rw);
+        return;
+    }
+    free(rw->next);
+    free(rw->rule);
+    free(rw->out);
+    free(rw->more);
+    free(rw->rules);
+    free(rw->pool);
+    free(rw);
+}
@@ -0,0 +1,53 @@
+/*
+ * rewrite.h - Pronunciation rewriting before the engine
+ *
+ * Copyright (C) 2025
+ */
+
+#ifndef _REWRITE_H
+#define _REWRITE_H
+
+#include <stddef.h>
+
+typedef struct Rewriter Rewriter;
+
+/* How rewrite_open() got its rules */
+enum {
+    REWRITE_TEXT,               /* compiled a rule file */
+    REWRITE_IMAGE,              /* mapped a compiled image */
+    REWRITE_STALE,              /* compiled an image's changed sources */
+    REWRITE_STALE_KEPT,         /* mapped it as the sources failed to compile */
+};
+
+/* Compile rule files: one "pattern<TAB>replacement" per line, like
+ * main.dict, '#' starting a comment.  Patterns match case-insensitively
+ * and only as whole words, unless they start or end with '*', which
+ * lets them match inside a word on that side.  Where files repeat a
+ * pattern, the first one wins.  No files give an empty set.  Returns
+ * NULL with errno set if a file cannot be read or memory runs out. */
+Rewriter *rewrite_load(const char *const *paths, int count);
+
+/* Map an image written by rewrite_save(), or compile path as a rule
+ * file if it is not one.  An image whose source files changed since it
+ * was written is ignored and the sources are compiled instead, unless
+ * that fails.  Sets *how to REWRITE_*; returns NULL with errno set on
+ * failure. */
+Rewriter *rewrite_open(const char *path, int *how);
+
+/* Write rw as an image for rewrite_open(), recording the size and time
+ * of the rule files it was compiled from.  The image replaces path
+ * atomically. */
+int rewrite_save(const Rewriter *rw, const char *path,
+                 const char *const *sources, int count);
+
+/* Apply every rule in one pass; the leftmost, then longest, match wins
+ * where matches overlap.  Returns a malloc'd string and sets *matches
+ * to the number of replacements made. */
+char *rewrite_apply(const Rewriter *rw, const char *text, int *matches);
+
+/* Rules, automaton states and table bytes, for the log */
+void rewrite_size(const Rewriter *rw, int *rules, int *states, size_t *bytes);
+
+void rewrite_free(Rewriter *rw);
+
+#endif /* _REWRITE_H */
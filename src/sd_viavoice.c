@@ -14,64 +14,195 @@
 #include <string.h>
 #include <pthread.h>
 #include <errno.h>
+#include <math.h>
+#include <poll.h>
 
 #include "spd_module_main.h"
 #include "eci_viavoice.h"
-
-/* Debug output */
-#define DBG(fmt, ...) fprintf(stderr, "sd_viavoice: " fmt "\n", ##__VA_ARGS__)
+#include "audiobuf.h"
+#include "stats.h"
+#include "trace.h"
+#include "log.h"
+#include "text.h"
+#include "watch.h"
+#include "rewrite.h"
+#include "charname.h"
+#include "spellcache.h"
+#include "engparams.h"
+#include "config.h"
+#include "audioout.h"
 
 /* Module state */
 static ECIHand eciHandle = NULL_ECI_HAND;
+static EngineParams eci_params;         /* set through this, not directly */
+static EngineValues eci_defaults;       /* the engine's own, at startup */
 static short *audio_buffer = NULL;
 static int audio_buffer_size = 20000;
 static volatile int stop_requested = 0;
 static int eci_sample_rate = 22050;
-static int config_sample_rate = 2;  /* 0=8000, 1=11025, 2=22050 (default) */
-
-/* Custom voice parameters (applied on top of preset voice) */
-static int config_pitch_baseline = -1;   /* -1 = use voice default */
-static int config_pitch_fluctuation = -1;
-static int config_speed = -1;
-static int config_volume = -1;
-static int config_head_size = -1;
-static int config_roughness = -1;
-static int config_breathiness = -1;
-
-/* Dictionary paths */
-static char config_main_dict[256] = "";
-static char config_root_dict[256] = "";
-static char config_abbrev_dict[256] = "";
-
-/* Global ECI parameters */
-static int config_phrase_prediction = 0;  /* 0 = disabled by default */
-static int config_dictionary = 0;         /* 0 = abbreviation dicts disabled by default */
-static int config_number_mode = -1;
-static int config_text_mode = -1;
-static int config_real_world_units = -1;
+
+static Settings config;                 /* in effect */
+static Settings file_config;            /* as viavoice.conf has it */
+static char config_file[256] = "";     /* for reloads, "" = none */
+static Settings *settings_pending = NULL;  /* reloaded, not yet in effect */
+
+/* SET viavoice_* values, in int_settings order, which take the place of
+ * viavoice.conf's from the next message on, across reloads */
+static int set_value[INT_SETTINGS];
+static unsigned int set_mask = 0;       /* bits of the ones SET */
+static int set_changed = 0;             /* not yet in effect */
+
+/* Bits of the files in watch_paths() */
+#define WATCH_CONFIG 1u
+#define WATCH_DICTS  0xeu                  /* main, root, abbreviation */
+#define WATCH_RULES  0x10u
+#define WATCH_FILES  5
 
 /* Dictionary handle */
 static ECIDictHand dictHandle = NULL_DICT_HAND;
 
-/* Voice settings — the voice is fixed at init from viavoice.conf */
-static int config_voice = 0;   /* 0-7 ViaVoice preset, set via ViaVoiceDefaultVoice */
+/* Dictionaries load on their own thread so INIT is answered at once.
+ * The finished handle waits in dict_pending until the next utterance
+ * starts, and is switched to there. */
+static pthread_t dict_thread;
+static int dict_loading = 0;            /* dict_thread needs joining */
+static ECIDictHand dict_pending = NULL_DICT_HAND;
+
+/* Rewrite rules are compiled on the same threads as the dictionaries
+ * and taken up when the next message is parsed */
+static Rewriter *rewriter = NULL;
+static Rewriter *rewriter_pending = NULL;
+
+/* Runtime voice settings from speech-dispatcher */
+static int spd_rate = 0;       /* -100..100 as last set */
 static int current_rate = 50;  /* 0-250, default 50 */
 static int current_pitch = 65; /* 0-100, default 65 */
 static int current_volume = 90;
+static int utterance_rate = 50;        /* current_rate under this message's profile */
+static int punct_mode = PUNCT_NONE;    /* SET punctuation_mode */
+static int spelling_mode = 0;          /* SET spelling_mode */
+static int cap_recogn = 0;             /* SET cap_let_recogn, CAP_* */
+
+/* How capital letters are told apart when spelled.  speech-dispatcher's
+ * "icon" has no sound icon to play here, so it raises the pitch. */
+enum { CAP_NONE, CAP_SPELL, CAP_PITCH };
+
+/* Characters prerendered for spelling and CHAR messages.  The cache
+ * holds for the engine parameters in spell_voice; spell_epoch moves on
+ * whenever a reload or a dictionary could change how they sound. */
+#define SPELL_GAP_MS    120     /* between letters at speed 50 */
+#define SPELL_CAP_PITCH 20      /* pitch raise for capitals */
+#define SPELL_QUIET     64      /* level trimmed off the ends of clips */
+static SpellCache spell_cache;
+static struct {
+    EngineValues engine;
+    int epoch;
+} spell_voice;
+static int spell_epoch = 0;
+static int *render_marks = NULL;       /* index positions while rendering */
+static int render_count = 0;
 
-static const char *voice_name_table[] = {
-    "Wade", "Flo", "Bobbie", "Male2", "Male3", "Female2", "Grandma", "Grandpa"
-};
+/* Voice 0 is the one the engine speaks with.  The configured voice is
+ * also kept in a user-defined slot, so that a profile's own voice can be
+ * switched back from; active_voice is the slot last copied to voice 0. */
+#define VOICE_CONFIGURED (ECI_PRESET_VOICES + ECI_USER_DEFINED_VOICES - 1)
+#define VOICE_PRESET0    (VOICE_CONFIGURED - 1)  /* voice 0 as the engine started */
+static int active_voice = VOICE_CONFIGURED;
+
+/* Time compression beyond the engine's 250 speed ceiling */
+static double current_stretch = 1.0;
+static WsolaState *wsola = NULL;
+static int stretch_active = 0;
+
+/* Silence trimming, thresholds in dBFS per message type (0 = off) */
+static SilenceTrim trim;
+static int trim_active = 0;
+
+/* Post-synthesis DSP chain */
+static DspChain dsp_chain;
+static int dsp_active = 0;
+
+/* Loudness of each preset voice, by preset number, and of the
+ * configured voice in LEVEL_CONFIGURED, in centibels; 0 = not measured.
+ * A calibration thread with an engine of its own measures them, so
+ * neither INIT nor a message waits for it.  Until a voice is measured it
+ * plays without normalization. */
+#define LEVEL_CONFIGURED ECI_PRESET_VOICES
+#define LEVELS_ALL       ((1u << (ECI_PRESET_VOICES + 1)) - 1)
+static int voice_level_cb[ECI_PRESET_VOICES + 1];
+
+static pthread_t calib_thread;
+static int calib_running = 0;           /* calib_thread needs joining */
+static pthread_mutex_t calib_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t calib_cond = PTHREAD_COND_INITIALIZER;
+static Settings calib_settings;         /* the configured voice to measure */
+static unsigned int calib_mask = 0;     /* bits of the levels to measure */
+static int calib_quit = 0;
+
+/* Sentence synthesized to measure each voice's loudness, at the speed,
+ * pitch and volume speech-dispatcher starts with; those are set per
+ * message, so they are the same for every voice */
+#define CALIBRATION_TEXT "The quick brown fox jumps over the lazy dog. How are you today?"
+#define CALIBRATION_SPEED  50
+#define CALIBRATION_PITCH  65
+#define CALIBRATION_VOLUME 90
 
 /* Collected audio data */
+static AudioData audio_data = {NULL, 0, 0};
+static pthread_mutex_t audio_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Message text split at SSML <mark/> tags.  Each piece is queued with
+ * eciAddText followed by eciInsertIndex(i + 1), so the index reply
+ * tells where in the audio the mark falls. */
+typedef struct {
+    char *text;     /* normalized text before the mark, may be empty */
+    char *mark;     /* name of the mark ending this piece, NULL for the last */
+    int sample;     /* audio position the mark was reached at, -1 if not yet */
+} Piece;
+
 typedef struct {
-    short *samples;
-    int num_samples;
+    Piece *pieces;
+    int count;
     int allocated;
-} AudioData;
+} Utterance;
 
-static AudioData audio_data = {NULL, 0, 0};
-static pthread_mutex_t audio_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Utterance utterance = {NULL, 0, 0};
+
+/* A paused message keeps its audio so the resumed message, which the
+ * server re-sends from the last reported mark, plays without going
+ * through the engine again */
+static volatile int pause_requested = 0;
+static int paused = 0;
+static Utterance paused_utterance = {NULL, 0, 0};
+static AudioData paused_audio = {NULL, 0, 0};
+static int playing = 0;                 /* in play_utterance(), audio_mutex held */
+static int paused_mark = -1;    /* piece whose mark was reported last, -1 = start */
+static void discard_paused(void);
+
+/* Incremental synthesis of text messages still being received */
+#define INCREMENTAL_POLL_MS 10
+static int incremental = 0;             /* sentences already queued to ECI */
+static size_t incremental_fed = 0;      /* bytes of the message parsed so far */
+static int incremental_speakable = 0;
+static int incremental_failed = 0;
+
+/* Level to return to when SSIP DEBUG OFF arrives, -1 while debug is off */
+static int debug_saved_level = -1;
+
+/* Start of synthesis for the current message, for the stage timings */
+static unsigned long long synth_start = 0;
+static volatile int first_audio_pending = 0;
+static int output_pending = 0;          /* no sample played locally yet */
+static unsigned long long stop_time = 0;
+
+/* Audio played by the module itself rather than sent to the server,
+ * with ViaVoiceAudioOutput set.  Like the 705 AUDIO path, everything
+ * here runs on the thread reading SSIP. */
+static int local_output = 0;
+static AudioOut *audio_out = NULL;
+static char audio_output_names[64];     /* backends to open, in order */
+static char audio_device[256];
+static char spd_output_method[64] = ""; /* AUDIO audio_output_method */
 
 /* ECI callback for receiving synthesized audio */
 static ECICallbackReturn eci_callback(ECIHand hECI, ECIMessage msg, long param, void *data)
@@ -84,180 +215,492 @@ static ECICallbackReturn eci_callback(ECIHand hECI, ECIMessage msg, long param,
         return eciDataNotProcessed;
     
     if (msg == eciWaveformBuffer) {
-        pthread_mutex_lock(&audio_mutex);
-        
-        int new_samples = param;
-        int new_size = audio_data.num_samples + new_samples;
-        
-        if (new_size > audio_data.allocated) {
-            int alloc_size = new_size + audio_buffer_size;
-            audio_data.samples = realloc(audio_data.samples, alloc_size * sizeof(short));
-            if (!audio_data.samples) {
-                pthread_mutex_unlock(&audio_mutex);
-                return eciDataNotProcessed;
-            }
-            audio_data.allocated = alloc_size;
+        TRACE_BEGIN("waveform");
+        if (first_audio_pending) {
+            first_audio_pending = 0;
+            stats_record(STAT_FIRST_AUDIO, synth_start);
         }
+        stats_count(STAT_CALLBACKS, 1);
+        stats_count(STAT_SAMPLES, param);
         
-        memcpy(audio_data.samples + audio_data.num_samples, 
-               audio_buffer, new_samples * sizeof(short));
-        audio_data.num_samples = new_size;
+        AudioStages stages = {
+            dsp_active ? &dsp_chain : NULL,
+            stretch_active ? wsola : NULL,
+            trim_active ? &trim : NULL,
+        };
         
+        pthread_mutex_lock(&audio_mutex);
+        int appended = audiobuf_append(&audio_data, audio_buffer, param, &stages,
+                                       audio_buffer_size);
+        pthread_mutex_unlock(&audio_mutex);
+        TRACE_END("waveform");
+        if (appended < 0)
+            return eciDataNotProcessed;
+    } else if (msg == eciIndexReply) {
+        TRACE_INSTANT("index");
+        pthread_mutex_lock(&audio_mutex);
+        if (render_marks) {
+            if (param >= 1 && param <= render_count)
+                render_marks[param - 1] = audio_data.num_samples;
+        } else if (param >= 1 && param <= utterance.count)
+            utterance.pieces[param - 1].sample = audio_data.num_samples;
         pthread_mutex_unlock(&audio_mutex);
     }
     
     return eciDataProcessed;
 }
 
+static int profile_index(SPDMessageType msgtype)
+{
+    switch (msgtype) {
+        case SPD_MSGTYPE_SOUND_ICON: return PROFILE_SOUND_ICON;
+        case SPD_MSGTYPE_CHAR:       return PROFILE_CHAR;
+        case SPD_MSGTYPE_KEY:        return PROFILE_KEY;
+        default:                     return PROFILE_TEXT;
+    }
+}
+
+/* Engine slot holding preset voice v */
+static int voice_slot(int v)
+{
+    return v == 0 ? VOICE_PRESET0 : v;
+}
+
 int module_config(const char *configfile)
 {
-    DBG("loading config: %s", configfile ? configfile : "(none)");
+    if (log_open("sd_viavoice") != 0)
+        fprintf(stderr, "sd_viavoice: logging thread failed, logging synchronously\n");
+    INFO("loading config: %s", configfile ? configfile : "(none)");
     
+    config = default_settings;
     if (!configfile) return 0;
     
-    FILE *f = fopen(configfile, "r");
-    if (!f) {
-        DBG("Could not open config file: %s", strerror(errno));
+    snprintf(config_file, sizeof(config_file), "%s", configfile);
+    if (config_parse(configfile, &config) != 0) {
+        WARN("Could not open config file: %s", strerror(errno));
         return 0;  /* Not fatal - use defaults */
     }
-    DBG("Config file opened successfully");
-    
-    char line[256];
-    while (fgets(line, sizeof(line), f)) {
-        /* Skip comments and empty lines */
-        char *p = line;
-        while (*p == ' ' || *p == '\t') p++;
-        if (*p == '#' || *p == '\n' || *p == '\0') continue;
+    if (config.log_level >= 0)
+        log_level = config.log_level;
+    return 0;
+}
+
+typedef struct {
+    AudioData audio;
+    short *buffer;
+} Calibration;
+
+static ECICallbackReturn calib_callback(ECIHand hECI, ECIMessage msg, long param, void *data)
+{
+    (void)hECI;
+    Calibration *c = data;
+    AudioStages none = { NULL, NULL, NULL };
+
+    if (msg == eciWaveformBuffer &&
+        audiobuf_append(&c->audio, c->buffer, param, &none, audio_buffer_size) < 0)
+        return eciDataNotProcessed;
+    return eciDataProcessed;
+}
+
+/* Synthesize the calibration sentence with level i's voice and return
+ * its loudness in dBFS, or -100 if that failed */
+static double measure_level(ECIHand h, EngineParams *p, Calibration *c,
+                            const Settings *s, int i)
+{
+    engparams_set(p, eciSampleRate, s->sample_rate);
+    engparams_commit(p, h);
+    if (eciCopyVoice(h, voice_slot(i == LEVEL_CONFIGURED ? s->voice : i), 0))
+        engparams_voice_copied(p, h);
+    if (i == LEVEL_CONFIGURED)
+        config_voice_params(s, p);
+    engparams_voice(p, eciSpeed, CALIBRATION_SPEED);
+    engparams_voice(p, eciPitchBaseline, CALIBRATION_PITCH);
+    engparams_voice(p, eciVolume, CALIBRATION_VOLUME);
+    engparams_commit(p, h);
+
+    c->audio.num_samples = 0;
+    if (!eciAddText(h, CALIBRATION_TEXT) || !eciSynthesize(h) || !eciSynchronize(h))
+        return -100.0;
+    return dsp_level_db(c->audio.samples, c->audio.num_samples,
+                        config_sample_rate_hz(s->sample_rate));
+}
+
+/* Calibration thread: measures the levels in calib_mask, the configured
+ * voice first, until module_close() */
+static void *calibrator(void *arg)
+{
+    (void)arg;
+    Calibration c = { { NULL, 0, 0 }, malloc(audio_buffer_size * sizeof(short)) };
+    ECIHand h = c.buffer ? eciNew() : NULL_ECI_HAND;
+    EngineParams p;
+
+    if (h == NULL_ECI_HAND || !eciSetOutputBuffer(h, audio_buffer_size, c.buffer)) {
+        WARN("Failed to start the calibration engine, normalization disabled");
+        if (h != NULL_ECI_HAND)
+            eciDelete(h);
+        free(c.buffer);
+        return NULL;
+    }
+    eciRegisterCallback(h, calib_callback, &c);
+    eciCopyVoice(h, 0, VOICE_PRESET0);
+    engparams_init(&p, h);
+
+    pthread_mutex_lock(&calib_mutex);
+    while (!calib_quit) {
+        if (!calib_mask) {
+            pthread_cond_wait(&calib_cond, &calib_mutex);
+            continue;
+        }
+        int i = calib_mask & (1u << LEVEL_CONFIGURED) ? LEVEL_CONFIGURED :
+                __builtin_ctz(calib_mask);
+        Settings s = calib_settings;
+        calib_mask &= ~(1u << i);
+        pthread_mutex_unlock(&calib_mutex);
+
+        double level = measure_level(h, &p, &c, &s, i);
+        const char *name = i == LEVEL_CONFIGURED ? "configured" : voice_name_table[i];
+        if (level > -100.0) {
+            __atomic_store_n(&voice_level_cb[i], (int)lrint(level * 10.0), __ATOMIC_RELAXED);
+            INFO("Voice %s measured at %.1f dBFS", name, level);
+        } else {
+            WARN("Could not measure the loudness of voice %s", name);
+        }
+        pthread_mutex_lock(&calib_mutex);
+    }
+    pthread_mutex_unlock(&calib_mutex);
+
+    eciDelete(h);
+    free(c.buffer);
+    free(c.audio.samples);
+    return NULL;
+}
+
+/* Have the levels in mask measured, with s's configured voice */
+static void calibrate(const Settings *s, unsigned int mask)
+{
+    pthread_mutex_lock(&calib_mutex);
+    calib_settings = *s;
+    calib_mask |= mask;
+    pthread_cond_signal(&calib_cond);
+    pthread_mutex_unlock(&calib_mutex);
+
+    if (!calib_running) {
+        if (pthread_create(&calib_thread, NULL, calibrator, NULL) == 0)
+            calib_running = 1;
+        else
+            WARN("Failed to start calibration thread, normalization disabled");
+    }
+}
+
+/* Loudness correction for the voice in engine slot voice, 1 until it
+ * has been measured */
+static float voice_gain(int voice)
+{
+    int i = voice == VOICE_CONFIGURED ? LEVEL_CONFIGURED :
+            voice == VOICE_PRESET0 ? 0 : voice;
+    int cb = __atomic_load_n(&voice_level_cb[i], __ATOMIC_RELAXED);
+    if (cb == 0)
+        return 1.0f;
+
+    double correction = config.loudness_target - cb / 10.0;
+    if (correction > 12.0) correction = 12.0;
+    if (correction < -12.0) correction = -12.0;
+    return (float)pow(10.0, correction / 20.0);
+}
+
+/* Leave dict for dict_swap(), replacing one it has not picked up yet */
+static void dict_publish(ECIDictHand dict)
+{
+    ECIDictHand stale = __atomic_exchange_n(&dict_pending, dict, __ATOMIC_ACQ_REL);
+    if (stale != NULL_DICT_HAND)
+        eciDeleteDict(eciHandle, stale);
+}
+
+/* Leave rw for rewrite_swap(), replacing rules it has not picked up yet */
+static void rewrite_publish(Rewriter *rw)
+{
+    rewrite_free(__atomic_exchange_n(&rewriter_pending, rw, __ATOMIC_ACQ_REL));
+}
+
+/* Between messages: switch to rules that finished compiling */
+static void rewrite_swap(void)
+{
+    Rewriter *rw = __atomic_exchange_n(&rewriter_pending, NULL, __ATOMIC_ACQUIRE);
+    if (!rw)
+        return;
+
+    int rules, states;
+    size_t bytes;
+    rewrite_size(rw, &rules, &states, &bytes);
+    rewrite_free(rewriter);
+    rewriter = rules > 0 ? rw : NULL;
+    if (!rewriter)
+        rewrite_free(rw);
+}
+
+/* Dictionary thread at startup, also compiling the rewrite rules; arg
+ * is a copy of the settings to free */
+static void *dict_loader(void *arg)
+{
+    const Settings *s = arg;
+
+    if (s->rewrite_rules[0] != '\0') {
+        Rewriter *rw = config_rewriter(s);
+        if (rw)
+            rewrite_publish(rw);
+    }
+    if (config_has_dictionaries(s)) {
+        ECIDictHand dict = config_dictionary(eciHandle, s);
+        if (dict != NULL_DICT_HAND)
+            dict_publish(dict);
+    }
+    free(arg);
+    return NULL;
+}
+
+/* Between utterances: activate dictionaries that finished loading */
+static void dict_swap(void)
+{
+    ECIDictHand dict = __atomic_exchange_n(&dict_pending, NULL_DICT_HAND, __ATOMIC_ACQUIRE);
+    if (dict == NULL_DICT_HAND)
+        return;
+
+    ECIDictError err = eciSetDict(eciHandle, dict);
+    if (err != DictNoError) {
+        WARN("Failed to activate dictionary (error %d)", err);
+        eciDeleteDict(eciHandle, dict);
+        return;
+    }
+    if (dictHandle != NULL_DICT_HAND)
+        eciDeleteDict(eciHandle, dictHandle);
+    dictHandle = dict;
+    spell_epoch++;
+    INFO("Dictionary activated");
+}
+
+/* Map spd_rate to an engine speed, with time compression on top of the
+ * engine's fastest speed when the compressor is available */
+static void map_rate(void)
+{
+    if (!wsola) {
+        current_rate = ((spd_rate + 100) * 250) / 200;
+        current_stretch = 1.0;
+    } else if (spd_rate <= 50) {
+        /* -100..+50 drives the engine over its full range... */
+        current_rate = ((spd_rate + 100) * 250) / 150;
+        current_stretch = 1.0;
+    } else {
+        /* ...and +50..+100 time-compresses its fastest output */
+        current_rate = 250;
+        current_stretch = 1.0 + (config.max_stretch - 1.0) * (spd_rate - 50) / 50.0;
+    }
+}
+
+/* Push s to the engine and the audio stages.  old is what is in effect,
+ * NULL at init; on a reload only what changed is applied again, so the
+ * compressor, the DSP state and the voice's loudness measurement survive
+ * unrelated edits.  Runs between utterances. */
+static void apply_settings(const Settings *old, const Settings *s)
+{
+#define CHANGED(field) (!old || old->field != s->field)
+    int old_rate = eci_sample_rate;
+
+    if (CHANGED(sample_rate)) {
+        engparams_set(&eci_params, eciSampleRate, s->sample_rate);
+        engparams_commit(&eci_params, eciHandle);
         
-        /* Parse key-value pairs */
-        char key[64], value[64];
-        if (sscanf(p, "%63s %63s", key, value) == 2) {
-            DBG("Config line: key='%s' value='%s'", key, value);
-            if (strcasecmp(key, "ViaVoiceSampleRate") == 0) {
-                int v = atoi(value);
-                if (v >= 0 && v <= 2) {
-                    config_sample_rate = v;
-                    DBG("Config: sample rate %d", v);
-                }
-            }
-            else if (strcasecmp(key, "ViaVoiceDefaultVoice") == 0) {
-                int v = atoi(value);
-                if (v >= 0 && v <= 7) {
-                    config_voice = v;
-                    DBG("Config: voice %d (%s)", config_voice, voice_name_table[config_voice]);
-                }
-            }
-            else if (strcasecmp(key, "ViaVoicePitchBaseline") == 0) {
-                int v = atoi(value);
-                if (v >= 0 && v <= 100) {
-                    config_pitch_baseline = v;
-                    DBG("Config: pitch baseline %d", v);
-                }
-            }
-            else if (strcasecmp(key, "ViaVoicePitchFluctuation") == 0) {
-                int v = atoi(value);
-                if (v >= 0 && v <= 100) {
-                    config_pitch_fluctuation = v;
-                    DBG("Config: pitch fluctuation %d", v);
-                }
-            }
-            else if (strcasecmp(key, "ViaVoiceSpeed") == 0) {
-                int v = atoi(value);
-                if (v >= 0 && v <= 250) {
-                    config_speed = v;
-                    DBG("Config: speed %d", v);
-                }
-            }
-            else if (strcasecmp(key, "ViaVoiceVolume") == 0) {
-                int v = atoi(value);
-                if (v >= 0 && v <= 100) {
-                    config_volume = v;
-                    DBG("Config: volume %d", v);
-                }
-            }
-            else if (strcasecmp(key, "ViaVoiceHeadSize") == 0) {
-                int v = atoi(value);
-                if (v >= 0 && v <= 100) {
-                    config_head_size = v;
-                    DBG("Config: head size %d", v);
-                }
-            }
-            else if (strcasecmp(key, "ViaVoiceRoughness") == 0) {
-                int v = atoi(value);
-                if (v >= 0 && v <= 100) {
-                    config_roughness = v;
-                    DBG("Config: roughness %d", v);
-                }
-            }
-            else if (strcasecmp(key, "ViaVoiceBreathiness") == 0) {
-                int v = atoi(value);
-                if (v >= 0 && v <= 100) {
-                    config_breathiness = v;
-                    DBG("Config: breathiness %d", v);
-                }
-            }
-            else if (strcasecmp(key, "ViaVoiceMainDict") == 0) {
-                strncpy(config_main_dict, value, sizeof(config_main_dict) - 1);
-                config_main_dict[sizeof(config_main_dict) - 1] = '\0';
-                DBG("Config: main dictionary %s", config_main_dict);
-            }
-            else if (strcasecmp(key, "ViaVoiceRootDict") == 0) {
-                strncpy(config_root_dict, value, sizeof(config_root_dict) - 1);
-                config_root_dict[sizeof(config_root_dict) - 1] = '\0';
-                DBG("Config: root dictionary %s", config_root_dict);
-            }
-            else if (strcasecmp(key, "ViaVoiceAbbrevDict") == 0) {
-                strncpy(config_abbrev_dict, value, sizeof(config_abbrev_dict) - 1);
-                config_abbrev_dict[sizeof(config_abbrev_dict) - 1] = '\0';
-                DBG("Config: abbreviation dictionary %s", config_abbrev_dict);
-            }
-            else if (strcasecmp(key, "ViaVoicePhrasePrediction") == 0) {
-                int v = atoi(value);
-                if (v >= 0 && v <= 1) {
-                    config_phrase_prediction = v;
-                    DBG("Config: phrase prediction %d", v);
-                }
-            }
-            else if (strcasecmp(key, "ViaVoiceDictionary") == 0) {
-                int v = atoi(value);
-                if (v >= 0 && v <= 1) {
-                    config_dictionary = v;
-                    DBG("Config: dictionary (abbreviations) %d", v);
-                }
-            }
-            else if (strcasecmp(key, "ViaVoiceNumberMode") == 0) {
-                int v = atoi(value);
-                if (v >= 0) {
-                    config_number_mode = v;
-                    DBG("Config: number mode %d", v);
-                }
-            }
-            else if (strcasecmp(key, "ViaVoiceTextMode") == 0) {
-                int v = atoi(value);
-                if (v >= 0) {
-                    config_text_mode = v;
-                    DBG("Config: text mode %d", v);
-                }
-            }
-            else if (strcasecmp(key, "ViaVoiceRealWorldUnits") == 0) {
-                int v = atoi(value);
-                if (v >= 0 && v <= 1) {
-                    config_real_world_units = v;
-                    DBG("Config: real world units %d", v);
-                }
-            }
+        /* The rate the engine took */
+        eci_sample_rate = config_sample_rate_hz(eci_params.have.param[eciSampleRate]);
+    }
+    int rate_changed = old && eci_sample_rate != old_rate;
+    if (rate_changed) {
+        pthread_mutex_lock(&audio_mutex);
+        discard_paused();
+        pthread_mutex_unlock(&audio_mutex);
+    }
+    
+    /* Time compressor for rates past the engine ceiling */
+    if (CHANGED(max_stretch) || rate_changed) {
+        wsola_free(wsola);
+        wsola = NULL;
+        if (s->max_stretch > 1.0) {
+            wsola = wsola_new(eci_sample_rate, s->max_stretch);
+            if (!wsola)
+                WARN("Failed to allocate time compressor, rate capped at engine maximum");
         }
+        if (old)
+            map_rate();
     }
-    fclose(f);
-    return 0;
+    
+    /* Apply custom voice parameters from config to the selected voice */
+    int voice_changed = CHANGED(voice) || CHANGED(pitch_baseline) ||
+        CHANGED(pitch_fluctuation) || CHANGED(speed) || CHANGED(volume) ||
+        CHANGED(head_size) || CHANGED(roughness) || CHANGED(breathiness);
+    if (voice_changed) {
+        /* Copy the configured preset to voice 0 (the active synthesis
+         * voice) and customize it there.  Preset 0 is voice 0 itself
+         * until it is first customized, so it is kept aside then. */
+        if (!old)
+            eciCopyVoice(eciHandle, 0, VOICE_PRESET0);
+        eciCopyVoice(eciHandle, voice_slot(s->voice), 0);
+        engparams_voice_copied(&eci_params, eciHandle);
+
+        config_voice_params(s, &eci_params);
+        engparams_commit(&eci_params, eciHandle);
+
+        eciCopyVoice(eciHandle, 0, VOICE_CONFIGURED);
+        active_voice = VOICE_CONFIGURED;
+    }
+    
+    /* Global ECI parameters; only the ones that changed reach the engine */
+    config_engine_params(s, &eci_params, &eci_defaults);
+    engparams_commit(&eci_params, eciHandle);
+    
+    /* Post-synthesis DSP.  begin_utterance() sets the normalization
+     * for each message's voice from the levels measured in the
+     * background; the presets are measured once, and the configured
+     * voice again whenever it changes. */
+    if (CHANGED(dsp_stages) || CHANGED(gain_db) || rate_changed) {
+        stretch_active = trim_active = dsp_active = 0;
+        dsp_chain_init(&dsp_chain, s->dsp_stages, eci_sample_rate, s->gain_db);
+        dsp_active = s->dsp_stages != 0;
+    }
+    if (voice_changed)
+        __atomic_store_n(&voice_level_cb[LEVEL_CONFIGURED], 0, __ATOMIC_RELAXED);
+    if (s->dsp_stages & DSP_STAGE_NORMALIZE) {
+        unsigned int unmeasured = 0;
+        for (int i = 0; i <= LEVEL_CONFIGURED; i++)
+            if (__atomic_load_n(&voice_level_cb[i], __ATOMIC_RELAXED) == 0)
+                unmeasured |= 1u << i;
+        if (unmeasured || rate_changed)
+            calibrate(s, rate_changed ? LEVELS_ALL : unmeasured);
+    }
+    
+    if (old && CHANGED(log_level) && s->log_level >= 0) {
+        if (debug_saved_level >= 0)
+            debug_saved_level = s->log_level;
+        else
+            log_level = s->log_level;
+    }
+    if (old && (strcmp(old->trace_path, s->trace_path) != 0 || CHANGED(trace_events)))
+        NOTICE("Trace settings take effect after a restart");
+    if (old && (strcmp(old->audio_output, s->audio_output) != 0 ||
+                strcmp(old->audio_device, s->audio_device) != 0))
+        NOTICE("Audio output settings take effect after a restart");
+#undef CHANGED
+}
+
+/* The files watched for reloading, in WATCH_* bit order */
+static void watch_paths(const Settings *s, const char *paths[WATCH_FILES])
+{
+    paths[0] = config_file;
+    paths[1] = s->main_dict;
+    paths[2] = s->root_dict;
+    paths[3] = s->abbrev_dict;
+    paths[4] = s->rewrite_rules;
+}
+
+/* Reload thread: re-read viavoice.conf, and rebuild the dictionaries and
+ * rewrite rules if their files or paths changed.  All of them wait for
+ * the synthesis thread to pick them up at the start of the next message. */
+static void reload_config(unsigned int changed)
+{
+    static Settings watched;    /* as last read by this thread */
+    static int watched_valid = 0;
+
+    if (!watched_valid) {
+        watched = config;       /* not yet replaced by any reload */
+        watched_valid = 1;
+    }
+
+    Settings *next = malloc(sizeof(Settings));
+    if (!next)
+        return;
+    *next = default_settings;
+    if (config_parse(config_file, next) != 0) {
+        WARN("Could not reload %s: %s", config_file, strerror(errno));
+        free(next);
+        return;
+    }
+    NOTICE("Reloaded %s", config_file);
+
+    int dicts = (changed & WATCH_DICTS) ||
+        strcmp(next->main_dict, watched.main_dict) != 0 ||
+        strcmp(next->root_dict, watched.root_dict) != 0 ||
+        strcmp(next->abbrev_dict, watched.abbrev_dict) != 0;
+    int rules = (changed & WATCH_RULES) ||
+        strcmp(next->rewrite_rules, watched.rewrite_rules) != 0;
+
+    /* The startup load would otherwise finish after this one */
+    if ((dicts || rules) && dict_loading) {
+        pthread_join(dict_thread, NULL);
+        dict_loading = 0;
+    }
+    if (rules) {
+        Rewriter *rw = config_rewriter(next);
+        if (rw)
+            rewrite_publish(rw);
+    }
+    if (dicts) {
+        ECIDictHand dict = config_dictionary(eciHandle, next);
+        if (dict != NULL_DICT_HAND)
+            dict_publish(dict);
+    }
+    if (dicts || rules) {
+        const char *paths[WATCH_FILES];
+        watch_paths(next, paths);
+        watch_set_paths(paths, WATCH_FILES);
+    }
+    watched = *next;
+
+    free(__atomic_exchange_n(&settings_pending, next, __ATOMIC_ACQ_REL));
+}
+
+/* Between utterances: switch to a reloaded viavoice.conf */
+static void settings_swap(void)
+{
+    Settings *next = __atomic_exchange_n(&settings_pending, NULL, __ATOMIC_ACQUIRE);
+    if (!next && !set_changed)
+        return;
+    if (next) {
+        file_config = *next;
+        free(next);
+    }
+
+    /* SET values stand in for the file's */
+    Settings s = file_config;
+    for (int i = 0; i < INT_SETTINGS; i++)
+        if (set_mask & (1u << i))
+            *(int *)((char *)&s + int_settings[i].offset) = set_value[i];
+    set_changed = 0;
+
+    apply_settings(&config, &s);
+    config = s;
+    spell_epoch++;
 }
 
 int module_init(char **msg)
 {
-    DBG("initializing ViaVoice TTS");
+    INFO("initializing ViaVoice TTS");
     
-    /* Tell server we'll send audio to it */
-    module_audio_set_server();
+    /* Before any other threads start, so they all leave SIGHUP to the
+     * reload thread and SIGUSR1 to the statistics thread */
+    if (config_file[0] != '\0' && watch_block_signal() != 0)
+        WARN("Failed to block SIGHUP, reload on SIGHUP disabled");
+    if (stats_watch_signal() != 0)
+        WARN("Failed to start statistics thread, SIGUSR1 dump disabled");
+    if (config.trace_path[0] != '\0') {
+        if (trace_open(config.trace_path, config.trace_events) != 0 ||
+            trace_watch_signal() != 0)
+            WARN("Failed to start tracing to %s", config.trace_path);
+        else
+            INFO("Tracing to %s, SIGUSR2 to write it out", config.trace_path);
+    }
+    
+    /* Tell server we'll send audio to it, unless we play it ourselves */
+    local_output = strcmp(config.audio_output, "server") != 0;
+    if (!local_output)
+        module_audio_set_server();
     
     /* Create ECI instance */
     eciHandle = eciNew();
@@ -287,109 +730,33 @@ int module_init(char **msg)
         return -1;
     }
     
-    /* Set sample rate from config (default 22050 Hz) */
-    eciSetParam(eciHandle, eciSampleRate, config_sample_rate);
-    
-    /* Read back the actual sample rate */
-    int rate_code = eciGetParam(eciHandle, eciSampleRate);
-    switch (rate_code) {
-        case 0: eci_sample_rate = 8000; break;
-        case 1: eci_sample_rate = 11025; break;
-        case 2: eci_sample_rate = 22050; break;
-        default: eci_sample_rate = 22050;
-    }
-    
-    DBG("initialized, sample rate %d Hz", eci_sample_rate);
+    engparams_init(&eci_params, eciHandle);
+    eci_defaults = eci_params.have;
+    file_config = config;
+    apply_settings(NULL, &config);
+    NOTICE("initialized, sample rate %d Hz", eci_sample_rate);
     
-    /* Apply custom voice parameters from config to the selected voice */
-    if (config_pitch_baseline >= 0)
-        eciSetVoiceParam(eciHandle, config_voice, eciPitchBaseline, config_pitch_baseline);
-    if (config_pitch_fluctuation >= 0)
-        eciSetVoiceParam(eciHandle, config_voice, eciPitchFluctuation, config_pitch_fluctuation);
-    if (config_speed >= 0)
-        eciSetVoiceParam(eciHandle, config_voice, eciSpeed, config_speed);
-    if (config_volume >= 0)
-        eciSetVoiceParam(eciHandle, config_voice, eciVolume, config_volume);
-    if (config_head_size >= 0)
-        eciSetVoiceParam(eciHandle, config_voice, eciHeadSize, config_head_size);
-    if (config_roughness >= 0)
-        eciSetVoiceParam(eciHandle, config_voice, eciRoughness, config_roughness);
-    if (config_breathiness >= 0)
-        eciSetVoiceParam(eciHandle, config_voice, eciBreathiness, config_breathiness);
-
-    /* Copy configured voice to voice 0 (the active synthesis voice) */
-    if (config_voice != 0)
-        eciCopyVoice(eciHandle, config_voice, 0);
-    
-    /* Apply global ECI parameters from config */
-    if (config_phrase_prediction >= 0) {
-        eciSetParam(eciHandle, eciPhrasePrediction, config_phrase_prediction);
-        DBG("Set phrase prediction: %d", config_phrase_prediction);
-    }
-    if (config_dictionary >= 0) {
-        /* ECI uses 0=enabled, 1=disabled; we invert for consistent config convention */
-        int eci_val = config_dictionary ? 0 : 1;
-        eciSetParam(eciHandle, eciDictionary, eci_val);
-        DBG("Set dictionary (abbreviations): config=%d eci=%d", config_dictionary, eci_val);
-    }
-    if (config_number_mode >= 0) {
-        eciSetParam(eciHandle, eciNumberMode, config_number_mode);
-        DBG("Set number mode: %d", config_number_mode);
-    }
-    if (config_text_mode >= 0) {
-        eciSetParam(eciHandle, eciTextMode, config_text_mode);
-        DBG("Set text mode: %d", config_text_mode);
-    }
-    if (config_real_world_units >= 0) {
-        eciSetParam(eciHandle, eciRealWorldUnits, config_real_world_units);
-        DBG("Set real world units: %d", config_real_world_units);
-    }
-    
-    /* Load dictionaries if specified */
-    if (config_main_dict[0] != '\0' || config_root_dict[0] != '\0' || config_abbrev_dict[0] != '\0') {
-        dictHandle = eciNewDict(eciHandle);
-        if (dictHandle != NULL_DICT_HAND) {
-            ECIDictError err;
-            
-            if (config_main_dict[0] != '\0') {
-                err = eciLoadDict(eciHandle, dictHandle, eciMainDict, config_main_dict);
-                if (err == DictNoError) {
-                    DBG("Loaded main dictionary: %s", config_main_dict);
-                } else {
-                    DBG("Failed to load main dictionary: %s (error %d)", config_main_dict, err);
-                }
-            }
-            
-            if (config_root_dict[0] != '\0') {
-                err = eciLoadDict(eciHandle, dictHandle, eciRootDict, config_root_dict);
-                if (err == DictNoError) {
-                    DBG("Loaded root dictionary: %s", config_root_dict);
-                } else {
-                    DBG("Failed to load root dictionary: %s (error %d)", config_root_dict, err);
-                }
-            }
-            
-            if (config_abbrev_dict[0] != '\0') {
-                err = eciLoadDict(eciHandle, dictHandle, eciAbbvDict, config_abbrev_dict);
-                if (err == DictNoError) {
-                    DBG("Loaded abbreviation dictionary: %s", config_abbrev_dict);
-                } else {
-                    DBG("Failed to load abbreviation dictionary: %s (error %d)", config_abbrev_dict, err);
-                }
-            }
-            
-            /* Activate the dictionary */
-            err = eciSetDict(eciHandle, dictHandle);
-            if (err == DictNoError) {
-                DBG("Dictionary activated");
-            } else {
-                DBG("Failed to activate dictionary (error %d)", err);
-            }
+    /* Load dictionaries and rewrite rules if specified */
+    if (config_has_dictionaries(&config) || config.rewrite_rules[0] != '\0') {
+        Settings *copy = malloc(sizeof(Settings));
+        if (copy)
+            *copy = config;
+        if (copy && pthread_create(&dict_thread, NULL, dict_loader, copy) == 0) {
+            dict_loading = 1;
         } else {
-            DBG("Failed to create dictionary handle");
+            free(copy);
+            WARN("Failed to start dictionary loader, dictionaries and rewrite rules disabled");
         }
     }
     
+    /* Reload viavoice.conf, dictionaries and rules when they change */
+    if (config_file[0] != '\0') {
+        const char *paths[WATCH_FILES];
+        watch_paths(&config, paths);
+        if (watch_start(paths, WATCH_FILES, reload_config) != 0)
+            WARN("Failed to watch %s, reloading disabled", config_file);
+    }
+    
     *msg = strdup("ViaVoice TTS initialized successfully");
     return 0;
 }
@@ -401,7 +768,7 @@ SPDVoice **module_list_voices(void)
 
     voices[0] = malloc(sizeof(SPDVoice));
     if (!voices[0]) { free(voices); return NULL; }
-    voices[0]->name = strdup(voice_name_table[config_voice]);
+    voices[0]->name = strdup(voice_name_table[config.voice]);
     voices[0]->language = strdup("en-US");
     voices[0]->variant = strdup("none");
     voices[1] = NULL;
@@ -417,11 +784,10 @@ int module_set(const char *var, const char *val)
         /* Voice is fixed from viavoice.conf; ignore runtime changes */
         return 0;
     } else if (!strcmp(var, "rate")) {
-        /* SPD rate: -100 to +100, ViaVoice: 0-250 */
-        int spd_rate = atoi(val);
-        current_rate = ((spd_rate + 100) * 250) / 200;
-        if (current_rate < 0) current_rate = 0;
-        if (current_rate > 250) current_rate = 250;
+        spd_rate = atoi(val);
+        if (spd_rate < -100) spd_rate = -100;
+        if (spd_rate > 100) spd_rate = 100;
+        map_rate();
         return 0;
     } else if (!strcmp(var, "pitch")) {
         /* SPD pitch: -100 to +100, ViaVoice: 0-100 */
@@ -437,309 +803,1042 @@ int module_set(const char *var, const char *val)
         if (current_volume < 0) current_volume = 0;
         if (current_volume > 100) current_volume = 100;
         return 0;
+    } else if (!strcmp(var, "spelling_mode")) {
+        if (strcmp(val, "on") && strcmp(val, "off"))
+            return -1;
+        spelling_mode = !strcmp(val, "on");
+        return 0;
+    } else if (!strcmp(var, "cap_let_recogn")) {
+        static const char *const modes[] = { "none", "spell", "icon" };
+        for (int i = 0; i < 3; i++)
+            if (!strcmp(val, modes[i])) {
+                cap_recogn = i;
+                return 0;
+            }
+        return -1;
+    } else if (!strncmp(var, "viavoice_", 9)) {
+        /* Engine and voice parameters, in effect from the next message;
+         * "default" goes back to viavoice.conf's value */
+        const IntSetting *is = config_int_setting(var, 1);
+        int i = is ? (int)(is - int_settings) : 0, v;
+        if (!is)
+            return -1;
+        if (!strcmp(val, "default")) {
+            set_mask &= ~(1u << i);
+        } else if (config_parse_int(is, val, &v)) {
+            set_value[i] = v;
+            set_mask |= 1u << i;
+        } else {
+            return -1;
+        }
+        set_changed = 1;
+        INFO("SET %s %s", is->what, val);
+        return 0;
+    } else if (!strcmp(var, "punctuation_mode")) {
+        static const char *const modes[PUNCT_MODES] = { "none", "some", "most", "all" };
+        for (int i = 0; i < PUNCT_MODES; i++)
+            if (!strcmp(val, modes[i])) {
+                punct_mode = i;
+                return 0;
+            }
+        return -1;
     }
     /* Accept all parameters - ignore ones we don't handle */
     return 0;
 }
 
+/* Only asked when playing locally.  speech-dispatcher's output method
+ * is followed with ViaVoiceAudioOutput auto; the rest is ignored. */
 int module_audio_set(const char *var, const char *val)
 {
-    (void)var;
-    (void)val;
-    /* We use server audio output */
+    if (!strcmp(var, "audio_output_method")) {
+        strncpy(spd_output_method, val, sizeof(spd_output_method) - 1);
+        spd_output_method[sizeof(spd_output_method) - 1] = '\0';
+    }
     return 0;
 }
 
+/* The backends of speech-dispatcher's output method that audioout has,
+ * or its defaults */
+static void auto_outputs(char *names, size_t size)
+{
+    static const char *const known[] = { "pipewire", "pulse", "alsa" };
+
+    names[0] = '\0';
+    for (const char *p = spd_output_method; *p; ) {
+        size_t len = strcspn(p, ",");
+        for (int i = 0; i < 3; i++)
+            if (strlen(known[i]) == len && !strncmp(known[i], p, len)) {
+                size_t used = strlen(names);
+                snprintf(names + used, size - used, "%s%s", used ? "," : "", known[i]);
+            }
+        p += len;
+        if (*p == ',')
+            p++;
+    }
+    if (names[0] == '\0')
+        snprintf(names, size, "%s", AUDIOOUT_DEFAULT);
+}
+
 int module_audio_init(char **status)
 {
-    *status = strdup("Using server audio");
-    return 0;
+    char msg[128];
+
+    if (!strcmp(config.audio_output, "auto"))
+        auto_outputs(audio_output_names, sizeof(audio_output_names));
+    else
+        snprintf(audio_output_names, sizeof(audio_output_names), "%s",
+                 config.audio_output);
+    snprintf(audio_device, sizeof(audio_device), "%s", config.audio_device);
+
+    audioout_close(audio_out);
+    audio_out = audioout_open(audio_output_names, audio_device, eci_sample_rate);
+    if (audio_out)
+        snprintf(msg, sizeof(msg), "Playing through %s", audioout_name(audio_out));
+    else
+        snprintf(msg, sizeof(msg), "No audio output would open (%s)",
+                 audio_output_names);
+
+    if (audio_out)
+        NOTICE("%s", msg);
+    else
+        ERR("%s", msg);
+    *status = strdup(msg);
+    return audio_out ? 0 : -1;
 }
 
 int module_loglevel_set(const char *var, const char *val)
 {
-    (void)var;
-    (void)val;
+    if (strcmp(var, "log_level") != 0)
+        return -1;
+
+    char *end;
+    long v = strtol(val, &end, 10);
+    if (end == val || *end != '\0' || v < 0 || v > LOG_LEVEL_DEBUG)
+        return -1;
+
+    /* While DEBUG is on the level stays at debug; this applies after */
+    if (debug_saved_level >= 0)
+        debug_saved_level = v;
+    else
+        log_level = v;
     return 0;
 }
 
 int module_debug(int enable, const char *file)
 {
-    (void)enable;
-    (void)file;
+    if (enable) {
+        if (log_set_file(file) != 0)
+            return -1;
+        if (debug_saved_level < 0)
+            debug_saved_level = log_level;
+        log_level = LOG_LEVEL_DEBUG;
+        INFO("debug log opened");
+    } else {
+        if (debug_saved_level >= 0)
+            log_level = debug_saved_level;
+        debug_saved_level = -1;
+        log_set_file(NULL);
+    }
     return 0;
 }
 
 int module_loop(void)
 {
-    DBG("entering main loop");
+    INFO("entering main loop");
     int ret = module_process(STDIN_FILENO, 1);
     if (ret != 0)
-        DBG("broken pipe, exiting");
+        NOTICE("broken pipe, exiting");
     return ret;
 }
 
-/* Decode XML entities in-place: &amp; &lt; &gt; &apos; &quot; */
-static void decode_xml_entities(char *text)
+static void utterance_clear(Utterance *u)
 {
-    static const struct { const char *entity; char ch; int len; } entities[] = {
-        { "&amp;",  '&',  5 },
-        { "&lt;",   '<',  4 },
-        { "&gt;",   '>',  4 },
-        { "&apos;", '\'', 6 },
-        { "&quot;", '"',  6 },
-    };
+    for (int i = 0; i < u->count; i++) {
+        free(u->pieces[i].text);
+        free(u->pieces[i].mark);
+    }
+    u->count = 0;
+}
+
+static int utterance_add(Utterance *u, char *text, char *mark)
+{
+    if (u->count == u->allocated) {
+        int alloc_size = u->allocated ? u->allocated * 2 : 8;
+        Piece *pieces = realloc(u->pieces, alloc_size * sizeof(Piece));
+        if (!pieces)
+            return -1;
+        u->pieces = pieces;
+        u->allocated = alloc_size;
+    }
+    u->pieces[u->count].text = text;
+    u->pieces[u->count].mark = mark;
+    u->pieces[u->count].sample = -1;
+    u->count++;
+    return 0;
+}
+
+/* Name of a <mark name="..."/> tag spanning len bytes, or NULL */
+static char *mark_name(const char *tag, size_t len)
+{
+    const char *end = tag + len;
+    const char *p = tag + 5;
+
+    while (p + 5 < end && strncmp(p, "name=", 5) != 0)
+        p++;
+    if (p + 5 >= end)
+        return NULL;
+    p += 5;
+
+    char quote = *p++;
+    if (quote != '"' && quote != '\'')
+        return NULL;
+    const char *close = memchr(p, quote, end - p);
+    if (!close)
+        return NULL;
+    return strndup(p, close - p);
+}
+
+/* Length of the first character of text, 0 if it is malformed or empty */
+static int char_length(const char *text)
+{
+    unsigned int cp;
+    if ((unsigned char)*text < 0x80)
+        return *text != '\0';
+    return utf8_decode((const unsigned char *)text, &cp);
+}
+
+/* Whether text is exactly one character */
+static int one_char(const char *text)
+{
+    int n = char_length(text);
+    return n > 0 && text[n] == '\0';
+}
+
+/* Strip, decode and (for reading) rewrite and sanitize one stretch of
+ * SSML */
+static char *normalize_text(const char *data, size_t len, SPDMessageType msgtype)
+{
+    char *text = strip_ssml(data, len);
+
+    /* Spelled messages are rendered character by character from the
+     * raw text, see spell_utterance() */
+    if (text && ((msgtype == SPD_MSGTYPE_TEXT && spelling_mode) ||
+                 (config.profile[profile_index(msgtype)].cache && one_char(text))))
+        return text;
+
+    /* Other CHAR text the engine cannot read is spoken by name; ASCII
+     * and KEY names are left for ViaVoice to announce */
+    if (text && msgtype == SPD_MSGTYPE_CHAR && (unsigned char)*text >= 0x80) {
+        const char *name = char_name(text);
+        char *spoken = name ? strdup(name) : sanitize_for_viavoice(text, PUNCT_ALL);
+        free(text);
+        return spoken;
+    }
 
-    char *src = text, *dst = text;
-    while (*src) {
-        if (*src == '&') {
-            int matched = 0;
-            for (int e = 0; e < 5; e++) {
-                if (strncmp(src, entities[e].entity, entities[e].len) == 0) {
-                    *dst++ = entities[e].ch;
-                    src += entities[e].len;
-                    matched = 1;
+    /* Only sanitize during normal reading */
+    if (text && (msgtype == SPD_MSGTYPE_TEXT || msgtype == SPD_MSGTYPE_SOUND_ICON)) {
+        /* Before sanitizing, so rules can match symbols it drops */
+        if (rewriter) {
+            unsigned long long start = stats_now();
+            int matches;
+            char *rewritten = rewrite_apply(rewriter, text, &matches);
+            stats_record(STAT_REWRITE, start);
+            stats_count(STAT_REWRITE_BYTES, strlen(text));
+            stats_count(STAT_REWRITES, matches);
+            free(text);
+            text = rewritten;
+            if (!text)
+                return NULL;
+        }
+        char *sanitized = sanitize_for_viavoice(text, punct_mode);
+        free(text);
+        text = sanitized;
+    }
+    return text;
+}
+
+/* Split a message at its <mark/> tags and append the normalized
+ * pieces to u.  Returns -1 on failure, else whether any of it is
+ * speakable. */
+static int utterance_parse(Utterance *u, const char *data, size_t bytes,
+                           SPDMessageType msgtype)
+{
+    const char *p = data, *end = data + bytes;
+    int speakable = 0;
+    unsigned long long start = stats_now();
+
+    if (u->count == 0)
+        rewrite_swap();
+    TRACE_BEGIN("normalize");
+    while (1) {
+        const char *tag = p, *tag_end = NULL;
+        char *mark = NULL;
+
+        /* Find the next <mark .../> */
+        while ((tag = memchr(tag, '<', end - tag)) != NULL) {
+            if (end - tag > 5 && !strncmp(tag, "<mark", 5) &&
+                (tag[5] == ' ' || tag[5] == '/')) {
+                tag_end = memchr(tag, '>', end - tag);
+                if (tag_end && (mark = mark_name(tag, tag_end - tag)) != NULL)
                     break;
-                }
             }
-            if (!matched)
-                *dst++ = *src++;
-        } else {
-            *dst++ = *src++;
+            tag++;
         }
+
+        char *text = normalize_text(p, (tag ? tag : end) - p, msgtype);
+        if (!text || utterance_add(u, text, mark) != 0) {
+            free(text);
+            free(mark);
+            TRACE_END("normalize");
+            return -1;
+        }
+        if (*text)
+            speakable = 1;
+
+        if (!tag)
+            break;
+        p = tag_end + 1;
+    }
+    stats_record(STAT_NORMALIZE, start);
+    TRACE_END("normalize");
+    return speakable;
+}
+
+/* Normalized text following piece 'from' (-1 = all), space-separated */
+static char *utterance_join(const Utterance *u, int from)
+{
+    size_t len = 1;
+    for (int i = from + 1; i < u->count; i++)
+        len += strlen(u->pieces[i].text) + 1;
+
+    char *joined = malloc(len);
+    if (!joined)
+        return NULL;
+
+    char *dst = joined;
+    for (int i = from + 1; i < u->count; i++) {
+        size_t n = strlen(u->pieces[i].text);
+        if (!n)
+            continue;
+        if (dst > joined)
+            *dst++ = ' ';
+        memcpy(dst, u->pieces[i].text, n);
+        dst += n;
     }
     *dst = '\0';
+    return joined;
 }
 
-/* Strip SSML/XML tags from text - ViaVoice doesn't understand SSML */
-static char *strip_ssml(const char *text, size_t len)
+static void discard_paused(void)
 {
-    char *result = malloc(len + 1);
-    if (!result) return NULL;
+    utterance_clear(&paused_utterance);
+    free(paused_audio.samples);
+    paused_audio.samples = NULL;
+    paused_audio.num_samples = 0;
+    paused_audio.allocated = 0;
+    paused_mark = -1;
+    paused = 0;
+}
+
+/* Whether the message just parsed is the rest of the paused one */
+static int resume_matches(void)
+{
+    char *rest = utterance_join(&paused_utterance, paused_mark);
+    char *text = utterance_join(&utterance, -1);
+    int match = rest && text && strcmp(rest, text) == 0;
+    free(rest);
+    free(text);
+    return match;
+}
 
-    size_t j = 0;
-    int in_tag = 0;
+/* The local device at the engine's rate, opened again after a reload
+ * changed the rate or a write failed */
+static AudioOut *local_device(void)
+{
+    if (audio_out && audioout_rate(audio_out) == eci_sample_rate)
+        return audio_out;
+    audioout_close(audio_out);
+    audio_out = audioout_open(audio_output_names, audio_device, eci_sample_rate);
+    if (!audio_out)
+        ERR("No audio output would open (%s)", audio_output_names);
+    return audio_out;
+}
 
-    for (size_t i = 0; i < len; i++) {
-        if (text[i] == '<') {
-            in_tag = 1;
-        } else if (text[i] == '>') {
-            in_tag = 0;
-        } else if (!in_tag) {
-            result[j++] = text[i];
+/* Write to the local device a period at a time, reading STOP and PAUSE
+ * between periods the way module_tts_output_server() does between
+ * chunks, so they are seen within a period even while the device is
+ * full */
+static void play_samples(const short *samples, int n)
+{
+    int period = eci_sample_rate * AUDIOOUT_PERIOD_MS / 1000;
+
+    for (int i = 0; i < n && !stop_requested && !pause_requested; i += period) {
+        AudioOut *out = local_device();
+        if (!out)
+            return;
+        if (audioout_write(out, samples + i, n - i < period ? n - i : period) != 0) {
+            audioout_close(out);
+            audio_out = NULL;
+            return;
+        }
+        if (output_pending) {
+            output_pending = 0;
+            stats_record(STAT_OUTPUT, synth_start);
         }
+        module_process(STDIN_FILENO, 0);
+    }
+}
+
+/* Let the local device play out what it holds, or drop it at once on
+ * STOP or PAUSE.  The wait is bounded in case the device stalls. */
+static void finish_output(void)
+{
+    if (!local_output || !audio_out)
+        return;
+
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    long left = audioout_delay(audio_out);
+    unsigned long long deadline = stats_now() + left + 1000000;
+    while (left > 0 && !stop_requested && !pause_requested && stats_now() < deadline) {
+        if (poll(&pfd, 1, left / 1000 + 1) > 0)
+            module_process(STDIN_FILENO, 0);
+        if (audio_out)
+            left = audioout_delay(audio_out);
+        else
+            left = 0;
+    }
+    if (audio_out && (stop_requested || pause_requested)) {
+        audioout_flush(audio_out);
+        if (stop_requested)
+            stats_record(STAT_FLUSH, stop_time);
+    }
+}
+
+static void send_samples(const AudioData *audio, int from, int to)
+{
+    if (to <= from)
+        return;
+    if (local_output) {
+        play_samples(audio->samples + from, to - from);
+        return;
     }
-    result[j] = '\0';
 
-    /* Decode XML entities (e.g. &apos; -> ') */
-    decode_xml_entities(result);
+    AudioTrack track;
+    track.bits = 16;
+    track.num_channels = 1;
+    track.sample_rate = eci_sample_rate;
+    track.num_samples = to - from;
+    track.samples = audio->samples + from;
+    
+    module_tts_output_server(&track, SPD_AUDIO_LE);
+}
+
+/* Send audio from the mark of piece 'from' (-1 = start) to the server
+ * or the local device,
+ * reporting each mark as playback passes it.  Stops early on STOP or
+ * PAUSE and returns the piece whose mark was reported last.
+ * Caller holds audio_mutex. */
+static int play_utterance(const Utterance *u, const AudioData *audio, int from)
+{
+    int pos = 0, last = from;
+
+    if (from >= 0 && u->pieces[from].sample > 0)
+        pos = u->pieces[from].sample;
+    if (pos > audio->num_samples)
+        pos = audio->num_samples;
+
+    for (int i = from + 1; i < u->count; i++) {
+        const Piece *piece = &u->pieces[i];
+        if (!piece->mark)
+            continue;
 
-    /* Trim leading/trailing whitespace */
-    char *start = result;
-    while (*start && (*start == ' ' || *start == '\n' || *start == '\t')) start++;
+        int end = piece->sample;
+        if (end < 0 || end > audio->num_samples)
+            end = audio->num_samples;
+        if (end < pos)
+            end = pos;
 
-    j = strlen(result);
-    if (j == 0) return result;
-    char *end = result + j - 1;
-    while (end > start && (*end == ' ' || *end == '\n' || *end == '\t')) end--;
-    *(end + 1) = '\0';
+        send_samples(audio, pos, end);
+        if (stop_requested || pause_requested)
+            return last;
 
-    /* If we trimmed from the start, move the string */
-    if (start != result) {
-        memmove(result, start, strlen(start) + 1);
+        module_report_index_mark(piece->mark);
+        last = i;
+        pos = end;
     }
+    send_samples(audio, pos, audio->num_samples);
+    return last;
+}
 
-    return result;
+/* Report how playback ended, once the local device has.  Returns 1 if
+ * it was paused. */
+static int report_playback_end(const Utterance *u, int last)
+{
+    finish_output();
+    if (stop_requested) {
+        module_report_event_stop();
+        return 0;
+    }
+    if (pause_requested) {
+        /* Repeat the mark we paused after so the server knows where
+         * to resume from */
+        if (last >= 0)
+            module_report_index_mark(u->pieces[last].mark);
+        module_report_event_pause();
+        return 1;
+    }
+    module_report_event_end();
+    return 0;
 }
 
-/*
- * Sanitize text for ViaVoice (plain text mode).  Returns a new
- * malloc'd string (caller frees).  Clause-break characters become
- * commas attached to the preceding word so ViaVoice uses natural
- * inflection instead of reading punctuation aloud.
- */
-static char *sanitize_for_viavoice(const char *text)
-{
-    size_t len = strlen(text);
-    /* Each clause-break char can expand to ", " (2 bytes) so worst
-     * case output is 2*len.  Generous but safe. */
-    char *out = malloc(len * 2 + 1);
-    if (!out) return NULL;
-
-    const unsigned char *src = (const unsigned char *)text;
-    char *dst = out;
-
-    while (*src) {
-        unsigned char c = *src;
-
-        if (c < 0x80) {
-            if ((c >= 'A' && c <= 'Z') ||
-                (c >= 'a' && c <= 'z') ||
-                (c >= '0' && c <= '9') ||
-                c == ' ' || c == '\t' || c == '\n' ||
-                c == '.' || c == ',' || c == '!' || c == '?' ||
-                c == '$' || c == '\'') {
-                /* Split letter↔digit boundaries so ViaVoice reads
-                 * "libtest1" as "libtest 1" instead of spelling it */
-                int is_alpha = (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
-                int is_digit = (c >= '0' && c <= '9');
-                if (dst > out && (is_alpha || is_digit)) {
-                    char prev = *(dst - 1);
-                    int prev_alpha = (prev >= 'A' && prev <= 'Z') || (prev >= 'a' && prev <= 'z');
-                    int prev_digit = (prev >= '0' && prev <= '9');
-                    if ((is_alpha && prev_digit) || (is_digit && prev_alpha))
-                        *dst++ = ' ';
-                }
-                *dst++ = c;
-                src++;
-                continue;
-            }
+/* Play the rest of a paused message from its retained audio */
+static void resume_paused(void)
+{
+    DBG("Resuming paused message from retained audio");
+    
+    module_speak_ok();
+    module_report_event_begin();
+    
+    pthread_mutex_lock(&audio_mutex);
+    TRACE_BEGIN("play");
+    playing = 1;
+    int last = play_utterance(&paused_utterance, &paused_audio, paused_mark);
+    playing = 0;
+    TRACE_END("play");
+    if (report_playback_end(&paused_utterance, last))
+        paused_mark = last;
+    else
+        discard_paused();
+    pthread_mutex_unlock(&audio_mutex);
+}
 
-            /* Clause-break punctuation → comma attached to preceding word */
-            if (c == ';' || c == ':' ||
-                c == '(' || c == ')' ||
-                c == '[' || c == ']' ||
-                c == '{' || c == '}') {
-                while (dst > out && (*(dst-1) == ' ' || *(dst-1) == '\t'))
-                    dst--;
-                /* Only insert comma if there's a preceding word to attach to */
-                if (dst > out)
-                    *dst++ = ',';
-                src++;
-                /* Skip trailing punctuation that would end up isolated (e.g. ").") */
-                while (*src == '.' || *src == ',' || *src == '!' ||
-                       *src == '?' || *src == ';' || *src == ':') src++;
-                while (*src == ' ' || *src == '\t') src++;
-                *dst++ = ' ';
-                continue;
+/* Reset the audio path and engine parameters for a new message */
+static void begin_utterance(SPDMessageType msgtype)
+{
+    settings_swap();
+    dict_swap();
+    stats_count(STAT_MESSAGES, 1);
+    synth_start = stats_now();
+    first_audio_pending = 1;
+    output_pending = 1;
+    
+    /* Reset audio buffer */
+    const Profile *profile = &config.profile[profile_index(msgtype)];
+
+    /* The profile's rate multiplier goes to the engine up to its 250
+     * ceiling, and to the time compressor past it */
+    double speed = current_rate * current_stretch * profile->rate;
+    double stretch = 1.0;
+    if (speed > 250.0) {
+        stretch = speed / 250.0;
+        speed = 250.0;
+        if (stretch > config.max_stretch)
+            stretch = config.max_stretch;
+    }
+    utterance_rate = (int)(speed + 0.5);
+
+    pthread_mutex_lock(&audio_mutex);
+    audio_data.num_samples = 0;
+    stretch_active = wsola && stretch > 1.0;
+    if (stretch_active)
+        wsola_reset(wsola, stretch);
+    trim_active = profile->trim_db != 0;
+    if (trim_active)
+        silence_reset(&trim, eci_sample_rate, profile->trim_db,
+                      config.trim_pad_ms, config.max_pause_ms);
+    pthread_mutex_unlock(&audio_mutex);
+    
+    /* The profile's voice, copied in only when it is not there already */
+    int voice = profile->voice >= 0 && profile->voice != config.voice ?
+        voice_slot(profile->voice) : VOICE_CONFIGURED;
+    if (voice != active_voice && eciCopyVoice(eciHandle, voice, 0)) {
+        active_voice = voice;
+        engparams_voice_copied(&eci_params, eciHandle);
+    }
+    if (config.dsp_stages & DSP_STAGE_NORMALIZE)
+        dsp_chain.normalize = voice_gain(active_voice);
+
+    /* Apply per-utterance overrides from speech-dispatcher; only the
+     * ones that changed since the last message reach the engine */
+    engparams_voice(&eci_params, eciSpeed, utterance_rate);
+    engparams_voice(&eci_params, eciPitchBaseline, current_pitch);
+    engparams_voice(&eci_params, eciVolume, current_volume);
+    engparams_commit(&eci_params, eciHandle);
+}
+
+/* Add pieces from 'first' on to ECI, with an index after each piece
+ * that ends in a mark */
+static int queue_pieces(int first)
+{
+    unsigned long long start = stats_now();
+
+    TRACE_BEGIN("add_text");
+    /* The batch before ended without one, and the text of this one was
+     * trimmed: keep the sentences apart */
+    if (first > 0 && first < utterance.count && !eciAddText(eciHandle, " ")) {
+        ERR("eciAddText failed");
+        TRACE_END("add_text");
+        return -1;
+    }
+    for (int i = first; i < utterance.count; i++) {
+        const Piece *piece = &utterance.pieces[i];
+        
+        if (*piece->text) {
+            DBG("Speaking: %s", piece->text);
+            if (!eciAddText(eciHandle, piece->text) ||
+                ((piece->mark || i + 1 < utterance.count) &&
+                 !eciAddText(eciHandle, " "))) {
+                ERR("eciAddText failed");
+                TRACE_END("add_text");
+                return -1;
             }
+        }
+        if (piece->mark)
+            eciInsertIndex(eciHandle, i + 1);
+    }
+    stats_record(STAT_ADD_TEXT, start);
+    TRACE_END("add_text");
+    return 0;
+}
 
-            *dst++ = ' ';
-            src++;
-            continue;
+/* Whether the parsed message is read from the character cache: every
+ * TEXT message in spelling mode, and messages of one character whose
+ * profile caches them */
+static int spelled(SPDMessageType msgtype, const Utterance *u)
+{
+    if (msgtype == SPD_MSGTYPE_TEXT && spelling_mode)
+        return 1;
+    return config.profile[profile_index(msgtype)].cache &&
+        u->count == 1 && one_char(u->pieces[0].text);
+}
+
+/* A character to spell: its cache key and its UTF-8 text */
+typedef struct {
+    unsigned int key;
+    const char *text;
+    int len;
+} SpellUnit;
+
+/* Cache key for the character cp, 0 for those spelled as a pause.
+ * Capitals are spelled as their small letter with a cue, so the engine
+ * does not add one of its own. */
+static unsigned int spell_key(unsigned int cp, int *cue)
+{
+    *cue = 0;
+    if (cp <= ' ' || cp == 0x200D || (cp >= 0xFE00 && cp <= 0xFE0F))
+        return 0;               /* whitespace, joiners, variation selectors */
+    if (cp >= 'A' && cp <= 'Z' && cap_recogn != CAP_NONE) {
+        *cue = cap_recogn == CAP_SPELL;
+        return (cp - 'A' + 'a') | (cap_recogn == CAP_PITCH ? SPELL_RAISED : 0);
+    }
+    return cp;
+}
+
+/* Render units with one engine pass, an index after each, and cache
+ * the audio between the indexes as their clips.  ASCII characters go
+ * in the engine's spell mode; names of other characters and the cue
+ * are read as text. */
+static int spell_render(const SpellUnit *units, int n, int spell_mode, int pitch)
+{
+    if (n == 0)
+        return 0;
+
+    int *marks = malloc(n * sizeof(int));
+    if (!marks)
+        return -1;
+    for (int i = 0; i < n; i++)
+        marks[i] = -1;
+
+    /* Clips are kept raw; the audio stages run as they are played */
+    pthread_mutex_lock(&audio_mutex);
+    int dsp = dsp_active, stretch = stretch_active, trimming = trim_active;
+    dsp_active = stretch_active = trim_active = 0;
+    audio_data.num_samples = 0;
+    render_marks = marks;
+    render_count = n;
+    pthread_mutex_unlock(&audio_mutex);
+
+    engparams_set(&eci_params, eciTextMode, spell_mode ? 2 : 0);  /* all spell */
+    engparams_voice(&eci_params, eciPitchBaseline, pitch);
+    engparams_commit(&eci_params, eciHandle);
+
+    int ok = 1;
+    for (int i = 0; i < n && ok; i++) {
+        char buf[8], *owned = NULL;
+        const char *text;
+        if (units[i].key == SPELL_CUE_CAP) {
+            text = "cap";
+        } else if (units[i].len == 1) {
+            buf[0] = units[i].text[0];
+            buf[1] = '\0';
+            text = buf;
+        } else {
+            memcpy(buf, units[i].text, units[i].len);
+            buf[units[i].len] = '\0';
+            text = char_name(buf);
+            if (!text)
+                text = owned = sanitize_for_viavoice(buf, PUNCT_ALL);
         }
+        ok = text && eciAddText(eciHandle, text) && eciAddText(eciHandle, " ") &&
+             eciInsertIndex(eciHandle, i + 1);
+        free(owned);
+    }
+    ok = ok && eciSynthesize(eciHandle) && eciSynchronize(eciHandle);
 
-        /* Multi-byte UTF-8 */
-        int seqlen;
-        if (c < 0xE0)      seqlen = 2;
-        else if (c < 0xF0)  seqlen = 3;
-        else                 seqlen = 4;
+    /* Set back when the next message begins, if the next pass does not
+     * want the same */
+    engparams_set(&eci_params, eciTextMode, config.text_mode >= 0 ?
+                  config.text_mode : eci_defaults.param[eciTextMode]);
+    engparams_voice(&eci_params, eciPitchBaseline, current_pitch);
 
-        int valid = 1;
-        for (int i = 1; i < seqlen; i++) {
-            if (!src[i]) { valid = 0; break; }
+    pthread_mutex_lock(&audio_mutex);
+    render_marks = NULL;
+    if (ok && !stop_requested) {
+        /* A unit whose index never came is left out, and so is the one
+         * after it, whose clip would start at that index: they are
+         * rendered again next time rather than cached as silence or
+         * with another's audio */
+        int start = 0;
+        for (int i = 0; i < n && ok; i++) {
+            if (start >= 0 && marks[i] >= start)
+                ok = spellcache_add(&spell_cache, units[i].key, audio_data.samples + start,
+                                    marks[i] - start, SPELL_QUIET) == 0;
+            start = marks[i];
         }
-        if (!valid) { src++; continue; }
-
-        /* Currency symbols → English word (ViaVoice is too old for UTF-8) */
-        if (seqlen == 2 && c == 0xC2) {
-            const char *word = NULL;
-            if (src[1] == 0xA3) word = "pound";   /* £ */
-            else if (src[1] == 0xA2) word = "cent";    /* ¢ */
-            else if (src[1] == 0xA5) word = "yen";     /* ¥ */
-            if (word) {
-                while (*word) *dst++ = *word++;
-                src += 2;
-                continue;
+    }
+    audio_data.num_samples = 0;
+    dsp_active = dsp;
+    stretch_active = stretch;
+    trim_active = trimming;
+    pthread_mutex_unlock(&audio_mutex);
+
+    free(marks);
+    stats_count(STAT_SPELL_RENDERS, n);
+    return ok ? 0 : -1;
+}
+
+/* Append n samples (silence if samples is NULL) to the message audio
+ * through the audio stages.  Caller holds audio_mutex. */
+static int spell_append(const short *samples, int n)
+{
+    AudioStages stages = {
+        dsp_active ? &dsp_chain : NULL,
+        stretch_active ? wsola : NULL,
+        trim_active ? &trim : NULL,
+    };
+
+    while (n > 0) {
+        int chunk = n < audio_buffer_size ? n : audio_buffer_size;
+        if (samples)
+            memcpy(audio_buffer, samples, chunk * sizeof(short));
+        else
+            memset(audio_buffer, 0, chunk * sizeof(short));
+        if (audiobuf_append(&audio_data, audio_buffer, chunk, &stages, audio_buffer_size) < 0)
+            return -1;
+        if (samples)
+            samples += chunk;
+        n -= chunk;
+    }
+    return 0;
+}
+
+/* Decode the character at *p and move past it.  A malformed byte is
+ * skipped as code point 0. */
+static unsigned int next_char(const char **p)
+{
+    unsigned int cp = (unsigned char)**p;
+    int n = char_length(*p);
+
+    if (n > 1)
+        utf8_decode((const unsigned char *)*p, &cp);
+    else if (n == 0)
+        cp = 0;
+    *p += n ? n : 1;
+    return cp;
+}
+
+/* Which spell_render() pass a unit needs: 0 spelled, 1 spelled with the
+ * pitch raised, 2 read as text */
+static int spell_pass(const SpellUnit *u)
+{
+    if (u->key == SPELL_CUE_CAP || (unsigned char)u->text[0] >= 0x80)
+        return 2;
+    return (u->key & SPELL_RAISED) ? 1 : 0;
+}
+
+/* Collect the distinct units of the message missing from the cache
+ * into missing; returns their number */
+static int spell_missing(SpellUnit *missing)
+{
+    int count = 0;
+
+    for (int i = 0; i < utterance.count; i++) {
+        for (const char *p = utterance.pieces[i].text; *p; ) {
+            const char *start = p;
+            int cue;
+            unsigned int key = spell_key(next_char(&p), &cue);
+            for (int k = 0; k <= cue; k++) {
+                SpellUnit u = { k ? SPELL_CUE_CAP : key, start, p - start };
+                const short *samples;
+                int j = 0;
+                if (!u.key || spellcache_find(&spell_cache, u.key, &samples) >= 0)
+                    continue;
+                while (j < count && missing[j].key != u.key)
+                    j++;
+                if (j == count)
+                    missing[count++] = u;
             }
         }
-        if (seqlen == 3 && c == 0xE2 && src[1] == 0x82 && src[2] == 0xAC) {
-            const char *word = "euro";  /* € */
-            while (*word) *dst++ = *word++;
-            src += 3;
-            continue;
-        }
+    }
+    return count;
+}
 
-        /* Em-dash / En-dash → comma attached to word */
-        if (seqlen == 3 && c == 0xE2 && src[1] == 0x80 &&
-            (src[2] == 0x94 || src[2] == 0x93)) {
-            while (dst > out && (*(dst-1) == ' ' || *(dst-1) == '\t'))
-                dst--;
-            if (dst > out)
-                *dst++ = ',';
-            src += 3;
-            /* Skip trailing punctuation that would end up isolated */
-            while (*src == '.' || *src == ',' || *src == '!' ||
-                   *src == '?' || *src == ';' || *src == ':') src++;
-            while (*src == ' ' || *src == '\t') src++;
-            *dst++ = ' ';
-            continue;
+/* Spell the message into audio_data from the character cache, after
+ * rendering the characters it lacks: at most three engine passes,
+ * however long the message.  Returns -1 on failure. */
+static int spell_utterance(void)
+{
+    if (memcmp(&eci_params.have, &spell_voice.engine, sizeof(EngineValues)) != 0 ||
+        spell_voice.epoch != spell_epoch) {
+        spellcache_clear(&spell_cache);
+        spell_voice.engine = eci_params.have;
+        spell_voice.epoch = spell_epoch;
+    }
+
+    /* Distinct characters missing from the cache, and the cue.  If they
+     * do not all fit, start over with an empty cache rather than drop
+     * clips rendered for this message in an earlier pass. */
+    size_t room = 2;
+    for (int i = 0; i < utterance.count; i++)
+        room += strlen(utterance.pieces[i].text);
+    SpellUnit *missing = malloc(2 * room * sizeof(SpellUnit));
+    if (!missing)
+        return -1;
+    int count = spell_missing(missing);
+    if (!spellcache_fits(&spell_cache, count) && spell_cache.used > 0) {
+        spellcache_clear(&spell_cache);
+        count = spell_missing(missing);
+    }
+
+    int raised = current_pitch + SPELL_CAP_PITCH > 100 ? 100 : current_pitch + SPELL_CAP_PITCH;
+    SpellUnit *batch = missing + room;
+    int ok = 1;
+    for (int pass = 0; pass < 3 && ok; pass++) {
+        int n = 0;
+        for (int j = 0; j < count; j++)
+            if (spell_pass(&missing[j]) == pass)
+                batch[n++] = missing[j];
+        ok = spell_render(batch, n, pass < 2, pass == 1 ? raised : current_pitch) == 0;
+    }
+    free(missing);
+    if (!ok || stop_requested)
+        return -1;
+
+    /* Letters with a gap between them, three gaps between words */
+    int gap = SPELL_GAP_MS * eci_sample_rate / 1000 * 100 / (utterance_rate + 50);
+    int pending_gap = 0, hits = 0;
+
+    pthread_mutex_lock(&audio_mutex);
+    for (int i = 0; i < utterance.count && ok; i++) {
+        Piece *piece = &utterance.pieces[i];
+        for (const char *p = piece->text; *p && ok; ) {
+            unsigned int cp = next_char(&p);
+            int cue;
+            unsigned int key = spell_key(cp, &cue);
+            if (!key) {
+                if (cp && audio_data.num_samples > 0)
+                    pending_gap = 3 * gap;
+                continue;
+            }
+
+            const short *samples, *cue_samples = NULL;
+            int n = spellcache_find(&spell_cache, key, &samples);
+            int cue_n = cue ? spellcache_find(&spell_cache, SPELL_CUE_CAP, &cue_samples) : 0;
+            if (n <= 0)
+                continue;       /* silent */
+            hits++;
+
+            if (audio_data.num_samples > 0 && !pending_gap)
+                pending_gap = gap;
+            ok = spell_append(NULL, pending_gap) == 0 &&
+                 (cue_n <= 0 || (spell_append(cue_samples, cue_n) == 0 &&
+                                 spell_append(NULL, gap / 2) == 0)) &&
+                 spell_append(samples, n) == 0;
+            pending_gap = 0;
         }
+        if (piece->mark)
+            piece->sample = audio_data.num_samples;
+    }
+    pthread_mutex_unlock(&audio_mutex);
+    stats_count(STAT_SPELL_HITS, hits);
+    return ok ? 0 : -1;
+}
+
+/* Called while a multi-line text message is still arriving: queue the
+ * complete sentences received so far and let the engine work on them
+ * until more input shows up */
+void module_speak_partial(int fd, const char *data, size_t bytes)
+{
+    if (!config.incremental || eciHandle == NULL_ECI_HAND || paused ||
+        incremental_failed || spelling_mode)
+        return;
+
+    size_t cut = sentence_end(data, incremental_fed, bytes);
+    if (cut == incremental_fed)
+        return;
+
+    if (!incremental) {
+        stop_requested = 0;
+        pause_requested = 0;
+        pthread_mutex_lock(&audio_mutex);
+        utterance_clear(&utterance);
+        pthread_mutex_unlock(&audio_mutex);
+        begin_utterance(SPD_MSGTYPE_TEXT);
+        incremental = 1;
+        incremental_speakable = 0;
+    }
 
-        *dst++ = ' ';
-        src += seqlen;
+    pthread_mutex_lock(&audio_mutex);
+    int first = utterance.count;
+    int ret = utterance_parse(&utterance, data + incremental_fed,
+                              cut - incremental_fed, SPD_MSGTYPE_TEXT);
+    pthread_mutex_unlock(&audio_mutex);
+    incremental_fed = cut;
+    if (ret < 0 || queue_pieces(first) != 0) {
+        /* Leave it to module_speak_sync to fail the message */
+        incremental_failed = 1;
+        return;
     }
-    *dst = '\0';
-    return out;
+    if (ret == 0)
+        return;
+    incremental_speakable = 1;
+
+    if (!eciSynthesize(eciHandle)) {
+        incremental_failed = 1;
+        return;
+    }
+
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    TRACE_BEGIN("speaking");
+    while (eciSpeaking(eciHandle) && poll(&pfd, 1, INCREMENTAL_POLL_MS) == 0)
+        ;
+    TRACE_END("speaking");
+}
+
+/* Called when a message module_speak_partial started is dropped before
+ * module_speak_sync: stop the engine and forget the message, so the next
+ * one is not taken for its continuation */
+void module_speak_abort(void)
+{
+    if (!incremental)
+        return;
+    if (eciHandle != NULL_ECI_HAND)
+        eciStop(eciHandle);
+    incremental = 0;
+    incremental_fed = 0;
+    incremental_failed = 0;
+    incremental_speakable = 0;
+    pthread_mutex_lock(&audio_mutex);
+    utterance_clear(&utterance);
+    pthread_mutex_unlock(&audio_mutex);
 }
 
 /* Synchronous speak - this is called by the module framework */
 void module_speak_sync(const char *data, size_t bytes, SPDMessageType msgtype)
 {
+    int continued = incremental, failed = incremental_failed, first = 0;
+    size_t fed = incremental_fed;
+    int ret;
+
+    incremental = 0;
+    incremental_fed = 0;
+    incremental_failed = 0;
+
     if (eciHandle == NULL_ECI_HAND) {
         module_speak_error();
         return;
     }
     
-    stop_requested = 0;
-    
-    /* Reset audio buffer */
-    pthread_mutex_lock(&audio_mutex);
-    audio_data.num_samples = 0;
-    pthread_mutex_unlock(&audio_mutex);
-    
-    /* Apply per-utterance overrides from speech-dispatcher */
-    eciSetVoiceParam(eciHandle, 0, eciSpeed, current_rate);
-    eciSetVoiceParam(eciHandle, 0, eciPitchBaseline, current_pitch);
-    eciSetVoiceParam(eciHandle, 0, eciVolume, current_volume);
-    
-    /* Strip SSML tags */
-    char *text = strip_ssml(data, bytes);
-    if (!text || !*text) {
-        free(text);
+    if (continued) {
+        /* The start of the message is already with the engine */
+        if (failed) {
+            eciStop(eciHandle);
+            module_speak_error();
+            return;
+        }
+        pthread_mutex_lock(&audio_mutex);
+        first = utterance.count;
+        ret = utterance_parse(&utterance, data + fed, bytes - fed, msgtype);
+        pthread_mutex_unlock(&audio_mutex);
+        if (ret == 0 && incremental_speakable)
+            ret = 1;
+    } else {
+        stop_requested = 0;
+        pause_requested = 0;
+        
+        /* Strip SSML tags, splitting at marks */
+        pthread_mutex_lock(&audio_mutex);
+        utterance_clear(&utterance);
+        ret = utterance_parse(&utterance, data, bytes, msgtype);
+        pthread_mutex_unlock(&audio_mutex);
+    }
+    if (ret <= 0) {
+        if (continued)
+            eciStop(eciHandle);
         module_speak_error();
         return;
     }
 
-    /* Only sanitize during normal reading — let ViaVoice announce
-     * the actual character for CHAR and KEY message types */
-    if (msgtype == SPD_MSGTYPE_TEXT || msgtype == SPD_MSGTYPE_SOUND_ICON) {
-        char *sanitized = sanitize_for_viavoice(text);
-        free(text);
-        text = sanitized;
-        if (!text || !*text) {
-            free(text);
-            module_speak_error();
-            return;
+    if (!continued) {
+        if (paused) {
+            if (resume_matches()) {
+                resume_paused();
+                return;
+            }
+            pthread_mutex_lock(&audio_mutex);
+            discard_paused();
+            pthread_mutex_unlock(&audio_mutex);
         }
+        begin_utterance(msgtype);
     }
 
-    DBG("Speaking: %s", text);
-
     /* Confirm we're ready */
     module_speak_ok();
     
-    /* Add text to ECI */
-    if (!eciAddText(eciHandle, text)) {
-        DBG("eciAddText failed");
-        free(text);
-        module_report_event_end();
-        return;
-    }
-    free(text);
-    
-    /* Report that synthesis is beginning */
-    module_report_event_begin();
-    
-    /* Synthesize */
-    if (!eciSynthesize(eciHandle)) {
-        DBG("eciSynthesize failed");
-        module_report_event_end();
-        return;
+    if (!continued && spelled(msgtype, &utterance)) {
+        module_report_event_begin();
+        TRACE_BEGIN("spell");
+        ret = spell_utterance();
+        TRACE_END("spell");
+        if (ret != 0 && !stop_requested) {
+            ERR("Spelling failed");
+            module_report_event_end();
+            return;
+        }
+    } else {
+        if (queue_pieces(first) != 0) {
+            module_report_event_end();
+            return;
+        }
+        
+        /* Report that synthesis is beginning */
+        module_report_event_begin();
+        
+        /* Synthesize */
+        if (!eciSynthesize(eciHandle)) {
+            ERR("eciSynthesize failed");
+            module_report_event_end();
+            return;
+        }
+        
+        /* Wait for synthesis to complete */
+        TRACE_BEGIN("synchronize");
+        eciSynchronize(eciHandle);
+        TRACE_END("synchronize");
     }
-    
-    /* Wait for synthesis to complete */
-    eciSynchronize(eciHandle);
+    first_audio_pending = 0;
+    stats_record(STAT_SYNTH, synth_start);
     
     if (stop_requested) {
         module_report_event_stop();
@@ -748,19 +1847,39 @@ void module_speak_sync(const char *data, size_t bytes, SPDMessageType msgtype)
     
     /* Send audio to speech-dispatcher server */
     pthread_mutex_lock(&audio_mutex);
-    if (audio_data.num_samples > 0) {
-        AudioTrack track;
-        track.bits = 16;
-        track.num_channels = 1;
-        track.sample_rate = eci_sample_rate;
-        track.num_samples = audio_data.num_samples;
-        track.samples = audio_data.samples;
-        
-        module_tts_output_server(&track, SPD_AUDIO_LE);
+    if (stretch_active &&
+        audiobuf_reserve(&audio_data, wsola_max_output(wsola, 0), audio_buffer_size)) {
+        short *dst = audio_data.samples + audio_data.num_samples;
+        int n = wsola_flush(wsola, dst);
+        if (trim_active)
+            n = silence_trim(&trim, dst, n);
+        audio_data.num_samples += n;
+    }
+    if (trim_active) {
+        audio_data.num_samples -= silence_finish(&trim);
+        DBG("Trimmed silence: %d ms leading, %d ms pauses, %d ms trailing",
+            trim.lead_dropped * 1000 / eci_sample_rate,
+            trim.pause_dropped * 1000 / eci_sample_rate,
+            trim.trail_dropped * 1000 / eci_sample_rate);
     }
-    pthread_mutex_unlock(&audio_mutex);
     
-    module_report_event_end();
+    TRACE_BEGIN("play");
+    playing = 1;
+    int last = play_utterance(&utterance, &audio_data, -1);
+    playing = 0;
+    TRACE_END("play");
+    if (report_playback_end(&utterance, last)) {
+        /* Keep the audio and text; the next message may be the rest */
+        Utterance u = paused_utterance;
+        AudioData a = paused_audio;
+        paused_utterance = utterance;
+        paused_audio = audio_data;
+        utterance = u;
+        audio_data = a;
+        paused_mark = last;
+        paused = 1;
+    }
+    pthread_mutex_unlock(&audio_mutex);
 }
 
 /* Asynchronous speak - we use synchronous mode */
@@ -773,20 +1892,33 @@ int module_speak(char *data, size_t bytes, SPDMessageType msgtype)
     return -1;
 }
 
+/* Audio is complete before it is sent, so pausing only has to stop
+ * sending; module_speak_sync keeps the rest for the resume */
 size_t module_pause(void)
 {
     DBG("pause requested");
-    stop_requested = 1;
-    if (eciHandle != NULL_ECI_HAND) {
-        eciStop(eciHandle);
-    }
+    stats_count(STAT_PAUSES, 1);
+    pause_requested = 1;
     return 0;
 }
 
 int module_stop(void)
 {
     DBG("stop requested");
+    stats_count(STAT_STOPS, 1);
+    stop_time = stats_now();
     stop_requested = 1;
+
+    /* A STOP read while audio plays locally comes from within
+     * play_utterance(), under audio_mutex; a resume drops the retained
+     * audio once that returns */
+    if (playing) {
+        paused = 0;
+    } else {
+        pthread_mutex_lock(&audio_mutex);
+        discard_paused();
+        pthread_mutex_unlock(&audio_mutex);
+    }
     if (eciHandle != NULL_ECI_HAND) {
         eciStop(eciHandle);
     }
@@ -795,13 +1927,36 @@ int module_stop(void)
 
 int module_close(void)
 {
-    DBG("closing");
+    INFO("closing");
+    stats_dump(stderr);
+    trace_close();
     
-    /* Free dictionary before deleting ECI handle */
-    if (dictHandle != NULL_DICT_HAND && eciHandle != NULL_ECI_HAND) {
-        eciDeleteDict(eciHandle, dictHandle);
-        dictHandle = NULL_DICT_HAND;
+    /* Free dictionaries before deleting ECI handle */
+    watch_stop();
+    free(settings_pending);
+    settings_pending = NULL;
+    if (dict_loading) {
+        pthread_join(dict_thread, NULL);
+        dict_loading = 0;
     }
+    if (calib_running) {
+        pthread_mutex_lock(&calib_mutex);
+        calib_quit = 1;
+        pthread_cond_signal(&calib_cond);
+        pthread_mutex_unlock(&calib_mutex);
+        pthread_join(calib_thread, NULL);
+        calib_running = 0;
+    }
+    if (eciHandle != NULL_ECI_HAND) {
+        if (dict_pending != NULL_DICT_HAND)
+            eciDeleteDict(eciHandle, dict_pending);
+        if (dictHandle != NULL_DICT_HAND)
+            eciDeleteDict(eciHandle, dictHandle);
+    }
+    dict_pending = dictHandle = NULL_DICT_HAND;
+    rewrite_free(rewriter_pending);
+    rewrite_free(rewriter);
+    rewriter_pending = rewriter = NULL;
     
     if (eciHandle != NULL_ECI_HAND) {
         eciDelete(eciHandle);
@@ -813,7 +1968,20 @@ int module_close(void)
         audio_buffer = NULL;
     }
     
+    wsola_free(wsola);
+    wsola = NULL;
+    spellcache_free(&spell_cache);
+    
+    audioout_close(audio_out);
+    audio_out = NULL;
+    
     pthread_mutex_lock(&audio_mutex);
+    discard_paused();
+    utterance_clear(&utterance);
+    free(utterance.pieces);
+    free(paused_utterance.pieces);
+    utterance.pieces = paused_utterance.pieces = NULL;
+    utterance.allocated = paused_utterance.allocated = 0;
     if (audio_data.samples) {
         free(audio_data.samples);
         audio_data.samples = NULL;
@@ -822,5 +1990,6 @@ int module_close(void)
     audio_data.allocated = 0;
     pthread_mutex_unlock(&audio_mutex);
     
+    log_close();
     return 0;
 }
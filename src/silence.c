@@ -0,0 +1,84 @@
+/*
+ * silence.c - Energy-based silence trimming
+ *
+ * Copyright (C) 2025
+ *
+ * ViaVoice pads every utterance with silence on both ends.  For key and
+ * character echo that padding is most of the time between the key press
+ * and audible speech, so it is cut here, 5 ms frame by frame, before the
+ * audio is handed to the server.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "silence.h"
+#include "dsp.h"
+
+void silence_reset(SilenceTrim *st, int sample_rate, int threshold_db,
+                   int pad_ms, int max_pause_ms)
+{
+    double amplitude = 32768.0 * pow(10.0, threshold_db / 20.0);
+
+    st->frame = sample_rate / 200;
+    st->threshold = amplitude * amplitude;
+    st->pad = sample_rate * pad_ms / 1000;
+    st->max_pause = sample_rate * max_pause_ms / 1000;
+    st->started = 0;
+    st->run = 0;
+    st->lead_dropped = 0;
+    st->pause_dropped = 0;
+    st->trail_dropped = 0;
+}
+
+int silence_trim(SilenceTrim *st, short *buf, int n)
+{
+    int w = 0;
+
+    for (int r = 0; r < n; ) {
+        int len = n - r < st->frame ? n - r : st->frame;
+        int silent = dsp_sum_squares(buf + r, len) < st->threshold * len;
+        int keep_from = r, keep = len;
+
+        if (!st->started) {
+            if (silent) {
+                st->lead_dropped += len;
+                r += len;
+                continue;
+            }
+            /* Keep a little of the silence we just dropped so soft
+             * onsets are not clipped.  Only the part still in this
+             * buffer can be recovered. */
+            int pre = r - w < st->pad ? r - w : st->pad;
+            keep_from -= pre;
+            keep += pre;
+            st->lead_dropped -= pre;
+            st->started = 1;
+            st->run = 0;
+        } else if (silent) {
+            if (st->max_pause && st->run + len > st->max_pause) {
+                keep = st->max_pause > st->run ? st->max_pause - st->run : 0;
+                st->pause_dropped += len - keep;
+            }
+            st->run += keep;
+        } else {
+            st->run = 0;
+        }
+
+        if (keep && keep_from != w)
+            memmove(buf + w, buf + keep_from, keep * sizeof(short));
+        w += keep;
+        r += len;
+    }
+    return w;
+}
+
+int silence_finish(SilenceTrim *st)
+{
+    int cut = st->run - st->pad;
+    if (!st->started || cut < 0)
+        cut = 0;
+    st->trail_dropped = cut;
+    st->run -= cut;
+    return cut;
+}
@@ -0,0 +1,37 @@
+/*
+ * silence.h - Energy-based silence trimming
+ *
+ * Copyright (C) 2025
+ */
+
+#ifndef _SILENCE_H
+#define _SILENCE_H
+
+typedef struct {
+    int frame;              /* analysis frame, samples */
+    double threshold;       /* mean square below which a frame is silent */
+    int pad;                /* silence kept next to speech, samples */
+    int max_pause;          /* cap on internal pauses, samples; 0 = no cap */
+
+    int started;            /* speech seen in this utterance */
+    int run;                /* samples of the current silent run kept so far */
+
+    int lead_dropped;       /* per-utterance statistics, samples */
+    int pause_dropped;
+    int trail_dropped;
+} SilenceTrim;
+
+/* Start a new utterance.  threshold_db is in dBFS (e.g. -50). */
+void silence_reset(SilenceTrim *st, int sample_rate, int threshold_db,
+                   int pad_ms, int max_pause_ms);
+
+/* Trim n samples in place and return how many remain.  Leading silence
+ * is dropped as it arrives and internal pauses are capped; trailing
+ * silence can only be known at the end, see silence_finish(). */
+int silence_trim(SilenceTrim *st, short *buf, int n);
+
+/* End of utterance: number of samples to cut from the end of what
+ * silence_trim() has produced so far. */
+int silence_finish(SilenceTrim *st);
+
+#endif /* _SILENCE_H */
@@ -61,6 +61,17 @@ int module_speak(char *data, size_t bytes, SPDMessageType msgtype);
 /* Synchronous Speak */
 void module_speak_sync(const char *data, size_t bytes, SPDMessageType msgtype);
 
+/* Optional: called while a multi-line TEXT message is still being received,
+ * with the (unescaped) lines read so far.  The module may start synthesizing
+ * what is complete; module_speak_sync is then called with the whole message
+ * as usual.  fd is the input, to be watched for the rest of the message.  */
+void module_speak_partial(int fd, const char *data, size_t bytes);
+
+/* Optional: called when a message module_speak_partial was given part of
+ * is dropped before module_speak_sync sees it (bad input, out of memory,
+ * EOF).  The module must stop what it started and forget the message.  */
+void module_speak_abort(void);
+
 /* Pause */
 size_t module_pause(void);
 
@@ -123,6 +134,9 @@ void module_tts_output_server(const AudioTrack *track, AudioFormat format);
  */
 char *module_readline(int fd, int block);
 
+/* Whether module_readline() has a whole line buffered already */
+int module_readline_ready(void);
+
 /* This protects multi-line answers against asynchronous event reporting */
 extern pthread_mutex_t module_stdout_mutex;
 
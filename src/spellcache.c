@@ -0,0 +1,90 @@
+/*
+ * spellcache.c - Prerendered audio of single characters
+ *
+ * Copyright (C) 2025
+ *
+ * Spelling and character echo say the same few dozen characters over
+ * and over.  Each is rendered once per voice setting and kept here, so
+ * a spelled word is assembled from memory instead of costing an engine
+ * round trip per letter.  Lookups are one hash into an open-addressed
+ * table of SPELL_SLOTS entries.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "spellcache.h"
+
+static unsigned int slot_of(unsigned int key)
+{
+    return (key * 0x9E3779B1u) >> 22;   /* top 10 bits: SPELL_SLOTS */
+}
+
+int spellcache_fits(const SpellCache *c, int keys)
+{
+    /* Keep the table at most 3/4 full so probes stay short */
+    return c->used + keys <= SPELL_SLOTS * 3 / 4 && c->pool_used < SPELL_MAX_SAMPLES;
+}
+
+int spellcache_find(const SpellCache *c, unsigned int key, const short **samples)
+{
+    for (unsigned int i = slot_of(key); c->slots[i].key; i = (i + 1) & (SPELL_SLOTS - 1))
+        if (c->slots[i].key == key) {
+            *samples = c->pool + c->slots[i].offset;
+            return c->slots[i].count;
+        }
+    return -1;
+}
+
+int spellcache_add(SpellCache *c, unsigned int key, const short *samples,
+                   int n, int quiet)
+{
+    while (n > 0 && abs(samples[0]) < quiet) {
+        samples++;
+        n--;
+    }
+    while (n > 0 && abs(samples[n - 1]) < quiet)
+        n--;
+
+    if (c->pool_used + n > c->pool_allocated) {
+        int size = c->pool_allocated ? c->pool_allocated : 65536;
+        while (size < c->pool_used + n)
+            size *= 2;
+        short *pool = realloc(c->pool, size * sizeof(short));
+        if (!pool)
+            return -1;
+        c->pool = pool;
+        c->pool_allocated = size;
+    }
+
+    unsigned int i = slot_of(key);
+    while (c->slots[i].key && c->slots[i].key != key)
+        i = (i + 1) & (SPELL_SLOTS - 1);
+    if (!c->slots[i].key) {
+        /* An empty slot must remain to end the probes */
+        if (c->used >= SPELL_SLOTS - 1)
+            return -1;
+        c->used++;
+    }
+    c->slots[i].key = key;
+    c->slots[i].offset = c->pool_used;
+    c->slots[i].count = n;
+    memcpy(c->pool + c->pool_used, samples, n * sizeof(short));
+    c->pool_used += n;
+    return 0;
+}
+
+void spellcache_clear(SpellCache *c)
+{
+    memset(c->slots, 0, sizeof(c->slots));
+    c->used = 0;
+    c->pool_used = 0;
+}
+
+void spellcache_free(SpellCache *c)
+{
+    free(c->pool);
+    c->pool = NULL;
+    c->pool_allocated = 0;
+    spellcache_clear(c);
+}
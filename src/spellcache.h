@@ -0,0 +1,51 @@
+/*
+ * spellcache.h - Prerendered audio of single characters
+ *
+ * Copyright (C) 2025
+ */
+
+#ifndef _SPELLCACHE_H
+#define _SPELLCACHE_H
+
+/* A key is a code point, with these flags for its variants */
+#define SPELL_RAISED   0x1000000u  /* rendered with the pitch raised */
+#define SPELL_CUE_CAP  0x2000000u  /* the spoken "cap" cue, no code point */
+
+#define SPELL_SLOTS    1024        /* power of two */
+#define SPELL_MAX_SAMPLES (1 << 21)
+
+typedef struct {
+    unsigned int key;           /* 0 = empty slot */
+    int offset;                 /* into the pool */
+    int count;
+} SpellClip;
+
+/* Clips live in one pool and are dropped all at once: when the voice
+ * changes, or before a message whose clips would not fit.  The clips of
+ * the message being spelled are never dropped. */
+typedef struct {
+    SpellClip slots[SPELL_SLOTS];
+    int used;
+    short *pool;
+    int pool_used;
+    int pool_allocated;
+} SpellCache;
+
+/* Whether keys more clips fit, keeping the table at most 3/4 full and
+ * the pool within SPELL_MAX_SAMPLES */
+int spellcache_fits(const SpellCache *c, int keys);
+
+/* Samples of key's clip and their number, or -1 if it is not cached */
+int spellcache_find(const SpellCache *c, unsigned int key, const short **samples);
+
+/* Store n samples as key's clip, without the leading and trailing
+ * samples quieter than quiet.  A clip can be empty.  Nothing is dropped
+ * to make room: the pool grows past SPELL_MAX_SAMPLES if it must.
+ * Returns 0, or -1 if out of memory or the table is full. */
+int spellcache_add(SpellCache *c, unsigned int key, const short *samples,
+                   int n, int quiet);
+
+void spellcache_clear(SpellCache *c);
+void spellcache_free(SpellCache *c);
+
+#endif /* _SPELLCACHE_H */
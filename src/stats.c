@@ -0,0 +1,173 @@
+/*
+ * stats.c - Per-stage latency histograms and counters
+ *
+ * Copyright (C) 2025
+ *
+ * Durations go into log-linear histograms: four buckets per power of two
+ * of microseconds, so every bucket is within 25% of its neighbours from
+ * 1 us up to an hour.  Recording takes a few relaxed atomic operations,
+ * cheap enough for the audio callback and safe from the engine's
+ * threads; a dump reads the buckets without stopping anyone.
+ */
+
+#include <stdio.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "stats.h"
+
+#define SUB_BITS 2
+#define SUB (1 << SUB_BITS)
+#define BUCKETS ((32 - SUB_BITS + 1) * SUB)
+
+typedef struct {
+    unsigned int buckets[BUCKETS];
+    unsigned long long sum;
+    unsigned int max;
+} Histogram;
+
+static Histogram hist[STAT_STAGES];
+static unsigned long long counters[STAT_COUNTERS];
+
+static const char *stage_names[STAT_STAGES] = {
+    "receive", "normalize", "rewrite", "add_text", "first_audio", "synth", "send",
+    "output", "flush",
+};
+
+static const char *counter_names[STAT_COUNTERS] = {
+    "messages", "callbacks", "samples", "send_bytes", "escapes", "rewrite_bytes",
+    "rewrites", "spell_hits", "spell_renders", "param_calls", "param_skipped",
+    "stops", "pauses", "audio_hits",
+};
+
+static int bucket_of(unsigned int v)
+{
+    if (v < SUB)
+        return v;
+    int msb = 31 - __builtin_clz(v);
+    return (msb - SUB_BITS + 1) * SUB + ((v >> (msb - SUB_BITS)) & (SUB - 1));
+}
+
+/* Largest value that lands in bucket b */
+static unsigned long long bucket_high(int b)
+{
+    if (b < SUB)
+        return b;
+    int msb = b / SUB + SUB_BITS - 1;
+    unsigned long long low = (unsigned long long)(SUB + b % SUB) << (msb - SUB_BITS);
+    return low + (1ULL << (msb - SUB_BITS)) - 1;
+}
+
+unsigned long long stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void stats_record(int stage, unsigned long long start)
+{
+    unsigned long long d = stats_now() - start;
+    unsigned int v = d > 0xffffffffULL ? 0xffffffffU : (unsigned int)d;
+    Histogram *h = &hist[stage];
+
+    __atomic_fetch_add(&h->buckets[bucket_of(v)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, v, __ATOMIC_RELAXED);
+
+    unsigned int max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (v > max &&
+           !__atomic_compare_exchange_n(&h->max, &max, v, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void stats_count(int counter, unsigned long n)
+{
+    __atomic_fetch_add(&counters[counter], n, __ATOMIC_RELAXED);
+}
+
+/* Upper bound of the bucket holding the p-th percentile */
+static unsigned long long percentile(const unsigned int *buckets,
+                                     unsigned long long count, int p)
+{
+    unsigned long long rank = (count * p + 99) / 100, seen = 0;
+
+    for (int b = 0; b < BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen >= rank)
+            return bucket_high(b);
+    }
+    return bucket_high(BUCKETS - 1);
+}
+
+void stats_dump(FILE *f)
+{
+    fprintf(f, "%-12s %10s %10s %10s %10s %10s %10s\n",
+            "stage (us)", "count", "mean", "p50", "p95", "p99", "max");
+
+    for (int s = 0; s < STAT_STAGES; s++) {
+        unsigned int buckets[BUCKETS];
+        for (int b = 0; b < BUCKETS; b++)
+            buckets[b] = __atomic_load_n(&hist[s].buckets[b], __ATOMIC_RELAXED);
+        unsigned long long count = 0;
+        for (int b = 0; b < BUCKETS; b++)
+            count += buckets[b];
+        unsigned long long sum = __atomic_load_n(&hist[s].sum, __ATOMIC_RELAXED);
+        unsigned long long max = __atomic_load_n(&hist[s].max, __ATOMIC_RELAXED);
+
+        if (!count) {
+            fprintf(f, "%-12s %10d\n", stage_names[s], 0);
+            continue;
+        }
+
+        unsigned long long p[3] = {
+            percentile(buckets, count, 50),
+            percentile(buckets, count, 95),
+            percentile(buckets, count, 99),
+        };
+        for (int i = 0; i < 3; i++)
+            if (p[i] > max)
+                p[i] = max;
+        fprintf(f, "%-12s %10llu %10llu %10llu %10llu %10llu %10llu\n",
+                stage_names[s], count, sum / count, p[0], p[1], p[2], max);
+    }
+
+    for (int c = 0; c < STAT_COUNTERS; c++)
+        fprintf(f, "%-12s %10llu\n", counter_names[c],
+                __atomic_load_n(&counters[c], __ATOMIC_RELAXED));
+    fflush(f);
+}
+
+static void *signal_thread(void *arg)
+{
+    sigset_t *set = arg;
+    int sig;
+
+    while (sigwait(set, &sig) == 0)
+        stats_dump(stderr);
+    return NULL;
+}
+
+int stats_watch_signal(void)
+{
+    static sigset_t set;
+    pthread_t thread;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0)
+        return -1;
+
+    /* With every signal blocked, so this thread is never picked for
+     * one another thread waits for, or that it would die of */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int ret = pthread_create(&thread, NULL, signal_thread, &set);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (ret != 0)
+        return -1;
+    pthread_detach(thread);
+    return 0;
+}
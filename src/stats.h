@@ -0,0 +1,61 @@
+/*
+ * stats.h - Per-stage latency histograms and counters
+ *
+ * Copyright (C) 2025
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdio.h>
+
+/* Timed stages of the speech pipeline */
+enum {
+    STAT_RECEIVE,       /* SPEAK line to final "." */
+    STAT_NORMALIZE,     /* SSML stripping and sanitizing */
+    STAT_REWRITE,       /* rewrite rules, part of normalize */
+    STAT_ADD_TEXT,      /* eciAddText() calls for a message */
+    STAT_FIRST_AUDIO,   /* synthesis start to first waveform callback */
+    STAT_SYNTH,         /* synthesis start to eciSynchronize() return */
+    STAT_SEND,          /* one 705 AUDIO chunk written and flushed */
+    STAT_OUTPUT,        /* synthesis start to the first sample played locally */
+    STAT_FLUSH,         /* STOP to the local device emptied */
+    STAT_STAGES
+};
+
+/* Event counters */
+enum {
+    STAT_MESSAGES,
+    STAT_CALLBACKS,     /* waveform callbacks */
+    STAT_SAMPLES,       /* samples received from the engine */
+    STAT_SEND_BYTES,    /* audio bytes sent, before escaping */
+    STAT_ESCAPES,       /* bytes that needed HDLC escaping */
+    STAT_REWRITE_BYTES, /* text bytes scanned by the rewrite rules */
+    STAT_REWRITES,      /* replacements made by them */
+    STAT_SPELL_HITS,    /* characters spelled from the cache */
+    STAT_SPELL_RENDERS, /* characters the engine rendered for it */
+    STAT_PARAM_CALLS,   /* engine parameters set */
+    STAT_PARAM_SKIPPED, /* ones set to what the engine already held */
+    STAT_STOPS,
+    STAT_PAUSES,
+    STAT_AUDIO_HITS,    /* vvserver messages from the audio cache */
+    STAT_COUNTERS
+};
+
+/* Monotonic clock in microseconds */
+unsigned long long stats_now(void);
+
+/* Record the time elapsed since start (from stats_now()) for a stage.
+ * Lock-free; safe from any thread. */
+void stats_record(int stage, unsigned long long start);
+
+void stats_count(int counter, unsigned long n);
+
+/* Write every stage and counter to f */
+void stats_dump(FILE *f);
+
+/* Dump to stderr whenever the process gets SIGUSR1.  Blocks the signal
+ * in the calling thread, so call this before creating other threads. */
+int stats_watch_signal(void);
+
+#endif /* _STATS_H */
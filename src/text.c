@@ -0,0 +1,342 @@
+/*
+ * text.c - Text clean-up before it reaches the engine
+ *
+ * Copyright (C) 2025
+ *
+ * ViaVoice predates both SSML and UTF-8: tags would be read aloud and
+ * multi-byte characters come out as noise.  These functions turn what
+ * speech-dispatcher sends into plain Latin text the engine handles well.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "text.h"
+#include "translit.h"       /* generated from data/translit.tsv */
+
+/* Decode XML entities in-place: &amp; &lt; &gt; &apos; &quot; */
+void decode_xml_entities(char *text)
+{
+    static const struct { const char *entity; char ch; int len; } entities[] = {
+        { "&amp;",  '&',  5 },
+        { "&lt;",   '<',  4 },
+        { "&gt;",   '>',  4 },
+        { "&apos;", '\'', 6 },
+        { "&quot;", '"',  6 },
+    };
+
+    char *src = text, *dst = text;
+    while (*src) {
+        if (*src == '&') {
+            int matched = 0;
+            for (int e = 0; e < 5; e++) {
+                if (strncmp(src, entities[e].entity, entities[e].len) == 0) {
+                    *dst++ = entities[e].ch;
+                    src += entities[e].len;
+                    matched = 1;
+                    break;
+                }
+            }
+            if (!matched)
+                *dst++ = *src++;
+        } else {
+            *dst++ = *src++;
+        }
+    }
+    *dst = '\0';
+}
+
+/* Strip SSML/XML tags from text - ViaVoice doesn't understand SSML */
+char *strip_ssml(const char *text, size_t len)
+{
+    char *result = malloc(len + 1);
+    if (!result) return NULL;
+
+    size_t j = 0;
+    int in_tag = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] == '<') {
+            in_tag = 1;
+        } else if (text[i] == '>') {
+            in_tag = 0;
+        } else if (!in_tag) {
+            result[j++] = text[i];
+        }
+    }
+    result[j] = '\0';
+
+    /* Decode XML entities (e.g. &apos; -> ') */
+    decode_xml_entities(result);
+
+    /* Trim leading/trailing whitespace */
+    char *start = result;
+    while (*start && (*start == ' ' || *start == '\n' || *start == '\t')) start++;
+
+    j = strlen(result);
+    if (j == 0) return result;
+    char *end = result + j - 1;
+    while (end > start && (*end == ' ' || *end == '\n' || *end == '\t')) end--;
+    *(end + 1) = '\0';
+
+    /* If we trimmed from the start, move the string */
+    if (start != result) {
+        memmove(result, start, strlen(start) + 1);
+    }
+
+    return result;
+}
+
+int utf8_decode(const unsigned char *s, unsigned int *cp)
+{
+    int len;
+    if (s[0] < 0xC2)      return 0;     /* continuation or overlong */
+    else if (s[0] < 0xE0) { len = 2; *cp = s[0] & 0x1F; }
+    else if (s[0] < 0xF0) { len = 3; *cp = s[0] & 0x0F; }
+    else if (s[0] < 0xF5) { len = 4; *cp = s[0] & 0x07; }
+    else                  return 0;
+
+    for (int i = 1; i < len; i++) {
+        if ((s[i] & 0xC0) != 0x80)
+            return 0;
+        *cp = (*cp << 6) | (s[i] & 0x3F);
+    }
+    if ((len == 3 && *cp < 0x800) || (len == 4 && (*cp < 0x10000 || *cp > 0x10FFFF)))
+        return 0;
+    return len;
+}
+
+/* Spelling of a code point, or " " if the table has none */
+static const char *translit_lookup(unsigned int cp)
+{
+    unsigned int off = cp < TRANSLIT_LIMIT ?
+        translit_block[translit_page[cp >> 8]][cp & 0xFF] : 0;
+    return off ? translit_pool + off : " ";
+}
+
+/* Replace every non-ASCII character with its spelling from
+ * data/translit.tsv, measuring first so the result is allocated once */
+char *transliterate(const char *text)
+{
+    const unsigned char *src;
+    size_t size = 0;
+
+    for (src = (const unsigned char *)text; *src; ) {
+        unsigned int cp;
+        int n;
+        if (*src < 0x80) {
+            size++;
+            src++;
+        } else if ((n = utf8_decode(src, &cp)) > 0) {
+            size += strlen(translit_lookup(cp));
+            src += n;
+        } else {
+            size++;             /* a space */
+            src++;
+        }
+    }
+
+    char *out = malloc(size + 1), *dst = out;
+    if (!out) return NULL;
+
+    for (src = (const unsigned char *)text; *src; ) {
+        unsigned int cp;
+        int n;
+        if (*src < 0x80) {
+            *dst++ = *src++;
+        } else if ((n = utf8_decode(src, &cp)) > 0) {
+            for (const char *t = translit_lookup(cp); *t; )
+                *dst++ = *t++;
+            src += n;
+        } else {
+            *dst++ = ' ';
+            src++;
+        }
+    }
+    *dst = '\0';
+    return out;
+}
+
+/* What the sanitizer does with each byte */
+enum {
+    ACT_SPACE,          /* replace with a space */
+    ACT_KEEP,
+    ACT_LETTER,         /* keep, splitting it from a digit */
+    ACT_DIGIT,          /* keep, splitting it from a letter */
+    ACT_CLAUSE,         /* comma attached to the preceding word */
+    ACT_WORD,           /* speak punct_word[c] */
+};
+
+/* Punctuation the modes treat alike.  Bytes 0x96 and 0x97 are the
+ * Windows-1252 en and em dash, which transliterate() produces. */
+#define PUNCT_COMMON \
+    ['A' ... 'Z'] = ACT_LETTER, ['a' ... 'z'] = ACT_LETTER, \
+    [0xC0 ... 0xFF] = ACT_LETTER, ['0' ... '9'] = ACT_DIGIT, \
+    [' '] = ACT_KEEP, ['\t'] = ACT_KEEP, ['\n'] = ACT_KEEP, ['$'] = ACT_KEEP
+#define PUNCT_SENTENCE(a) \
+    ['.'] = a, [','] = a, ['!'] = a, ['?'] = a, ['\''] = a
+#define PUNCT_CLAUSE(a) \
+    [';'] = a, [':'] = a, ['('] = a, [')'] = a, ['['] = a, [']'] = a, \
+    ['{'] = a, ['}'] = a, [0x96] = a, [0x97] = a
+#define PUNCT_SOME(a) \
+    ['#'] = a, ['%'] = a, ['&'] = a, ['*'] = a, ['+'] = a, ['/'] = a, \
+    ['<'] = a, ['='] = a, ['>'] = a, ['@'] = a, ['\\'] = a, ['^'] = a, \
+    ['_'] = a, ['|'] = a, ['~'] = a, ['`'] = a
+#define PUNCT_MOST(a) \
+    ['"'] = a, ['-'] = a
+
+/* One action per byte for each punctuation mode.  "some" speaks the
+ * symbols that carry meaning, "most" also brackets, quotes and dashes,
+ * "all" everything.  Sentence punctuation stays as it is up to "most"
+ * so the engine can pause and inflect. */
+static const unsigned char punct_action[PUNCT_MODES][256] = {
+    [PUNCT_NONE] = { PUNCT_COMMON, PUNCT_SENTENCE(ACT_KEEP), PUNCT_CLAUSE(ACT_CLAUSE) },
+    [PUNCT_SOME] = { PUNCT_COMMON, PUNCT_SENTENCE(ACT_KEEP), PUNCT_CLAUSE(ACT_CLAUSE),
+                     PUNCT_SOME(ACT_WORD) },
+    [PUNCT_MOST] = { PUNCT_COMMON, PUNCT_SENTENCE(ACT_KEEP), PUNCT_CLAUSE(ACT_WORD),
+                     PUNCT_SOME(ACT_WORD), PUNCT_MOST(ACT_WORD) },
+    [PUNCT_ALL]  = { PUNCT_COMMON, PUNCT_SENTENCE(ACT_WORD), PUNCT_CLAUSE(ACT_WORD),
+                     PUNCT_SOME(ACT_WORD), PUNCT_MOST(ACT_WORD) },
+};
+
+/* Words for ACT_WORD, indexed by the byte */
+#define PUNCT_WORD_MAX 16
+static const char punct_word[256][PUNCT_WORD_MAX] = {
+    ['!'] = "exclamation",  ['"'] = "quote",        ['#'] = "number",
+    ['%'] = "percent",      ['&'] = "and",          ['\''] = "apostrophe",
+    ['('] = "left paren",   [')'] = "right paren",  ['*'] = "star",
+    ['+'] = "plus",         [','] = "comma",        ['-'] = "dash",
+    ['.'] = "dot",          ['/'] = "slash",        [':'] = "colon",
+    [';'] = "semicolon",    ['<'] = "less than",    ['='] = "equals",
+    ['>'] = "greater than", ['?'] = "question",     ['@'] = "at",
+    ['['] = "left bracket", ['\\'] = "backslash",   [']'] = "right bracket",
+    ['^'] = "caret",        ['_'] = "underscore",   ['`'] = "backtick",
+    ['{'] = "left brace",   ['|'] = "bar",          ['}'] = "right brace",
+    ['~'] = "tilde",        [0x96] = "dash",        [0x97] = "dash",
+};
+
+/*
+ * Sanitize text for ViaVoice (plain text mode).  Returns a new
+ * malloc'd string (caller frees).  Non-ASCII characters are
+ * transliterated first, leaving ASCII and Latin-1 letters.  Each byte
+ * then takes its action from the mode's table: clause-break characters
+ * become commas attached to the preceding word so ViaVoice uses natural
+ * inflection instead of reading punctuation aloud, and symbols the mode
+ * speaks become words.
+ */
+char *sanitize_for_viavoice(const char *text, int mode)
+{
+    const unsigned char *act = punct_action[mode];
+    char *latin = NULL;
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++)
+        if (*p >= 0x80) {
+            latin = transliterate(text);
+            if (!latin) return NULL;
+            text = latin;
+            break;
+        }
+
+    /* Each clause-break char can expand to ", " (2 bytes) and each
+     * spoken one to its word and two spaces */
+    size_t len = 0, words = 0;
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++, len++)
+        words += act[*p] == ACT_WORD;
+    char *out = malloc(len * 2 + words * (PUNCT_WORD_MAX + 1) + 1);
+    if (!out) {
+        free(latin);
+        return NULL;
+    }
+
+    const unsigned char *src = (const unsigned char *)text;
+    char *dst = out;
+    int last = ACT_SPACE;
+
+    while (*src) {
+        unsigned char c = *src;
+        int a = act[c];
+
+        switch (a) {
+        case ACT_LETTER:
+        case ACT_DIGIT:
+            /* Split letter↔digit boundaries so ViaVoice reads
+             * "libtest1" as "libtest 1" instead of spelling it */
+            if ((last == ACT_LETTER || last == ACT_DIGIT) && last != a)
+                *dst++ = ' ';
+            /* fall through */
+        case ACT_KEEP:
+            *dst++ = c;
+            src++;
+            break;
+
+        case ACT_CLAUSE:
+            /* Clause-break punctuation → comma attached to preceding word */
+            while (dst > out && (*(dst-1) == ' ' || *(dst-1) == '\t'))
+                dst--;
+            /* Only insert comma if there's a preceding word to attach to */
+            if (dst > out)
+                *dst++ = ',';
+            src++;
+            /* Skip trailing punctuation that would end up isolated (e.g. ").") */
+            while (*src == '.' || *src == ',' || *src == '!' ||
+                   *src == '?' || *src == ';' || *src == ':') src++;
+            while (*src == ' ' || *src == '\t') src++;
+            *dst++ = ' ';
+            a = ACT_SPACE;
+            break;
+
+        case ACT_WORD:
+            *dst++ = ' ';
+            for (const char *w = punct_word[c]; *w; )
+                *dst++ = *w++;
+            *dst++ = ' ';
+            src++;
+            a = ACT_SPACE;
+            break;
+
+        default:
+            *dst++ = ' ';
+            src++;
+            break;
+        }
+        last = a;
+    }
+    *dst = '\0';
+    free(latin);
+    return out;
+}
+
+/* Where incremental synthesis and vvrender cut text; tags are skipped
+ * so a '.' in an attribute does not end a sentence */
+size_t sentence_end(const char *data, size_t from, size_t bytes)
+{
+    size_t cut = from;
+    int in_tag = 0;
+
+    for (size_t i = from; i < bytes; i++) {
+        char c = data[i];
+        if (c == '<') {
+            in_tag = 1;
+        } else if (c == '>') {
+            in_tag = 0;
+        } else if (!in_tag && (c == '.' || c == '!' || c == '?')) {
+            size_t j = i + 1;
+            while (j < bytes && (data[j] == '"' || data[j] == '\'' ||
+                                 data[j] == ')' || data[j] == ']'))
+                j++;
+            if (j < bytes && (data[j] == ' ' || data[j] == '\n' || data[j] == '\t'))
+                cut = j;
+        }
+    }
+    return cut;
+}
+
+size_t chunk_end(const char *text, size_t from, size_t len, size_t bytes)
+{
+    /* Widen the window until it holds a sentence end */
+    for (size_t window = bytes; from + window < len; window *= 2) {
+        size_t cut = sentence_end(text, from, from + window);
+        if (cut > from)
+            return cut;
+    }
+    return len;
+}
@@ -0,0 +1,49 @@
+/*
+ * text.h - Text clean-up before it reaches the engine
+ *
+ * Copyright (C) 2025
+ */
+
+#ifndef _TEXT_H
+#define _TEXT_H
+
+#include <stddef.h>
+
+/* Decode &amp; &lt; &gt; &apos; &quot; in place */
+void decode_xml_entities(char *text);
+
+/* Drop SSML tags, decode entities and trim surrounding whitespace.
+ * Returns a malloc'd string. */
+char *strip_ssml(const char *text, size_t len);
+
+/* End of the last complete sentence in data[from, bytes): the
+ * whitespace after a '.', '!' or '?' (and any closing quotes or
+ * brackets) outside a tag.  Returns from if there is none. */
+size_t sentence_end(const char *data, size_t from, size_t bytes);
+
+/* End of a chunk of text[from, len) for the engine to take in one go:
+ * the last sentence end within bytes of from, or within twice, four
+ * times... as many if a sentence is longer, or len */
+size_t chunk_end(const char *text, size_t from, size_t len, size_t bytes);
+
+/* Decode the UTF-8 sequence at s into *cp.  Returns its length, or 0
+ * if it is malformed. */
+int utf8_decode(const unsigned char *s, unsigned int *cp);
+
+/* Spell every non-ASCII character of UTF-8 text as data/translit.tsv
+ * lists it: accented letters stay Latin-1 or fold to ASCII, symbols
+ * become words, and characters it lacks become spaces.  Returns a
+ * malloc'd Latin-1 string. */
+char *transliterate(const char *text);
+
+/* Punctuation modes of SET punctuation_mode, from speaking no
+ * punctuation to speaking all of it */
+enum { PUNCT_NONE, PUNCT_SOME, PUNCT_MOST, PUNCT_ALL, PUNCT_MODES };
+
+/* Reduce text to what ViaVoice reads naturally in plain text mode:
+ * non-ASCII is transliterated, punctuation the mode speaks becomes
+ * words, clause breaks become commas and other symbols become spaces.
+ * Returns a malloc'd string. */
+char *sanitize_for_viavoice(const char *text, int mode);
+
+#endif /* _TEXT_H */
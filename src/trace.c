@@ -0,0 +1,159 @@
+/*
+ * trace.c - Opt-in timeline tracing in Chrome trace format
+ *
+ * Copyright (C) 2025
+ *
+ * Events go into a ring allocated up front.  A writer claims a slot with
+ * one atomic increment and stamps it with a sequence number last, so a
+ * flush running concurrently can skip slots that are half written or
+ * already reused instead of taking a lock on the hot path.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+typedef struct {
+    unsigned long long ts;      /* us, CLOCK_MONOTONIC */
+    const char *name;
+    int tid;
+    char phase;                 /* 'B', 'E' or 'i' */
+    unsigned int seq;           /* slot index + 1 once complete */
+} TraceEvent;
+
+int trace_enabled = 0;
+
+static TraceEvent *ring = NULL;
+static unsigned int ring_size = 0;
+static unsigned int head = 0;
+static char *trace_path = NULL;
+static pthread_mutex_t flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread int thread_id = 0;
+
+int trace_open(const char *path, int events)
+{
+    if (events < 1024)
+        events = 1024;
+    ring = calloc(events, sizeof(TraceEvent));
+    trace_path = strdup(path);
+    if (!ring || !trace_path) {
+        free(ring);
+        free(trace_path);
+        ring = NULL;
+        trace_path = NULL;
+        return -1;
+    }
+    ring_size = events;
+    head = 0;
+    trace_enabled = 1;
+    return 0;
+}
+
+void trace_event(char phase, const char *name)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    if (!thread_id)
+        thread_id = syscall(SYS_gettid);
+
+    unsigned int idx = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    TraceEvent *ev = &ring[idx % ring_size];
+
+    __atomic_store_n(&ev->seq, 0, __ATOMIC_RELAXED);
+    ev->ts = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+    ev->name = name;
+    ev->tid = thread_id;
+    ev->phase = phase;
+    __atomic_store_n(&ev->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+int trace_flush(void)
+{
+    if (!ring)
+        return -1;
+
+    pthread_mutex_lock(&flush_mutex);
+
+    FILE *f = fopen(trace_path, "w");
+    if (!f) {
+        pthread_mutex_unlock(&flush_mutex);
+        return -1;
+    }
+
+    unsigned int end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    unsigned int start = end > ring_size ? end - ring_size : 0;
+    int pid = getpid(), first = 1;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (unsigned int idx = start; idx != end; idx++) {
+        const TraceEvent *ev = &ring[idx % ring_size];
+        if (__atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE) != idx + 1)
+            continue;
+
+        TraceEvent copy = *ev;
+        if (__atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE) != idx + 1)
+            continue;
+
+        fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":%d,\"tid\":%d%s}",
+                first ? "" : ",\n", copy.name, copy.phase, copy.ts, pid, copy.tid,
+                copy.phase == 'i' ? ",\"s\":\"t\"" : "");
+        first = 0;
+    }
+    fprintf(f, "\n]}\n");
+
+    int ret = fclose(f) == 0 ? 0 : -1;
+    pthread_mutex_unlock(&flush_mutex);
+    return ret;
+}
+
+static void *signal_thread(void *arg)
+{
+    sigset_t *set = arg;
+    int sig;
+
+    while (sigwait(set, &sig) == 0)
+        trace_flush();
+    return NULL;
+}
+
+int trace_watch_signal(void)
+{
+    static sigset_t set;
+    pthread_t thread;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR2);
+    if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0)
+        return -1;
+
+    /* With every signal blocked, so this thread is never picked for
+     * one another thread waits for, or that it would die of */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int ret = pthread_create(&thread, NULL, signal_thread, &set);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (ret != 0)
+        return -1;
+    pthread_detach(thread);
+    return 0;
+}
+
+/* The ring stays allocated: an engine thread may still be inside
+ * trace_event() */
+void trace_close(void)
+{
+    if (!ring)
+        return;
+    trace_flush();
+    trace_enabled = 0;
+}
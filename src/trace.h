@@ -0,0 +1,36 @@
+/*
+ * trace.h - Opt-in timeline tracing in Chrome trace format
+ *
+ * Copyright (C) 2025
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+extern int trace_enabled;
+
+/* Begin, end and instant events.  Names must be string literals: only
+ * the pointer is stored.  When tracing is off these cost one branch. */
+#define TRACE_BEGIN(name) do { if (trace_enabled) trace_event('B', name); } while (0)
+#define TRACE_END(name) do { if (trace_enabled) trace_event('E', name); } while (0)
+#define TRACE_INSTANT(name) do { if (trace_enabled) trace_event('i', name); } while (0)
+
+/* Start recording into a ring of the given number of events; older
+ * events are overwritten once it is full.  path is where
+ * trace_flush() writes. */
+int trace_open(const char *path, int events);
+
+void trace_event(char phase, const char *name);
+
+/* Write the events in the ring to the trace file as Chrome trace JSON
+ * (chrome://tracing, ui.perfetto.dev).  Recording continues. */
+int trace_flush(void);
+
+/* Flush whenever the process gets SIGUSR2.  Blocks the signal in the
+ * calling thread, so call this before creating other threads. */
+int trace_watch_signal(void);
+
+/* Flush and stop recording */
+void trace_close(void);
+
+#endif /* _TRACE_H */
@@ -0,0 +1,453 @@
+/*
+ * vvrender.c - Render text and SSML files to a WAV file
+ *
+ * Copyright (C) 2025
+ *
+ * Usage: vvrender [-c viavoice.conf] [-j workers] [-p none|some|most|all]
+ *                 [-s] -o <out.wav> <file>...
+ *
+ * Files are read as speech-dispatcher would send them: SSML if they
+ * start with a tag, and rewritten and sanitized as TEXT messages are,
+ * with the voice, parameters and dictionaries viavoice.conf sets.  "-"
+ * reads standard input.
+ *
+ * The text is cut into chunks at sentence ends and worker processes,
+ * each with its own engine, take the next chunk from a shared counter
+ * until none are left.  The chunks are then written out in order.  -s
+ * renders with 1 to -j workers in turn to measure how it scales; the
+ * last run writes the file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "eci_viavoice.h"
+#include "config.h"
+#include "engparams.h"
+#include "audiobuf.h"
+#include "audioout.h"
+#include "text.h"
+#include "log.h"
+
+/* Chunks end at the last sentence end within this many bytes, so each
+ * worker gets many and they finish close together */
+#define CHUNK_BYTES 1500
+
+#define BUFFER_SAMPLES 8192
+
+/* Where a rendered chunk's audio is, in the file of the worker that
+ * rendered it */
+typedef struct {
+    int worker;                 /* -1 = not rendered */
+    long offset;                /* in samples */
+    int samples;
+} ChunkAudio;
+
+/* Shared between the workers and the parent */
+typedef struct {
+    int next;                   /* next chunk to take */
+    ChunkAudio chunk[];
+} RenderQueue;
+
+typedef struct {
+    char **text;
+    int count;
+    int allocated;
+} Chunks;
+
+static const char *prog = "vvrender";
+static short engine_buffer[BUFFER_SAMPLES];
+static int out_of_memory;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *read_file(const char *path, size_t *len)
+{
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!f)
+        return NULL;
+
+    size_t size = 0, allocated = 65536;
+    char *data = malloc(allocated);
+    size_t n;
+    while (data && (n = fread(data + size, 1, allocated - size, f)) > 0) {
+        size += n;
+        if (size == allocated) {
+            char *grown = realloc(data, allocated * 2);
+            if (!grown)
+                free(data);
+            data = grown;
+            allocated *= 2;
+        }
+    }
+    if (data && ferror(f)) {
+        free(data);
+        data = NULL;
+    }
+    if (f != stdin)
+        fclose(f);
+    if (!data && errno == 0)
+        errno = ENOMEM;
+    *len = size;
+    return data;
+}
+
+static int chunks_add(Chunks *c, char *text)
+{
+    if (!text)
+        return -1;
+    if (c->count == c->allocated) {
+        int allocated = c->allocated ? c->allocated * 2 : 64;
+        char **grown = realloc(c->text, allocated * sizeof(char *));
+        if (!grown) {
+            free(text);
+            return -1;
+        }
+        c->text = grown;
+        c->allocated = allocated;
+    }
+    c->text[c->count++] = text;
+    return 0;
+}
+
+/* Cut text at sentence ends into chunks of about CHUNK_BYTES, and
+ * sanitize each for the engine */
+static int split_text(const char *text, int punct, Chunks *c)
+{
+    size_t len = strlen(text), pos = 0;
+
+    while (pos < len) {
+        while (pos < len && isspace((unsigned char)text[pos]))
+            pos++;
+        if (pos == len)
+            break;
+
+        size_t end = chunk_end(text, pos, len, CHUNK_BYTES);
+        char *chunk = strndup(text + pos, end - pos);
+        char *sanitized = chunk ? sanitize_for_viavoice(chunk, punct) : NULL;
+        free(chunk);
+        if (chunks_add(c, sanitized) != 0)
+            return -1;
+        pos = end;
+    }
+    return 0;
+}
+
+/* Read a file and add its chunks */
+static int load_input(const char *path, const Rewriter *rw, int punct, Chunks *c)
+{
+    size_t len;
+    errno = 0;
+    char *data = read_file(path, &len);
+    if (!data) {
+        fprintf(stderr, "%s: %s: %s\n", prog, path, strerror(errno));
+        return -1;
+    }
+
+    /* strip_ssml() drops tags and decodes entities, which plain text
+     * must keep as written */
+    size_t start = 0;
+    while (start < len && isspace((unsigned char)data[start]))
+        start++;
+    char *text = start < len && data[start] == '<' ? strip_ssml(data, len)
+                                                    : strndup(data, len);
+    free(data);
+
+    if (text && rw) {
+        int matches;
+        char *rewritten = rewrite_apply(rw, text, &matches);
+        free(text);
+        text = rewritten;
+    }
+    int ret = text ? split_text(text, punct, c) : -1;
+    free(text);
+    if (ret != 0)
+        fprintf(stderr, "%s: %s: %s\n", prog, path, strerror(ENOMEM));
+    return ret;
+}
+
+static ECICallbackReturn engine_callback(ECIHand h, ECIMessage msg, long param, void *data)
+{
+    (void)h;
+    static const AudioStages no_stages = { NULL, NULL, NULL };
+
+    if (msg == eciWaveformBuffer &&
+        audiobuf_append(data, engine_buffer, param, &no_stages, BUFFER_SAMPLES) < 0) {
+        out_of_memory = 1;
+        return eciDataNotProcessed;
+    }
+    return eciDataProcessed;
+}
+
+/* An engine set up as the module sets up its own from s */
+static ECIHand engine_open(const Settings *s, AudioData *audio)
+{
+    ECIHand h = eciNew();
+    if (h == NULL_ECI_HAND)
+        return NULL_ECI_HAND;
+
+    eciRegisterCallback(h, engine_callback, audio);
+    if (!eciSetOutputBuffer(h, BUFFER_SAMPLES, engine_buffer)) {
+        eciDelete(h);
+        return NULL_ECI_HAND;
+    }
+
+    EngineParams params;
+    config_engine(h, s, &params);
+    return h;
+}
+
+/* Body of a worker process: render chunks until none are left,
+ * appending their samples to out */
+static int worker_run(int id, const Settings *s, const Chunks *c,
+                      RenderQueue *queue, FILE *out)
+{
+    AudioData audio = { NULL, 0, 0 };
+    ECIHand h = engine_open(s, &audio);
+    if (h == NULL_ECI_HAND) {
+        fprintf(stderr, "%s: worker %d: cannot start the engine\n", prog, id);
+        return 1;
+    }
+
+    long offset = 0;
+    int i;
+    while ((i = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) < c->count) {
+        audio.num_samples = 0;
+        if (!eciAddText(h, c->text[i]) || !eciSynthesize(h) || !eciSynchronize(h) ||
+            out_of_memory) {
+            fprintf(stderr, "%s: worker %d: chunk %d failed\n", prog, id, i + 1);
+            return 1;
+        }
+        if (fwrite(audio.samples, sizeof(short), audio.num_samples, out)
+                != (size_t)audio.num_samples) {
+            fprintf(stderr, "%s: worker %d: %s\n", prog, id, strerror(errno));
+            return 1;
+        }
+        queue->chunk[i].offset = offset;
+        queue->chunk[i].samples = audio.num_samples;
+        queue->chunk[i].worker = id;
+        offset += audio.num_samples;
+    }
+
+    eciDelete(h);
+    free(audio.samples);
+    return fflush(out) == 0 ? 0 : 1;
+}
+
+/* 16-bit mono WAV: the header, then each chunk's samples in order */
+static int write_wav(const char *path, int rate, const RenderQueue *queue,
+                     int count, FILE **parts, long samples)
+{
+    FILE *f = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+    if (!f)
+        return -1;
+
+    unsigned char header[AUDIOOUT_WAV_HEADER];
+    audioout_wav_header(header, rate, samples * sizeof(short));
+    int ok = fwrite(header, 1, sizeof(header), f) == sizeof(header);
+
+    /* Samples are written in the host's byte order, little-endian on
+     * every machine ViaVoice runs on */
+    short buf[BUFFER_SAMPLES];
+    for (int i = 0; ok && i < count; i++) {
+        FILE *part = parts[queue->chunk[i].worker];
+        long left = queue->chunk[i].samples;
+        ok = fseek(part, queue->chunk[i].offset * (long)sizeof(short), SEEK_SET) == 0;
+        while (ok && left > 0) {
+            size_t n = left < BUFFER_SAMPLES ? (size_t)left : BUFFER_SAMPLES;
+            ok = fread(buf, sizeof(short), n, part) == n &&
+                 fwrite(buf, sizeof(short), n, f) == n;
+            left -= n;
+        }
+    }
+
+    if (f == stdout)
+        ok = fflush(f) == 0 && ok;
+    else
+        ok = fclose(f) == 0 && ok;
+    return ok ? 0 : -1;
+}
+
+/* Render every chunk with this many workers, writing out if set.
+ * Returns the wall time in seconds, or -1. */
+static double render(const Settings *s, const Chunks *c, int workers,
+                     const char *out, long *samples)
+{
+    size_t size = sizeof(RenderQueue) + c->count * sizeof(ChunkAudio);
+    RenderQueue *queue = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (queue == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", prog, strerror(errno));
+        return -1;
+    }
+    queue->next = 0;
+    for (int i = 0; i < c->count; i++)
+        queue->chunk[i].worker = -1;
+
+    FILE *parts[workers];
+    int started = 0, failed = 0;
+    double start = now();
+
+    fflush(NULL);
+    for (; started < workers; started++) {
+        parts[started] = tmpfile();
+        if (!parts[started]) {
+            fprintf(stderr, "%s: temporary file: %s\n", prog, strerror(errno));
+            failed = 1;
+            break;
+        }
+        pid_t pid = fork();
+        if (pid == 0)
+            _exit(worker_run(started, s, c, queue, parts[started]));
+        if (pid < 0) {
+            fprintf(stderr, "%s: fork: %s\n", prog, strerror(errno));
+            fclose(parts[started]);
+            failed = 1;
+            break;
+        }
+    }
+
+    int status;
+    while (wait(&status) > 0)
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = 1;
+    double elapsed = now() - start;
+
+    *samples = 0;
+    for (int i = 0; i < c->count; i++) {
+        if (queue->chunk[i].worker < 0)
+            failed = 1;
+        *samples += queue->chunk[i].samples;
+    }
+
+    if (!failed && out &&
+        write_wav(out, config_sample_rate_hz(s->sample_rate), queue, c->count, parts, *samples) != 0) {
+        fprintf(stderr, "%s: %s: %s\n", prog, out, strerror(errno));
+        failed = 1;
+    }
+
+    for (int i = 0; i < started; i++)
+        fclose(parts[i]);
+    munmap(queue, size);
+    return failed ? -1 : elapsed;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: %s [-c viavoice.conf] [-j workers] [-p none|some|most|all] "
+                    "[-s] -o <out.wav> <file>...\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *const modes[PUNCT_MODES] = { "none", "some", "most", "all" };
+    const char *config_path = NULL, *out = NULL;
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int punct = PUNCT_NONE, scaling = 0, opt;
+
+    while ((opt = getopt(argc, argv, "c:j:o:p:s")) != -1) {
+        switch (opt) {
+            case 'c': config_path = optarg; break;
+            case 'o': out = optarg; break;
+            case 's': scaling = 1; break;
+            case 'j': {
+                char *end;
+                workers = strtol(optarg, &end, 10);
+                if (*end != '\0' || workers < 1 || workers > 256) {
+                    fprintf(stderr, "%s: -j takes 1 to 256 workers\n", prog);
+                    return 2;
+                }
+                break;
+            }
+            case 'p':
+                for (punct = 0; punct < PUNCT_MODES; punct++)
+                    if (strcmp(optarg, modes[punct]) == 0)
+                        break;
+                if (punct == PUNCT_MODES) {
+                    usage();
+                    return 2;
+                }
+                break;
+            default:
+                usage();
+                return 2;
+        }
+    }
+    if (!out || optind >= argc) {
+        usage();
+        return 2;
+    }
+    if (workers < 1)
+        workers = 1;
+
+    /* The module's log lines about the configuration and dictionaries
+     * only matter when something goes wrong */
+    log_level = LOG_LEVEL_WARNING;
+
+    Settings s = default_settings;
+    if (config_path && config_parse(config_path, &s) != 0) {
+        fprintf(stderr, "%s: %s: %s\n", prog, config_path, strerror(errno));
+        return 1;
+    }
+    if (s.log_level >= 0)
+        log_level = s.log_level;
+
+    Rewriter *rw = NULL;
+    if (s.rewrite_rules[0] != '\0' && !(rw = config_rewriter(&s))) {
+        fprintf(stderr, "%s: %s: cannot load the rewrite rules\n", prog, s.rewrite_rules);
+        return 1;
+    }
+
+    Chunks chunks = { NULL, 0, 0 };
+    for (int i = optind; i < argc; i++)
+        if (load_input(argv[i], rw, punct, &chunks) != 0)
+            return 1;
+    if (rw)
+        rewrite_free(rw);
+    if (chunks.count == 0) {
+        fprintf(stderr, "%s: nothing to say\n", prog);
+        return 1;
+    }
+    if (workers > chunks.count)
+        workers = chunks.count;
+
+    /* With -s, efficiency is how close k workers come to k times the
+     * speed of one */
+    double single = 0;
+    for (int k = scaling ? 1 : workers; k <= workers; k++) {
+        long samples;
+        double elapsed = render(&s, &chunks, k, k == workers ? out : NULL, &samples);
+        if (elapsed < 0)
+            return 1;
+        double audio = (double)samples / config_sample_rate_hz(s.sample_rate);
+        if (audio <= 0) {
+            fprintf(stderr, "%s: the engine produced no audio\n", prog);
+            return 1;
+        }
+        if (k == 1)
+            single = elapsed;
+        fprintf(stderr, "%2d workers: %d chunks, %.2f s of audio in %.2f s, "
+                        "real-time factor %.4f", k, chunks.count, audio, elapsed,
+                elapsed / audio);
+        if (scaling)
+            fprintf(stderr, ", efficiency %.0f%%", 100.0 * single / (k * elapsed));
+        fputc('\n', stderr);
+    }
+
+    for (int i = 0; i < chunks.count; i++)
+        free(chunks.text[i]);
+    free(chunks.text);
+    return 0;
+}
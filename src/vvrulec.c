@@ -0,0 +1,67 @@
+/*
+ * vvrulec.c - Compile rewrite rule files into an image the module maps
+ *
+ * Copyright (C) 2025
+ *
+ * Usage: vvrulec -o <image> <rules>...
+ *
+ * Rules from earlier files win where files repeat a pattern.  Point
+ * ViaVoiceRewriteRules at the image; the module maps it as is, or
+ * compiles the rule files again if any of them changed since.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rewrite.h"
+
+int main(int argc, char **argv)
+{
+    const char *out = NULL;
+    int first = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-o") == 0) {
+        out = argv[2];
+        first = 3;
+    }
+    if (!out || first >= argc) {
+        fprintf(stderr, "usage: %s -o <image> <rules>...\n", argv[0]);
+        return 2;
+    }
+
+    const char *const *paths = (const char *const *)argv + first;
+    int count = argc - first;
+    struct timespec t0, t1;
+
+    for (int i = 0; i < count; i++)
+        if (access(paths[i], R_OK) != 0) {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], paths[i], strerror(errno));
+            return 1;
+        }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    Rewriter *rw = rewrite_load(paths, count);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (!rw) {
+        fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+        return 1;
+    }
+
+    if (rewrite_save(rw, out, paths, count) != 0) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], out, strerror(errno));
+        rewrite_free(rw);
+        return 1;
+    }
+
+    int rules, states;
+    size_t bytes;
+    rewrite_size(rw, &rules, &states, &bytes);
+    printf("%s: %d rules from %d files, %d states, %zu KiB, compiled in %.1f ms\n",
+           out, rules, count, states, bytes / 1024,
+           (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+    rewrite_free(rw);
+    return 0;
+}
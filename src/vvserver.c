@@ -0,0 +1,992 @@
+/*
+ * vvserver.c - Speak for many clients over a Unix socket
+ *
+ * Copyright (C) 2025
+ *
+ * Usage: vvserver [-c viavoice.conf] [-j engines] [-m cache MiB] <socket>
+ *
+ * Services that need ViaVoice audio connect here instead of each
+ * starting a module with a cold engine.  The engines, the parsed
+ * configuration, the rewrite rules and the audio cache are shared by
+ * all clients.  The protocol is the module protocol speech-dispatcher
+ * speaks, with the audio sent raw:
+ *
+ *   on connecting            299-sample_rate=22050, 299-bits=16,
+ *                            299-num_channels=1, 299 OK READY
+ *   SET, key=value lines, .  203 OK SETTINGS RECEIVED, or 303 and none
+ *                            of them applied
+ *   SPEAK, text lines, .     202 OK RECEIVING MESSAGE, 200 OK SPEAKING
+ *   STOP                     stops every message of the client
+ *   QUIT                     210 OK QUIT
+ *
+ * Text lines starting with '.' have another '.' put in front, and text
+ * starting with a tag is SSML.  A client's messages are spoken in turn,
+ * each as "701 BEGIN", then "705 AUDIO <bytes>" lines each followed by
+ * that many bytes of 16-bit samples in host byte order, then "702 END",
+ * or "703 STOP" if it was stopped.  SET takes rate, pitch and volume
+ * (-100 to 100), voice (0-7, a voice name or "default") and
+ * punctuation_mode.
+ *
+ * Messages are cut into chunks at sentence ends.  An idle engine takes
+ * the next chunk of the next client in turn with none being spoken, so
+ * a client reading a long document holds up the others for at most a
+ * sentence, and its own chunks stay in order.  Engines never wait for
+ * a client: what they produce is queued, and the main thread sends it
+ * as the client reads.  A client that has BACKLOG bytes unread gets no
+ * more chunks rendered until it catches up, so one that plays as it
+ * reads does not hold an engine, nor fill memory with a whole book.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <ctype.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "eci_viavoice.h"
+#include "config.h"
+#include "engparams.h"
+#include "audiobuf.h"
+#include "audiocache.h"
+#include "text.h"
+#include "stats.h"
+#include "log.h"
+
+/* Small, so a long message yields the engine to others often */
+#define CHUNK_BYTES 400
+
+#define BUFFER_SAMPLES 8192
+#define MAX_MESSAGE (1 << 20)           /* text bytes */
+#define MAX_ENGINES 64
+#define BACKLOG (4 << 20)               /* bytes, about 95 s at 22050 Hz */
+
+/* Voice slots as the module uses them */
+#define VOICE_SLOTS      (ECI_PRESET_VOICES + ECI_USER_DEFINED_VOICES)
+#define VOICE_CONFIGURED (VOICE_SLOTS - 1)
+#define VOICE_PRESET0    (VOICE_CONFIGURED - 1)
+
+#define UNSET 1000                      /* a rate, pitch or volume left
+                                         * to the voice */
+
+typedef struct {
+    int voice;                          /* 0-7, -1 = viavoice.conf's */
+    int rate, pitch, volume;            /* -100..100, or UNSET */
+    int punct;
+} ClientVoice;
+
+typedef struct Chunk Chunk;
+struct Chunk {
+    Chunk *next;
+    char *text;                         /* NULL: only send stops */
+    int first, last;                    /* of its message */
+    int stops;                          /* "703 STOP" lines to send */
+    int quit;                           /* then "210 OK QUIT" */
+    ClientVoice voice;
+};
+
+typedef struct Engine Engine;
+
+enum { READ_COMMAND, READ_SPEAK, READ_SET };
+
+typedef struct {
+    int fd;
+
+    /* Under out: what is queued for the main thread to send */
+    pthread_mutex_t out;
+    char *out_buf;
+    size_t out_used, out_sent, out_allocated;
+    int broken;                         /* out of memory or a send failed */
+    int quit_sent;                      /* closed once its output is sent */
+
+    /* Under lock */
+    Chunk *head, *tail;
+    Engine *engine;                     /* speaking a chunk of it */
+    int begun;                          /* a message was begun, not ended */
+    int stopped;                        /* STOP came during the chunk */
+    int closed;                         /* freed once no engine has it */
+
+    /* Main thread only */
+    ClientVoice voice, pending;
+    int quitting;                       /* QUIT read, nothing more is */
+    int reading;
+    int bad;                            /* the SET or SPEAK being read */
+    char *in;
+    size_t in_used, in_allocated;
+    char *body;
+    size_t body_used, body_allocated;
+} Client;
+
+struct Engine {
+    pthread_t thread;
+    ECIHand h;
+    EngineParams params;
+    int voice;                          /* slot copied to voice 0 */
+    int base[VOICE_SLOTS][eciNumVoiceParams];
+    short buffer[BUFFER_SAMPLES];
+    Client *client;                     /* whose audio the callback sends */
+    AudioData audio;                    /* for the cache */
+    int collect;
+    int out_of_memory;
+    unsigned long long start;
+    int first_audio;
+};
+
+static const char *prog = "vvserver";
+static Settings settings;
+static Rewriter *rewriter;
+static AudioCache *cache;
+static int sample_hz;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t ready = PTHREAD_COND_INITIALIZER;
+static Client **clients;
+static int client_count, client_allocated;
+
+/* Main thread only: the poll set, with room for the pipe, the listener
+ * and every client */
+static struct pollfd *poll_fds;
+static Client **polled;
+static int poll_allocated;
+static int turn;                        /* the client served next */
+static int engines_started, engines_failed;
+
+static int wake_pipe[2];                /* output queued for the main thread */
+static volatile sig_atomic_t quit;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    quit = 1;
+}
+
+static int append(char **buf, size_t *used, size_t *allocated, const char *data, size_t n)
+{
+    if (*used + n + 1 > *allocated) {
+        size_t size = *allocated ? *allocated : 256;
+        while (size < *used + n + 1)
+            size *= 2;
+        char *grown = realloc(*buf, size);
+        if (!grown)
+            return -1;
+        *buf = grown;
+        *allocated = size;
+    }
+    memcpy(*buf + *used, data, n);
+    *used += n;
+    (*buf)[*used] = '\0';
+    return 0;
+}
+
+/* Queue data for c, under c->out, and wake the main thread to send it */
+static void queue_locked(Client *c, const void *data, size_t len)
+{
+    if (c->out_sent == c->out_used) {
+        char b = 0;
+        if (write(wake_pipe[1], &b, 1) < 0 && errno != EAGAIN)
+            c->broken = 1;
+    }
+    if (!c->broken && append(&c->out_buf, &c->out_used, &c->out_allocated, data, len) != 0)
+        c->broken = 1;
+}
+
+static void client_send(Client *c, const char *line)
+{
+    pthread_mutex_lock(&c->out);
+    queue_locked(c, line, strlen(line));
+    pthread_mutex_unlock(&c->out);
+}
+
+/* Answer QUIT, after which c is closed as soon as its output is sent */
+static void send_quit(Client *c)
+{
+    pthread_mutex_lock(&c->out);
+    queue_locked(c, "210 OK QUIT\n", 12);
+    c->quit_sent = 1;
+    pthread_mutex_unlock(&c->out);
+}
+
+static void send_audio(Client *c, const short *samples, int n)
+{
+    char header[32];
+    int len = snprintf(header, sizeof(header), "705 AUDIO %d\n", (int)(n * sizeof(short)));
+
+    pthread_mutex_lock(&c->out);
+    queue_locked(c, header, len);
+    queue_locked(c, samples, n * sizeof(short));
+    pthread_mutex_unlock(&c->out);
+    stats_count(STAT_SEND_BYTES, n * sizeof(short));
+}
+
+static size_t backlog(Client *c)
+{
+    pthread_mutex_lock(&c->out);
+    size_t n = c->out_used - c->out_sent;
+    pthread_mutex_unlock(&c->out);
+    return n;
+}
+
+static void chunk_free(Chunk *k)
+{
+    free(k->text);
+    free(k);
+}
+
+static void client_free(Client *c)
+{
+    while (c->head) {
+        Chunk *k = c->head;
+        c->head = k->next;
+        chunk_free(k);
+    }
+    close(c->fd);
+    pthread_mutex_destroy(&c->out);
+    free(c->out_buf);
+    free(c->in);
+    free(c->body);
+    free(c);
+}
+
+/* The next client in turn with a chunk waiting, none being spoken and
+ * room for its audio.  Called under lock. */
+static Client *next_client(void)
+{
+    for (int i = 0; i < client_count; i++) {
+        Client *c = clients[(turn + i) % client_count];
+        if (c->head && !c->engine && (!c->head->text || backlog(c) < BACKLOG)) {
+            turn = (turn + i + 1) % client_count;
+            return c;
+        }
+    }
+    return NULL;
+}
+
+/* ---- Engines ---- */
+
+static ECICallbackReturn engine_callback(ECIHand h, ECIMessage msg, long param, void *data)
+{
+    (void)h;
+    Engine *e = data;
+
+    /* STOP is only flagged by the main thread, which never calls ECI
+     * on an engine's handle; as in the module, refusing the data ends
+     * the synthesis, and engine_speak() stops the engine itself */
+    if (__atomic_load_n(&e->client->stopped, __ATOMIC_RELAXED))
+        return eciDataNotProcessed;
+    if (msg != eciWaveformBuffer)
+        return eciDataProcessed;
+
+    if (e->first_audio) {
+        e->first_audio = 0;
+        stats_record(STAT_FIRST_AUDIO, e->start);
+    }
+    stats_count(STAT_CALLBACKS, 1);
+    stats_count(STAT_SAMPLES, param);
+
+    send_audio(e->client, e->buffer, param);
+    if (e->collect) {
+        static const AudioStages no_stages = { NULL, NULL, NULL };
+        if (audiobuf_append(&e->audio, e->buffer, param, &no_stages, BUFFER_SAMPLES) < 0)
+            e->out_of_memory = 1;
+    }
+    return eciDataProcessed;
+}
+
+/* Like the module, keep voice 0 as the engine started (Wade) and the
+ * voice viavoice.conf configures in slots of their own to copy from */
+static int engine_start(Engine *e)
+{
+    e->h = eciNew();
+    if (e->h == NULL_ECI_HAND)
+        return -1;
+    eciRegisterCallback(e->h, engine_callback, e);
+    if (!eciSetOutputBuffer(e->h, BUFFER_SAMPLES, e->buffer)) {
+        eciDelete(e->h);
+        return -1;
+    }
+
+    eciCopyVoice(e->h, 0, VOICE_PRESET0);
+    config_engine(e->h, &settings, &e->params);
+    eciCopyVoice(e->h, 0, VOICE_CONFIGURED);
+    e->voice = VOICE_CONFIGURED;
+
+    for (int v = 1; v < VOICE_SLOTS; v++)
+        for (int i = 0; i < eciNumVoiceParams; i++)
+            e->base[v][i] = eciGetVoiceParam(e->h, v, (ECIVoiceParam)i);
+    return 0;
+}
+
+static void engine_voice(Engine *e, const ClientVoice *v)
+{
+    int slot = v->voice < 0 ? VOICE_CONFIGURED : v->voice == 0 ? VOICE_PRESET0 : v->voice;
+    if (slot != e->voice && eciCopyVoice(e->h, slot, 0)) {
+        e->voice = slot;
+        engparams_voice_copied(&e->params, e->h);
+    }
+
+    /* As the module maps them, without its time compression */
+    const int *base = e->base[e->voice];
+    engparams_voice(&e->params, eciSpeed,
+                    v->rate == UNSET ? base[eciSpeed] : (v->rate + 100) * 250 / 200);
+    engparams_voice(&e->params, eciPitchBaseline,
+                    v->pitch == UNSET ? base[eciPitchBaseline] : (v->pitch + 100) / 2);
+    engparams_voice(&e->params, eciVolume,
+                    v->volume == UNSET ? base[eciVolume] : (v->volume + 100) / 2);
+    engparams_commit(&e->params, e->h);
+}
+
+/* Speak one chunk to c, from the cache if it is there */
+static void engine_speak(Engine *e, Client *c, Chunk *k)
+{
+    if (!k->text) {
+        for (int i = 0; i < k->stops; i++)
+            client_send(c, "703 STOP\n");
+        if (k->quit)
+            send_quit(c);
+        return;
+    }
+    if (k->first)
+        client_send(c, "701 BEGIN\n");
+
+    engine_voice(e, &k->voice);
+    e->collect = cache && strlen(k->text) <= AUDIOCACHE_MAX_TEXT;
+    if (e->collect) {
+        int n;
+        short *samples = audiocache_get(cache, k->text, &e->params.have, &n);
+        if (samples) {
+            for (int i = 0; i < n && !__atomic_load_n(&c->stopped, __ATOMIC_RELAXED);
+                 i += BUFFER_SAMPLES)
+                send_audio(c, samples + i, n - i < BUFFER_SAMPLES ? n - i : BUFFER_SAMPLES);
+            free(samples);
+            return;
+        }
+    }
+
+    e->client = c;
+    e->audio.num_samples = 0;
+    e->out_of_memory = 0;
+    e->first_audio = 1;
+    e->start = stats_now();
+    int ok = eciAddText(e->h, k->text) && eciSynthesize(e->h) && eciSynchronize(e->h);
+    stats_record(STAT_SYNTH, e->start);
+    if (__atomic_load_n(&c->stopped, __ATOMIC_RELAXED))
+        eciStop(e->h);          /* drop what the abort left queued */
+    else if (!ok)
+        WARN("Engine failed on a message");
+    else if (e->collect && !e->out_of_memory)
+        audiocache_put(cache, k->text, &e->params.have, e->audio.samples,
+                       e->audio.num_samples);
+}
+
+static void *engine_main(void *arg)
+{
+    Engine *e = arg;
+    int ok = engine_start(e) == 0;
+
+    pthread_mutex_lock(&lock);
+    if (ok)
+        engines_started++;
+    else
+        engines_failed++;
+    pthread_cond_signal(&ready);
+    if (!ok) {
+        pthread_mutex_unlock(&lock);
+        return NULL;
+    }
+
+    for (;;) {
+        Client *c;
+        while (!(c = next_client()))
+            pthread_cond_wait(&work, &lock);
+        Chunk *k = c->head;
+        c->head = k->next;
+        if (!c->head)
+            c->tail = NULL;
+        c->engine = e;
+        __atomic_store_n(&c->stopped, 0, __ATOMIC_RELAXED);
+        if (k->first)
+            c->begun = 1;
+        pthread_mutex_unlock(&lock);
+
+        engine_speak(e, c, k);
+
+        /* The message ends here unless STOP ended it.  Other engines
+         * leave c alone until it is released, so this comes before
+         * anything of the next message. */
+        pthread_mutex_lock(&lock);
+        int end = k->text && k->last && !c->stopped;
+        if (end)
+            c->begun = 0;
+        pthread_mutex_unlock(&lock);
+        if (end)
+            client_send(c, "702 END\n");
+
+        pthread_mutex_lock(&lock);
+        c->engine = NULL;
+        if (c->closed)
+            client_free(c);
+        chunk_free(k);
+    }
+    return NULL;
+}
+
+/* ---- Clients ---- */
+
+static const char *const punct_names[PUNCT_MODES] = { "none", "some", "most", "all" };
+
+static int parse_level(const char *value, int *v)
+{
+    char *end;
+    long l = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || l < -100 || l > 100)
+        return 0;
+    *v = l;
+    return 1;
+}
+
+static int client_set(ClientVoice *v, const char *key, const char *value)
+{
+    if (!strcmp(key, "rate"))
+        return parse_level(value, &v->rate);
+    if (!strcmp(key, "pitch"))
+        return parse_level(value, &v->pitch);
+    if (!strcmp(key, "volume"))
+        return parse_level(value, &v->volume);
+    if (!strcmp(key, "voice")) {
+        if (!strcmp(value, "default")) {
+            v->voice = -1;
+            return 1;
+        }
+        for (int i = 0; i < ECI_PRESET_VOICES; i++)
+            if (!strcasecmp(value, voice_name_table[i]) ||
+                (value[0] == '0' + i && value[1] == '\0')) {
+                v->voice = i;
+                return 1;
+            }
+        return 0;
+    }
+    if (!strcmp(key, "punctuation_mode")) {
+        for (int i = 0; i < PUNCT_MODES; i++)
+            if (!strcmp(value, punct_names[i])) {
+                v->punct = i;
+                return 1;
+            }
+        return 0;
+    }
+    return 0;
+}
+
+/* Clean up a message as the module does TEXT and queue its chunks */
+static void client_speak(Client *c)
+{
+    unsigned long long start = stats_now();
+    Chunk *head = NULL, **tail = &head;
+    int chunks = 0;
+
+    if (c->body_used)
+        c->body[--c->body_used] = '\0';     /* the last newline */
+    const char *p = c->body ? c->body : "";
+    while (isspace((unsigned char)*p))
+        p++;
+    char *text = NULL;
+    if (!c->bad && *p)
+        text = *p == '<' ? strip_ssml(c->body, c->body_used) : strdup(c->body);
+    if (text && rewriter) {
+        int matches;
+        char *rewritten = rewrite_apply(rewriter, text, &matches);
+        stats_count(STAT_REWRITES, matches);
+        free(text);
+        text = rewritten;
+    }
+
+    size_t len = text ? strlen(text) : 0, pos = 0;
+    while (text) {
+        while (pos < len && isspace((unsigned char)text[pos]))
+            pos++;
+        if (pos == len)
+            break;
+        size_t end = chunk_end(text, pos, len, CHUNK_BYTES);
+        char *piece = strndup(text + pos, end - pos);
+        Chunk *k = calloc(1, sizeof(Chunk));
+        if (k && piece)
+            k->text = sanitize_for_viavoice(piece, c->voice.punct);
+        free(piece);
+        if (!k || !k->text) {
+            free(k);
+            chunks = 0;
+            break;
+        }
+        k->voice = c->voice;
+        k->first = chunks++ == 0;
+        *tail = k;
+        tail = &k->next;
+        pos = end;
+    }
+    free(text);
+    stats_record(STAT_NORMALIZE, start);
+
+    if (!chunks) {
+        while (head) {
+            Chunk *k = head;
+            head = k->next;
+            chunk_free(k);
+        }
+        client_send(c, "301 ERROR CANT SPEAK\n");
+        return;
+    }
+    Chunk *last = head;
+    while (last->next)
+        last = last->next;
+    last->last = 1;
+
+    /* Before an engine can send 701 */
+    client_send(c, "200 OK SPEAKING\n");
+    stats_count(STAT_MESSAGES, 1);
+
+    pthread_mutex_lock(&lock);
+    if (c->tail)
+        c->tail->next = head;
+    else
+        c->head = head;
+    c->tail = last;
+    pthread_cond_signal(&work);
+    pthread_mutex_unlock(&lock);
+}
+
+/* Drop c's waiting chunks and stop the one being spoken.  Every message
+ * begun or waiting ends with "703 STOP", sent in order by an engine, and
+ * for quit "210 OK QUIT" comes after them. */
+static void client_stop(Client *c, int quit)
+{
+    stats_count(STAT_STOPS, 1);
+    pthread_mutex_lock(&lock);
+    int stops = c->begun;
+    c->begun = 0;
+    while (c->head) {
+        Chunk *k = c->head;
+        c->head = k->next;
+        if (k->first || !k->text)
+            stops += k->text ? 1 : k->stops;
+        chunk_free(k);
+    }
+    c->tail = NULL;
+    if (c->engine)
+        __atomic_store_n(&c->stopped, 1, __ATOMIC_RELAXED);
+    /* An engine may still be sending the end of the message it spoke */
+    Chunk *k = stops || (quit && c->engine) ? calloc(1, sizeof(Chunk)) : NULL;
+    if (k) {
+        k->stops = stops;
+        k->quit = quit;
+        c->head = c->tail = k;
+        pthread_cond_signal(&work);
+    }
+    pthread_mutex_unlock(&lock);
+    if (quit && !k)
+        send_quit(c);
+}
+
+static void client_close(Client *c)
+{
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < client_count; i++)
+        if (clients[i] == c) {
+            memmove(clients + i, clients + i + 1, (client_count - i - 1) * sizeof(Client *));
+            client_count--;
+            if (turn > i)
+                turn--;
+            break;
+        }
+    if (turn >= client_count)
+        turn = 0;
+    c->closed = 1;
+    if (c->engine)
+        __atomic_store_n(&c->stopped, 1, __ATOMIC_RELAXED);
+    else
+        client_free(c);
+    pthread_mutex_unlock(&lock);
+}
+
+/* Handle one line from c, without its newline.  Returns -1 to stop
+ * reading from it. */
+static int client_line(Client *c, char *line)
+{
+    size_t len = strlen(line);
+    if (len && line[len - 1] == '\r')
+        line[--len] = '\0';
+
+    if (c->reading == READ_SPEAK) {
+        if (!strcmp(line, ".")) {
+            c->reading = READ_COMMAND;
+            client_speak(c);
+        } else if (!c->bad) {
+            if (line[0] == '.')
+                line++;
+            c->bad = c->body_used + len > MAX_MESSAGE ||
+                     append(&c->body, &c->body_used, &c->body_allocated, line, strlen(line)) ||
+                     append(&c->body, &c->body_used, &c->body_allocated, "\n", 1);
+        }
+        return 0;
+    }
+
+    if (c->reading == READ_SET) {
+        if (!strcmp(line, ".")) {
+            c->reading = READ_COMMAND;
+            if (c->bad) {
+                client_send(c, "303 ERROR INVALID PARAMETER OR VALUE\n");
+            } else {
+                c->voice = c->pending;
+                client_send(c, "203 OK SETTINGS RECEIVED\n");
+            }
+            return 0;
+        }
+        char *eq = strchr(line, '=');
+        if (!eq)
+            c->bad = 1;
+        else {
+            *eq = '\0';
+            if (!client_set(&c->pending, line, eq + 1))
+                c->bad = 1;
+        }
+        return 0;
+    }
+
+    if (!strcmp(line, "SPEAK")) {
+        c->reading = READ_SPEAK;
+        c->bad = 0;
+        c->body_used = 0;
+        client_send(c, "202 OK RECEIVING MESSAGE\n");
+        return 0;
+    }
+    if (!strcmp(line, "SET")) {
+        c->reading = READ_SET;
+        c->bad = 0;
+        c->pending = c->voice;
+        client_send(c, "203 OK RECEIVING SETTINGS\n");
+        return 0;
+    }
+    if (!strcmp(line, "STOP")) {
+        client_stop(c, 0);
+        return 0;
+    }
+    if (!strcmp(line, "QUIT")) {
+        client_stop(c, 1);
+        c->quitting = 1;
+        return -1;
+    }
+    client_send(c, "300 ERR UNKNOWN COMMAND\n");
+    return 0;
+}
+
+/* Read what c sent and handle its complete lines.  Returns -1 to
+ * close it. */
+static int client_read(Client *c)
+{
+    char buf[65536];
+    ssize_t n = read(c->fd, buf, sizeof(buf));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        return 0;
+    if (n <= 0 || c->broken)
+        return -1;
+    if (append(&c->in, &c->in_used, &c->in_allocated, buf, n) != 0)
+        return -1;
+
+    char *line = c->in, *nl;
+    while (!c->quitting && (nl = memchr(line, '\n', c->in + c->in_used - line))) {
+        *nl = '\0';
+        client_line(c, line);
+        line = nl + 1;
+    }
+    c->in_used -= line - c->in;
+    memmove(c->in, line, c->in_used);
+    if (c->in_used > MAX_MESSAGE)
+        return -1;
+    return 0;
+}
+
+/* Send what is queued for c, as much as it takes now.  Returns -1 to
+ * close it. */
+static int client_flush(Client *c)
+{
+    pthread_mutex_lock(&c->out);
+    while (!c->broken && c->out_sent < c->out_used) {
+        ssize_t n = send(c->fd, c->out_buf + c->out_sent, c->out_used - c->out_sent,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0)
+            c->broken = 1;
+        else
+            c->out_sent += n;
+    }
+    if (c->out_sent == c->out_used) {
+        c->out_sent = c->out_used = 0;
+    } else if (c->out_sent > c->out_used / 2) {
+        memmove(c->out_buf, c->out_buf + c->out_sent, c->out_used - c->out_sent);
+        c->out_used -= c->out_sent;
+        c->out_sent = 0;
+    }
+    int left = c->out_used > 0, broken = c->broken, quit = c->quit_sent;
+    int room = c->out_used < BACKLOG;
+    pthread_mutex_unlock(&c->out);
+
+    /* Its next chunk may have waited for the client to catch up */
+    if (room) {
+        pthread_mutex_lock(&lock);
+        if (c->head && !c->engine)
+            pthread_cond_signal(&work);
+        pthread_mutex_unlock(&lock);
+    }
+    return broken || (quit && !left) ? -1 : 0;
+}
+
+static int poll_reserve(int n)
+{
+    if (n <= poll_allocated)
+        return 0;
+    struct pollfd *fds = realloc(poll_fds, n * sizeof(struct pollfd));
+    if (!fds)
+        return -1;
+    poll_fds = fds;
+    Client **grown = realloc(polled, n * sizeof(Client *));
+    if (!grown)
+        return -1;
+    polled = grown;
+    poll_allocated = n;
+    return 0;
+}
+
+static void client_accept(int listener)
+{
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0)
+        return;
+
+    /* The engines look through clients under lock */
+    pthread_mutex_lock(&lock);
+    if (client_count == client_allocated) {
+        Client **grown = realloc(clients, (client_allocated * 2 + 16) * sizeof(Client *));
+        if (grown) {
+            clients = grown;
+            client_allocated = client_allocated * 2 + 16;
+        }
+    }
+    int room = client_count < client_allocated;
+    pthread_mutex_unlock(&lock);
+    if (room && poll_reserve(client_count + 3) != 0)
+        room = 0;
+
+    Client *c = room ? calloc(1, sizeof(Client)) : NULL;
+    if (!c) {
+        WARN("Out of memory for a new client");
+        close(fd);
+        return;
+    }
+    c->fd = fd;
+    pthread_mutex_init(&c->out, NULL);
+    c->voice.voice = -1;
+    c->voice.rate = c->voice.pitch = c->voice.volume = UNSET;
+    c->voice.punct = PUNCT_NONE;
+
+    char greeting[128];
+    snprintf(greeting, sizeof(greeting),
+             "299-sample_rate=%d\n299-bits=16\n299-num_channels=1\n299 OK READY\n", sample_hz);
+    client_send(c, greeting);
+
+    pthread_mutex_lock(&lock);
+    clients[client_count++] = c;
+    pthread_mutex_unlock(&lock);
+    DBG("client %d connected", fd);
+}
+
+/* Bind path, replacing a socket left by a server that is gone */
+static int listen_on(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        close(fd);
+        errno = EADDRINUSE;
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: %s [-c viavoice.conf] [-j engines] [-m cache MiB] <socket>\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *config_path = NULL;
+    long engines = sysconf(_SC_NPROCESSORS_ONLN), cache_mb = 16;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:j:m:")) != -1) {
+        char *end;
+        switch (opt) {
+            case 'c': config_path = optarg; break;
+            case 'j':
+                engines = strtol(optarg, &end, 10);
+                if (*end != '\0' || engines < 1 || engines > MAX_ENGINES) {
+                    fprintf(stderr, "%s: -j takes 1 to %d engines\n", prog, MAX_ENGINES);
+                    return 2;
+                }
+                break;
+            case 'm':
+                cache_mb = strtol(optarg, &end, 10);
+                if (*end != '\0' || cache_mb < 0 || cache_mb > 1024) {
+                    fprintf(stderr, "%s: -m takes 0 to 1024 MiB\n", prog);
+                    return 2;
+                }
+                break;
+            default:
+                usage();
+                return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
+        return 2;
+    }
+    if (engines < 1)
+        engines = 1;
+    if (engines > MAX_ENGINES)
+        engines = MAX_ENGINES;
+
+    settings = default_settings;
+    if (config_path && config_parse(config_path, &settings) != 0) {
+        fprintf(stderr, "%s: %s: %s\n", prog, config_path, strerror(errno));
+        return 1;
+    }
+    if (settings.log_level >= 0)
+        log_level = settings.log_level;
+    sample_hz = config_sample_rate_hz(settings.sample_rate);
+
+    /* SIGINT and SIGTERM only reach the main thread, while it polls */
+    sigset_t blocked, polling;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &blocked, NULL);
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (stats_watch_signal() != 0)
+        WARN("Failed to start statistics thread, SIGUSR1 dump disabled");
+    pthread_sigmask(SIG_BLOCK, NULL, &polling);
+    sigdelset(&polling, SIGINT);
+    sigdelset(&polling, SIGTERM);
+    log_open(prog);
+
+    if (pipe2(wake_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        ERR("pipe: %s", strerror(errno));
+        log_close();
+        return 1;
+    }
+
+    if (settings.rewrite_rules[0] != '\0' && !(rewriter = config_rewriter(&settings)))
+        WARN("Rewrite rules disabled");
+    if (cache_mb > 0 && !(cache = audiocache_new((size_t)cache_mb << 20)))
+        WARN("Out of memory for the audio cache");
+
+    int listener = listen_on(argv[optind]);
+    if (listener < 0) {
+        ERR("Cannot listen on %s: %s", argv[optind], strerror(errno));
+        log_close();
+        return 1;
+    }
+
+    /* Each engine starts and loads its dictionaries on its own thread */
+    static Engine pool[MAX_ENGINES];
+    for (int i = 0; i < engines; i++)
+        if (pthread_create(&pool[i].thread, NULL, engine_main, &pool[i]) != 0) {
+            engines = i;
+            break;
+        }
+    pthread_mutex_lock(&lock);
+    while (engines_started + engines_failed < engines)
+        pthread_cond_wait(&ready, &lock);
+    pthread_mutex_unlock(&lock);
+    if (engines_started == 0) {
+        ERR("No engine started - check the ViaVoice installation");
+        unlink(argv[optind]);
+        log_close();
+        return 1;
+    }
+    NOTICE("listening on %s with %d engines, %d Hz", argv[optind], engines_started, sample_hz);
+
+    if (poll_reserve(2) != 0) {
+        ERR("Out of memory");
+        quit = 1;
+    }
+    while (!quit) {
+        struct pollfd *fds = poll_fds;
+        int n = 0;
+        fds[n++] = (struct pollfd){ .fd = wake_pipe[0], .events = POLLIN };
+        fds[n++] = (struct pollfd){ .fd = listener, .events = POLLIN };
+        for (int i = 0; i < client_count; i++) {
+            Client *c = clients[i];
+            polled[n] = c;
+            fds[n++] = (struct pollfd){
+                .fd = c->fd,
+                .events = (c->quitting ? 0 : POLLIN) | (backlog(c) ? POLLOUT : 0),
+            };
+        }
+
+        if (ppoll(fds, n, NULL, &polling) < 0) {
+            if (errno == EINTR)
+                continue;
+            ERR("poll: %s", strerror(errno));
+            break;
+        }
+        if (fds[0].revents) {
+            char drain[256];
+            while (read(wake_pipe[0], drain, sizeof(drain)) > 0)
+                ;
+        }
+        for (int i = 2; i < n; i++) {
+            Client *c = polled[i];
+            if (((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && !c->quitting &&
+                 client_read(c) != 0) || client_flush(c) != 0)
+                client_close(c);
+        }
+        if (fds[1].revents & POLLIN)
+            client_accept(listener);
+    }
+
+    NOTICE("shutting down");
+    close(listener);
+    unlink(argv[optind]);
+    stats_dump(stderr);
+    log_close();
+    return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * watch.c - Reload on file changes and SIGHUP
+ *
+ * Copyright (C) 2025
+ *
+ * One thread waits on an inotify descriptor, a signalfd for SIGHUP and
+ * a pipe used to stop it.  Editors tend to produce several events per
+ * save (truncate, write, rename), so changes are collected until none
+ * has arrived for WATCH_SETTLE_MS and then reported in one callback.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+
+#include "watch.h"
+
+#define WATCH_SETTLE_MS 200
+
+static char names[WATCH_MAX][256];     /* file name within its directory */
+static int wds[WATCH_MAX];             /* watch on the directory, -1 = none */
+static int count = 0;
+
+static int inotify_fd = -1;
+static int signal_fd = -1;
+static int wake[2] = { -1, -1 };
+static pthread_t thread;
+static int running = 0;
+static WatchCallback callback;
+
+int watch_block_signal(void)
+{
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    return pthread_sigmask(SIG_BLOCK, &set, NULL) == 0 ? 0 : -1;
+}
+
+void watch_set_paths(const char *const *paths, int n)
+{
+    for (int i = 0; i < count; i++)
+        if (wds[i] >= 0)
+            inotify_rm_watch(inotify_fd, wds[i]);   /* shared ones fail, harmlessly */
+
+    count = n < WATCH_MAX ? n : WATCH_MAX;
+    for (int i = 0; i < count; i++) {
+        char dir[256];
+        const char *slash = strrchr(paths[i], '/');
+
+        wds[i] = -1;
+        if (inotify_fd < 0 || paths[i][0] == '\0')
+            continue;
+        if (slash)
+            snprintf(dir, sizeof(dir), "%.*s", slash == paths[i] ? 1 : (int)(slash - paths[i]), paths[i]);
+        else
+            snprintf(dir, sizeof(dir), ".");
+        snprintf(names[i], sizeof(names[i]), "%s", slash ? slash + 1 : paths[i]);
+        wds[i] = inotify_add_watch(inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    }
+}
+
+static unsigned int read_events(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    unsigned int changed = 0;
+    ssize_t len;
+
+    while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len; ) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            for (int i = 0; i < count && ev->len; i++)
+                if (wds[i] == ev->wd && strcmp(names[i], ev->name) == 0)
+                    changed |= 1u << i;
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    return changed;
+}
+
+static void *watch_thread(void *arg)
+{
+    unsigned int pending = 0;
+    (void)arg;
+
+    while (1) {
+        struct pollfd fds[3] = {
+            { wake[0], POLLIN, 0 },
+            { inotify_fd, POLLIN, 0 },
+            { signal_fd, POLLIN, 0 },
+        };
+        int ret = poll(fds, 3, pending ? WATCH_SETTLE_MS : -1);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (ret == 0) {
+            callback(pending);
+            pending = 0;
+            continue;
+        }
+        if (fds[0].revents)
+            break;
+        if (fds[1].revents & POLLIN)
+            pending |= read_events();
+        if (fds[2].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            if (read(signal_fd, &si, sizeof(si)) == sizeof(si))
+                pending = ~0u;
+        }
+    }
+    return NULL;
+}
+
+int watch_start(const char *const *paths, int n, WatchCallback cb)
+{
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    signal_fd = signalfd(-1, &set, SFD_CLOEXEC | SFD_NONBLOCK);
+    inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if ((signal_fd < 0 && inotify_fd < 0) || pipe(wake) != 0) {
+        watch_stop();
+        return -1;
+    }
+
+    callback = cb;
+    watch_set_paths(paths, n);
+    if (pthread_create(&thread, NULL, watch_thread, NULL) != 0) {
+        watch_stop();
+        return -1;
+    }
+    running = 1;
+    return 0;
+}
+
+void watch_stop(void)
+{
+    if (running) {
+        if (write(wake[1], "", 1) == 1)
+            pthread_join(thread, NULL);
+        running = 0;
+    }
+    for (int i = 0; i < 2; i++)
+        if (wake[i] >= 0) {
+            close(wake[i]);
+            wake[i] = -1;
+        }
+    if (inotify_fd >= 0)
+        close(inotify_fd);
+    if (signal_fd >= 0)
+        close(signal_fd);
+    inotify_fd = signal_fd = -1;
+    count = 0;
+}
@@ -0,0 +1,31 @@
+/*
+ * watch.h - Reload on file changes and SIGHUP
+ *
+ * Copyright (C) 2025
+ */
+
+#ifndef _WATCH_H
+#define _WATCH_H
+
+#define WATCH_MAX 8
+
+/* Called on the watch thread once changes have settled.  Bit i is set
+ * when paths[i] changed; SIGHUP sets every bit. */
+typedef void (*WatchCallback)(unsigned int changed);
+
+/* Block SIGHUP in the calling thread, so call this before creating
+ * other threads: the watch thread is the only one to receive it. */
+int watch_block_signal(void);
+
+/* Start watching up to WATCH_MAX files; empty paths are skipped.  Files
+ * are watched by name in their directory, so editors that save by
+ * renaming a new file over the old one are seen too. */
+int watch_start(const char *const *paths, int count, WatchCallback callback);
+
+/* Replace the watched files.  Only call this from the callback. */
+void watch_set_paths(const char *const *paths, int count);
+
+/* Stop the watch thread, waiting for a running callback to finish */
+void watch_stop(void);
+
+#endif /* _WATCH_H */
@@ -0,0 +1,249 @@
+/*
+ * wsola.c - Pitch-preserving time compression (WSOLA)
+ *
+ * Copyright (C) 2025
+ *
+ * Waveform Similarity Overlap-Add.  Frames of 20 ms are read from the
+ * input every hop_in samples and overlap-added every hop_out samples
+ * (hop_in = hop_out * speed).  Each frame is shifted by up to +-5 ms so
+ * that it lines up with the natural continuation of the previous frame,
+ * which keeps pitch periods intact instead of smearing them.
+ *
+ * The input is consumed in whatever chunks the engine delivers, so the
+ * stretcher only ever holds one frame plus the search tolerance.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "wsola.h"
+
+/* Frame length is capped so the int32 lanes of the correlation kernel
+ * cannot overflow (64 iterations of 2 * 4095^2). */
+#define WSOLA_MAX_WIN 512
+
+/* Extra input buffered per pass on top of the working set */
+#define WSOLA_CHUNK 4096
+
+struct WsolaState {
+    int win;            /* frame length, multiple of 8 */
+    int hop_out;        /* win / 2 */
+    int tolerance;      /* search range either side of the nominal position */
+    int hop_in_max;
+    double hop_in;      /* hop_out * speed */
+    float *window;      /* periodic Hann, sums to 1 at 50% overlap */
+    float *overlap;     /* overlap-add accumulator, win samples */
+    short *in;          /* pending input */
+    int in_len;
+    int in_cap;
+    double pos;         /* nominal start of the next frame in in[] */
+    int prev;           /* natural continuation of the last frame, -1 if none */
+};
+
+/* Cross-correlation of two win-length int16 segments.  Samples are
+ * scaled down by 8 so eight products fit an int32 lane. */
+static long corr_int16(const short *a, const short *b, int n)
+{
+#ifdef __SSE2__
+    __m128i acc = _mm_setzero_si128();
+    for (int i = 0; i < n; i += 8) {
+        __m128i x = _mm_srai_epi16(_mm_loadu_si128((const __m128i *)(a + i)), 3);
+        __m128i y = _mm_srai_epi16(_mm_loadu_si128((const __m128i *)(b + i)), 3);
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(x, y));
+    }
+    int lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return (long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+    long sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += (long)(a[i] >> 3) * (b[i] >> 3);
+    return sum;
+#endif
+}
+
+/* Offset in [lo, hi] whose segment best matches target.  Coarse search
+ * on even offsets, then refine the winner's neighbours. */
+static int best_offset(const short *in, const short *target, int lo, int hi, int n)
+{
+    int best = lo;
+    long best_corr = corr_int16(in + lo, target, n);
+
+    for (int k = lo + 2; k <= hi; k += 2) {
+        long c = corr_int16(in + k, target, n);
+        if (c > best_corr) {
+            best_corr = c;
+            best = k;
+        }
+    }
+
+    int center = best;
+    for (int k = center - 1; k <= center + 1; k += 2) {
+        if (k < lo || k > hi)
+            continue;
+        long c = corr_int16(in + k, target, n);
+        if (c > best_corr) {
+            best_corr = c;
+            best = k;
+        }
+    }
+    return best;
+}
+
+static inline short clip16(float v)
+{
+    if (v > 32767.0f) return 32767;
+    if (v < -32768.0f) return -32768;
+    return (short)lrintf(v);
+}
+
+/* Run every frame whose input is fully available, stopping once the
+ * nominal position passes limit.  Returns samples written to out. */
+static int run_frames(WsolaState *ws, short *out, int limit)
+{
+    int written = 0;
+    int win = ws->win, hop = ws->hop_out, tol = ws->tolerance;
+
+    while (1) {
+        int p = (int)ws->pos;
+        if (p >= limit || p + tol + win > ws->in_len)
+            break;
+
+        int start = p;
+        if (ws->prev >= 0) {
+            int lo = p - tol, hi = p + tol;
+            if (lo < 0) lo = 0;
+            start = best_offset(ws->in, ws->in + ws->prev, lo, hi, win);
+        }
+
+        const short *frame = ws->in + start;
+        for (int i = 0; i < win; i++)
+            ws->overlap[i] += ws->window[i] * frame[i];
+
+        for (int i = 0; i < hop; i++)
+            out[written++] = clip16(ws->overlap[i]);
+        memmove(ws->overlap, ws->overlap + hop, (win - hop) * sizeof(float));
+        memset(ws->overlap + win - hop, 0, hop * sizeof(float));
+
+        ws->prev = start + hop;
+        ws->pos += ws->hop_in;
+    }
+
+    /* Discard input no later frame can reach */
+    int drop = (int)ws->pos - tol;
+    if (ws->prev >= 0 && ws->prev < drop)
+        drop = ws->prev;
+    if (drop > 0) {
+        ws->in_len -= drop;
+        memmove(ws->in, ws->in + drop, ws->in_len * sizeof(short));
+        ws->pos -= drop;
+        if (ws->prev >= 0)
+            ws->prev -= drop;
+    }
+
+    return written;
+}
+
+WsolaState *wsola_new(int sample_rate, double max_speed)
+{
+    WsolaState *ws = calloc(1, sizeof(*ws));
+    if (!ws) return NULL;
+
+    if (max_speed < 1.0) max_speed = 1.0;
+    if (max_speed > WSOLA_MAX_SPEED) max_speed = WSOLA_MAX_SPEED;
+
+    ws->win = (sample_rate / 50) & ~7;
+    if (ws->win > WSOLA_MAX_WIN) ws->win = WSOLA_MAX_WIN;
+    if (ws->win < 16) ws->win = 16;
+    ws->hop_out = ws->win / 2;
+    ws->tolerance = sample_rate / 200;
+    ws->hop_in_max = (int)ceil(ws->hop_out * max_speed);
+    ws->in_cap = 2 * ws->win + 2 * ws->tolerance + ws->hop_in_max + WSOLA_CHUNK;
+
+    ws->window = malloc(ws->win * sizeof(float));
+    ws->overlap = calloc(ws->win, sizeof(float));
+    ws->in = malloc(ws->in_cap * sizeof(short));
+    if (!ws->window || !ws->overlap || !ws->in) {
+        wsola_free(ws);
+        return NULL;
+    }
+
+    for (int i = 0; i < ws->win; i++)
+        ws->window[i] = 0.5f - 0.5f * (float)cos(2.0 * M_PI * i / ws->win);
+
+    wsola_reset(ws, 1.0);
+    return ws;
+}
+
+void wsola_free(WsolaState *ws)
+{
+    if (!ws) return;
+    free(ws->window);
+    free(ws->overlap);
+    free(ws->in);
+    free(ws);
+}
+
+void wsola_reset(WsolaState *ws, double speed)
+{
+    if (speed < 1.0) speed = 1.0;
+    ws->hop_in = ws->hop_out * speed;
+    if (ws->hop_in > ws->hop_in_max)
+        ws->hop_in = ws->hop_in_max;
+    ws->in_len = 0;
+    ws->pos = 0;
+    ws->prev = -1;
+    memset(ws->overlap, 0, ws->win * sizeof(float));
+}
+
+int wsola_max_output(const WsolaState *ws, int n)
+{
+    int avail = ws->in_len + n + ws->win + ws->tolerance;
+    return ((int)(avail / ws->hop_in) + 2) * ws->hop_out;
+}
+
+int wsola_process(WsolaState *ws, const short *in, int n, short *out)
+{
+    int written = 0;
+
+    while (n > 0) {
+        int room = ws->in_cap - ws->in_len;
+        int take = n < room ? n : room;
+
+        memcpy(ws->in + ws->in_len, in, take * sizeof(short));
+        ws->in_len += take;
+        in += take;
+        n -= take;
+
+        written += run_frames(ws, out + written, ws->in_len);
+    }
+    return written;
+}
+
+int wsola_flush(WsolaState *ws, short *out)
+{
+    int end = ws->in_len;
+
+    /* Pad with silence so the frames covering the tail can run */
+    int pad = ws->win + ws->tolerance;
+    if (ws->in_len + pad > ws->in_cap)
+        pad = ws->in_cap - ws->in_len;
+    memset(ws->in + ws->in_len, 0, pad * sizeof(short));
+    ws->in_len += pad;
+
+    int written = run_frames(ws, out, end);
+
+    /* Second half of the last frame is still in the accumulator */
+    if (ws->prev >= 0) {
+        for (int i = 0; i < ws->hop_out; i++)
+            out[written++] = clip16(ws->overlap[i]);
+    }
+
+    wsola_reset(ws, ws->hop_in / ws->hop_out);
+    return written;
+}
@@ -0,0 +1,36 @@
+/*
+ * wsola.h - Pitch-preserving time compression (WSOLA)
+ *
+ * Copyright (C) 2025
+ */
+
+#ifndef _WSOLA_H
+#define _WSOLA_H
+
+/* Highest speed-up factor the stretcher accepts */
+#define WSOLA_MAX_SPEED 3.0
+
+typedef struct WsolaState WsolaState;
+
+/* Create a stretcher for 16-bit mono PCM at the given sample rate.
+ * max_speed bounds the factor later passed to wsola_reset(). */
+WsolaState *wsola_new(int sample_rate, double max_speed);
+void wsola_free(WsolaState *ws);
+
+/* Drop any buffered audio and start a new stream at the given speed
+ * (1.0 = unchanged, 2.0 = twice as fast). */
+void wsola_reset(WsolaState *ws, double speed);
+
+/* Upper bound on the samples produced by feeding n more samples, or by
+ * wsola_flush() when n is 0. */
+int wsola_max_output(const WsolaState *ws, int n);
+
+/* Feed n samples, writing compressed output to out.  Returns the number
+ * of samples written.  Output lags input by at most one frame plus the
+ * search tolerance (about 25 ms). */
+int wsola_process(WsolaState *ws, const short *in, int n, short *out);
+
+/* End of stream: emit whatever is still buffered. */
+int wsola_flush(WsolaState *ws, short *out);
+
+#endif /* _WSOLA_H */